@@ -5,14 +5,22 @@
  *      Author: michal
  */
 
+#include <algorithm>
+#include <climits>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <stdexcept>
 #include <sys/epoll.h>
+#include <sys/uio.h>
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <linux/types.h>
 
 #include <boost/interprocess/sync/scoped_lock.hpp>
 #include <boost/interprocess/sync/interprocess_mutex.hpp>
+#include <boost/bind.hpp>
 #include <boost/thread.hpp>
 #include <boost/thread/thread_time.hpp>
 #include "boost/date_time/posix_time/posix_time.hpp"
@@ -32,13 +40,71 @@ using namespace amber;
 
 LoggerPtr AmberPipes::_logger (Logger::getLogger("Amber.Pipes"));
 
-AmberPipes::AmberPipes(MessageHandler *receiver, int pipeInFd, int pipeOutFd):
-		_messageHandler(receiver), _pipeInFd(pipeInFd), _pipeOutFd(pipeOutFd) {
+static const size_t sizeClasses[PIPE_OUT_SIZE_CLASSES] = { BUF_SIZE, 4096, 32768, PIPE_MAX_FRAME };
 
+// fixed size lockfree queues index their nodes with 16 bits and keep one spare, the pools hold a batch more than
+// the queue so it gives way to the batch
+AmberPipes::AmberPipes(MessageHandler *receiver, int pipeInFd, int pipeOutFd, unsigned int outQueueSize,
+		AmberPipesOverflow overflow, unsigned int batchSize, unsigned int latencyBudget):
+		_messageHandler(receiver), _pipeInFd(pipeInFd), _pipeOutFd(pipeOutFd), _pipeInStart(0), _pipeInEnd(0),
+		_overflow(overflow), _batchSize(std::min(std::max(batchSize, 1u), (unsigned int)IOV_MAX)),
+		_latencyBudget(latencyBudget), _outQueue(std::min(std::max(outQueueSize, 1u), 0xfffeu - _batchSize)),
+		_writerIdle(false), _writerHolding(false), _blockedProducers(0), _stopping(false), _dropped(0) {
+
+	_pipeInBuffer = new unsigned char[PIPE_IN_BUFFER_SIZE];
+
+	// every queued frame and a batch being written may come from one size
+	for (int i = 0; i < PIPE_OUT_SIZE_CLASSES; i++) {
+		_bufferPools[i] = new BufferQueue(std::min(std::max(outQueueSize, 1u), 0xfffeu - _batchSize) + _batchSize);
+	}
+
+	_batch = new AmberPipesBuffer *[_batchSize];
+	_iov = new struct iovec[_batchSize];
+
+	_writerThread = new boost::thread(boost::bind(&AmberPipes::writer, this));
 }
 
 AmberPipes::~AmberPipes() {
+	{
+		scoped_lock<interprocess_mutex> lock(_writerMutex);
+
+		_stopping = true;
+		_messageQueued.notify_one();
+		_queueDrained.notify_all();
+	}
+
+	// whatever is queued still goes out
+	_writerThread->join();
+	delete _writerThread;
+
+	AmberPipesBuffer *buffer;
+	while (_outQueue.pop(buffer)) {
+		delete buffer;
+	}
+
+	for (int i = 0; i < PIPE_OUT_SIZE_CLASSES; i++) {
+		while (_bufferPools[i]->pop(buffer)) {
+			delete buffer;
+		}
 
+		delete _bufferPools[i];
+	}
+
+	delete[] _batch;
+	delete[] _iov;
+	delete[] _pipeInBuffer;
+}
+
+AmberPipesOverflow AmberPipes::parseOverflow(const string& name) {
+	if (name == "block") {
+		return AMBER_PIPES_BLOCK;
+	}
+
+	if (name == "drop_oldest") {
+		return AMBER_PIPES_DROP_OLDEST;
+	}
+
+	throw std::invalid_argument("unknown pipe overflow policy: " + name);
 }
 
 
@@ -112,102 +178,116 @@ void AmberPipes::runProcess() {
 	}
 }
 
-ssize_t AmberPipes::readExact(ssize_t len) {
-	ssize_t in, got = 0;
-
-	do {
-		in = read(_pipeInFd, _pipeInBuffer + got, len - got);
-		if (in <= 0) {
-			if (got != len) {
-				LOG4CXX_FATAL(_logger, "Unexpected number of bytes read from pipe. Terminating.");
-				exit(1);
-			}
-			return got;
-		}
+// One read() takes whatever the pipe holds, every complete frame in it is handled,
+// a partial one waits in the buffer for the rest.
+void AmberPipes::readMsgFromPipe() {
 
-		got += in;
+	// the unhandled tail goes to the front once it can't grow in place
+	if (_pipeInStart == _pipeInEnd) {
+		_pipeInStart = _pipeInEnd = 0;
 
-	} while (got < len);
+	} else if (_pipeInStart > 0 && PIPE_IN_BUFFER_SIZE - _pipeInEnd < BUF_SIZE) {
+		memmove(_pipeInBuffer, _pipeInBuffer + _pipeInStart, _pipeInEnd - _pipeInStart);
+		_pipeInEnd -= _pipeInStart;
+		_pipeInStart = 0;
+	}
 
-	return len;
-}
+	ssize_t in = read(_pipeInFd, _pipeInBuffer + _pipeInEnd, PIPE_IN_BUFFER_SIZE - _pipeInEnd);
 
-ssize_t AmberPipes::writeExact(ssize_t len) {
+	if (in < 0 && (errno == EINTR || errno == EAGAIN)) {
+		throw PipeException();
+	}
 
-	if (_logger->isDebugEnabled()) {
-		LOG4CXX_DEBUG(_logger, "Writing " << len << " bytes to pipe.");
+	if (in <= 0) {
+		LOG4CXX_FATAL(_logger, "Unexpected number of bytes read from pipe. Terminating.");
+		exit(1);
 	}
 
-	ssize_t out, written = 0;
+	_pipeInEnd += in;
 
-	do {
-		out = write(_pipeOutFd, _pipeOutBuffer + written, len - written);
-	    if (out <= 0) {
-	    	return written;
-	    }
-	    written += out;
+	int frames = 0;
 
-	} while (written < len);
+	while (1) {
+		const unsigned char *frame = _pipeInBuffer + _pipeInStart;
+		size_t length = frameLength(frame, _pipeInEnd - _pipeInStart);
 
-	return len;
-}
+		if (length == 0) {
+			break;
+		}
 
-void AmberPipes::readMsgFromPipe() {
-	int len;
+		// consumed before handling, a handler that throws doesn't get it again
+		_pipeInStart += length;
+		frames++;
 
-	if (readExact(2) != 2) {
-		//LOG4CXX_ERROR(_logger, "Cannot read header length from pipe.");
-		throw PipeException();
+		try {
+			handleFrame(frame);
+		} catch (PipeException &e) {
+			continue;
+		}
 	}
 
-	len = (_pipeInBuffer[0] << 8) | _pipeInBuffer[1];
-
 	if (_logger->isDebugEnabled()) {
-		LOG4CXX_DEBUG(_logger, "Header length: " << len);
+		LOG4CXX_DEBUG(_logger, "Read " << in << " bytes from pipe, frames: " << frames
+				<< ", left over: " << _pipeInEnd - _pipeInStart);
 	}
+}
 
-	if (readExact(len) != len) {
-		//LOG4CXX_ERROR(_logger, "Cannot read header from pipe.");
-		throw PipeException();
+// 0 if the frame isn't complete yet
+size_t AmberPipes::frameLength(const unsigned char *frame, size_t available) {
+	if (available < 2) {
+		return 0;
 	}
 
-	DriverHdr header;
-	if (!header.ParseFromArray(_pipeInBuffer, len)) {
-		LOG4CXX_ERROR(_logger, "Cannot deserialize the header.");
-		throw PipeException();
-	}
+	size_t headerLen = (frame[0] << 8) | frame[1];
 
-	if (readExact(2) != 2) {
-		LOG4CXX_ERROR(_logger, "Cannot read message length from pipe.");
-		throw PipeException();
+	if (available < 2 + headerLen + 2) {
+		return 0;
 	}
 
-	len = (_pipeInBuffer[0] << 8) | _pipeInBuffer[1];
+	size_t frameLen = 2 + headerLen + 2 + ((frame[2 + headerLen] << 8) | frame[2 + headerLen + 1]);
+
+	return available < frameLen ? 0 : frameLen;
+}
+
+void AmberPipes::handleFrame(const unsigned char *frame) {
+	int len = (frame[0] << 8) | frame[1];
 
-	if (readExact(len) != len) {
-		LOG4CXX_ERROR(_logger, "Cannot read message from pipe.");
+	if (_logger->isDebugEnabled()) {
+		LOG4CXX_DEBUG(_logger, "Header length: " << len);
+	}
+
+	DriverHdr header;
+	if (!header.ParseFromArray(frame + 2, len)) {
+		LOG4CXX_ERROR(_logger, "Cannot deserialize the header.");
 		throw PipeException();
 	}
 
+	frame += 2 + len;
+	len = (frame[0] << 8) | frame[1];
+
 	DriverMsg message;
-	if (!message.ParseFromArray(_pipeInBuffer, len)) {
+	if (!message.ParseFromArray(frame + 2, len)) {
 		LOG4CXX_ERROR(_logger, "Cannot deserialize the message.");
 		throw PipeException();
 	}
 
-	switch (message.type()) {
+	dispatchMsg(&header, &message);
+}
+
+void AmberPipes::dispatchMsg(DriverHdr *header, DriverMsg *message) {
+	switch (message->type()) {
 
 	case DriverMsg_MsgType_DATA:
-		_messageHandler->handleDataMsg(&header, &message);
+		_messageHandler->handleDataMsg(header, message);
 		break;
 
 	case DriverMsg_MsgType_CLIENT_DIED:
-		if (header.clientids_size() != 1) {
+		if (header->clientids_size() != 1) {
 			LOG4CXX_WARN(_logger, "CLIENT_DIED message came, but clientID not set, ignoring.");
 			break;
 		}
 
-		_messageHandler->handleClientDiedMsg(header.clientids(0));
+		_messageHandler->handleClientDiedMsg(header->clientids(0));
 		break;
 
 	default:
@@ -217,44 +297,326 @@ void AmberPipes::readMsgFromPipe() {
 }
 
 void AmberPipes::writeMsgToPipe(DriverHdr *header, DriverMsg *message) {
-	scoped_lock<interprocess_mutex> lock(_pipeWriteMutex);
+	int messageLen = messageSize(message);
+	AmberPipesBuffer *buffer = frameHeader(header, messageLen);
+
+	// Serialize the message
+	message->SerializeWithCachedSizesToArray(buffer->data + buffer->length);
+	buffer->length += messageLen;
+
+	enqueue(buffer);
+}
+
+void AmberPipes::writeMsgToPipe(const vector<int>& clientIds, DriverMsg *message) {
+	int messageLen = messageSize(message);
+
+	// queued only once the next frame has its copy of the message
+	AmberPipesBuffer *previous = NULL;
+	const unsigned char *serialized = NULL;
+
+	for (size_t first = 0; first < clientIds.size(); first += PIPE_MAX_RECIPIENTS) {
+		size_t last = std::min(clientIds.size(), first + PIPE_MAX_RECIPIENTS);
+
+		DriverHdr header;
+		for (size_t i = first; i < last; i++) {
+			header.add_clientids(clientIds[i]);
+		}
 
-	int len, act = 0;
+		AmberPipesBuffer *buffer;
+		try {
+			buffer = frameHeader(&header, messageLen);
+		} catch (PipeException &e) {
+			if (previous != NULL) {
+				releaseBuffer(previous);
+			}
+			throw;
+		}
+
+		unsigned char *data = buffer->data + buffer->length;
+		if (serialized == NULL) {
+			message->SerializeWithCachedSizesToArray(data);
+		} else {
+			memcpy(data, serialized, messageLen);
+		}
+
+		buffer->length += messageLen;
+		serialized = data;
+
+		if (previous != NULL) {
+			enqueue(previous);
+		}
+		previous = buffer;
+	}
+
+	if (previous != NULL) {
+		enqueue(previous);
+	}
+}
+
+// it goes behind a 16 bit length
+int AmberPipes::messageSize(DriverMsg *message) {
+	int messageLen = message->ByteSize();
+
+	if (messageLen > 0xffff) {
+		LOG4CXX_ERROR(_logger, "Cannot serialize the message, " << messageLen << " bytes long.");
+		throw PipeException();
+	}
+
+	if (_logger->isDebugEnabled()) {
+		LOG4CXX_DEBUG(_logger, "Message is " << messageLen << " bytes long.");
+	}
+
+	return messageLen;
+}
+
+// a buffer for the whole frame, filled up to where the message goes, length says where
+AmberPipesBuffer *AmberPipes::frameHeader(DriverHdr *header, int messageLen) {
+	int headerLen = header->ByteSize();
+
+	if (headerLen > 0xffff) {
+		LOG4CXX_ERROR(_logger, "Cannot serialize the header, " << headerLen << " bytes long.");
+		throw PipeException();
+	}
+
+	AmberPipesBuffer *buffer = takeBuffer(2 + headerLen + 2 + messageLen);
+	unsigned char *data = buffer->data;
+
+	int act = 0;
 
 	// Header length
-	len = header->ByteSize();
-	_pipeOutBuffer[act] = (__u8)((len >> 8) & 0xff);
-	_pipeOutBuffer[act + 1] = (__u8)(len & 0xff);
+	data[act] = (__u8)((headerLen >> 8) & 0xff);
+	data[act + 1] = (__u8)(headerLen & 0xff);
 	act += 2;
 
 	// Serialize the header
-	if (!header->SerializeToArray(_pipeOutBuffer + act, BUF_SIZE - act)) {
-		LOG4CXX_ERROR(_logger, "Cannot serialize the header.");
-		throw PipeException();
-	}
-	act += len;
+	header->SerializeWithCachedSizesToArray(data + act);
+	act += headerLen;
 
 	// Message length
-	len = message->ByteSize();
-	_pipeOutBuffer[act] = (__u8)((len >> 8) & 0xff);
-	_pipeOutBuffer[act + 1] = (__u8)(len & 0xff);
+	data[act] = (__u8)((messageLen >> 8) & 0xff);
+	data[act + 1] = (__u8)(messageLen & 0xff);
 	act += 2;
 
-	if (_logger->isDebugEnabled()) {
-		LOG4CXX_DEBUG(_logger, "Message is " << len << " bytes long.");
+	buffer->length = act;
+
+	return buffer;
+}
+
+// a spare from the smallest size that fits, a new one only if there are none
+AmberPipesBuffer *AmberPipes::takeBuffer(size_t length) {
+	int sizeClass = 0;
+	while (sizeClasses[sizeClass] < length) {
+		sizeClass++;
 	}
 
-	// Serialize the message
-	if (!message->SerializeToArray(_pipeOutBuffer + act, BUF_SIZE - act)) {
-		LOG4CXX_ERROR(_logger, "Cannot serialize the message.");
-		throw PipeException();
+	AmberPipesBuffer *buffer;
+
+	if (_bufferPools[sizeClass]->pop(buffer)) {
+		return buffer;
 	}
-	act += len;
 
-	// Write whole packet to pipe
-	if (writeExact(act) != act) {
-		LOG4CXX_ERROR(_logger, "Cannot write the packet to pipe.");
-		throw PipeException();
+	return new AmberPipesBuffer(sizeClass, sizeClasses[sizeClass]);
+}
+
+void AmberPipes::releaseBuffer(AmberPipesBuffer *buffer) {
+	if (!_bufferPools[buffer->sizeClass]->bounded_push(buffer)) {
+		delete buffer;
+	}
+}
+
+void AmberPipes::enqueue(AmberPipesBuffer *buffer) {
+	bool pushed = _outQueue.bounded_push(buffer);
+
+	while (!pushed && _overflow == AMBER_PIPES_DROP_OLDEST) {
+		AmberPipesBuffer *oldest;
+
+		if (_outQueue.pop(oldest)) {
+			releaseBuffer(oldest);
+			_dropped++;
+
+			// the queue is full, a writer holding its batch back for more frames has them
+			if (_writerHolding.load()) {
+				scoped_lock<interprocess_mutex> lock(_writerMutex);
+				_messageQueued.notify_one();
+			}
+		}
+
+		pushed = _outQueue.bounded_push(buffer);
+	}
+
+	if (!pushed) {
+		scoped_lock<interprocess_mutex> lock(_writerMutex);
+
+		// pairs with the fence in writer(), either it sees us waiting or we see the room it made
+		_blockedProducers++;
+		boost::atomic_thread_fence(boost::memory_order_seq_cst);
+
+		pushed = _outQueue.bounded_push(buffer);
+		while (!pushed && !_stopping) {
+			// a writer holding its batch back for more frames has them
+			_messageQueued.notify_one();
+			_queueDrained.wait(lock);
+			pushed = _outQueue.bounded_push(buffer);
+		}
+
+		_blockedProducers--;
+
+		if (!pushed) {
+			releaseBuffer(buffer);
+			return;
+		}
+	}
+
+	// pairs with the fence in waitForMessages()
+	boost::atomic_thread_fence(boost::memory_order_seq_cst);
+
+	if (_writerIdle.load()) {
+		scoped_lock<interprocess_mutex> lock(_writerMutex);
+		_messageQueued.notify_one();
+	}
+}
+
+void AmberPipes::writer() {
+	LOG4CXX_INFO(_logger, "Pipe writer thread started, overflow: "
+			<< (_overflow == AMBER_PIPES_BLOCK ? "block" : "drop_oldest")
+			<< ", batch size: " << _batchSize << ", latency budget: " << _latencyBudget << "us");
+
+	AmberPipesBuffer **batch = _batch;
+	unsigned int reportedDrops = 0;
+	boost::system_time nextReportTime = boost::get_system_time();
+
+	while (1) {
+		int count = waitForMessages(batch);
+		if (count == 0) {
+			return;
+		}
+
+		count = collectBatch(batch, count);
+
+		boost::atomic_thread_fence(boost::memory_order_seq_cst);
+
+		if (_blockedProducers.load() > 0) {
+			scoped_lock<interprocess_mutex> lock(_writerMutex);
+			_queueDrained.notify_all();
+		}
+
+		writeBatch(batch, count);
+
+		for (int i = 0; i < count; i++) {
+			releaseBuffer(batch[i]);
+		}
+
+		unsigned int dropped = _dropped.load();
+		if (dropped != reportedDrops && boost::get_system_time() >= nextReportTime) {
+			LOG4CXX_WARN(_logger, "Pipe is not drained fast enough, messages dropped: " << dropped - reportedDrops);
+
+			reportedDrops = dropped;
+			nextReportTime = boost::get_system_time() + boost::posix_time::seconds(1);
+		}
+	}
+}
+
+// blocks until there is something to write, 0 once stopping with the queue empty
+int AmberPipes::waitForMessages(AmberPipesBuffer **batch) {
+	if (_outQueue.pop(batch[0])) {
+		return 1;
+	}
+
+	scoped_lock<interprocess_mutex> lock(_writerMutex);
+
+	_writerIdle = true;
+	boost::atomic_thread_fence(boost::memory_order_seq_cst);
+
+	while (!_outQueue.pop(batch[0])) {
+		if (_stopping) {
+			_writerIdle = false;
+			return 0;
+		}
+
+		_messageQueued.wait(lock);
+	}
+
+	_writerIdle = false;
+
+	return 1;
+}
+
+// tops the batch up from the queue, waiting out the latency budget for frames still to come
+int AmberPipes::collectBatch(AmberPipesBuffer **batch, int count) {
+	boost::system_time deadline = boost::get_system_time() + boost::posix_time::microseconds(_latencyBudget);
+	bool waiting = _latencyBudget > 0;
+
+	while (count < _batchSize) {
+		if (_outQueue.pop(batch[count])) {
+			count++;
+			continue;
+		}
+
+		if (!waiting) {
+			break;
+		}
+
+		scoped_lock<interprocess_mutex> lock(_writerMutex);
+
+		// producers only signal a full queue, and they do it under the lock
+		if (_outQueue.pop(batch[count])) {
+			count++;
+			continue;
+		}
+
+		if (_stopping) {
+			break;
+		}
+
+		// one more pass once it times out
+		_writerHolding = true;
+		waiting = _messageQueued.timed_wait(lock, deadline);
+		_writerHolding = false;
+	}
+
+	return count;
+}
+
+void AmberPipes::writeBatch(AmberPipesBuffer **batch, int count) {
+	struct iovec *iov = _iov;
+	size_t total = 0;
+
+	for (int i = 0; i < count; i++) {
+		iov[i].iov_base = batch[i]->data;
+		iov[i].iov_len = batch[i]->length;
+		total += batch[i]->length;
+	}
+
+	if (_logger->isDebugEnabled()) {
+		LOG4CXX_DEBUG(_logger, "Writing " << total << " bytes to pipe, frames: " << count);
+	}
+
+	struct iovec *next = iov;
+	int left = count;
+
+	while (left > 0) {
+		ssize_t out = writev(_pipeOutFd, next, left);
+
+		if (out < 0 && errno == EINTR) {
+			continue;
+		}
+
+		if (out <= 0) {
+			LOG4CXX_ERROR(_logger, "Cannot write the packet to pipe.");
+			return;
+		}
+
+		// a partial write resumes in the middle of a frame
+		while (left > 0 && (size_t)out >= next->iov_len) {
+			out -= (ssize_t)next->iov_len;
+			next++;
+			left--;
+		}
+
+		if (left > 0) {
+			next->iov_base = (unsigned char *)next->iov_base + out;
+			next->iov_len -= (size_t)out;
+		}
 	}
 }
 
@@ -9,16 +9,67 @@
 #define AMBERPIPES_H_
 
 #include <exception>
+#include <string>
+#include <vector>
+#include <sys/uio.h>
+#include <boost/atomic.hpp>
+#include <boost/lockfree/queue.hpp>
+#include <boost/thread.hpp>
+#include <boost/interprocess/sync/interprocess_condition.hpp>
 #include <boost/interprocess/sync/interprocess_mutex.hpp>
 
 #include <log4cxx/logger.h>
 #include "drivermsg.pb.h"
 
+// the smallest frame buffer, and the least room a read gets
 #define BUF_SIZE 512
 #define MAX_EVENTS 2
 
+// two length prefixes and the longest header and message they can describe
+#define PIPE_MAX_FRAME (2 * (2 + 0xffff))
+
+// whatever part of a frame is left after a read always fits
+#define PIPE_IN_BUFFER_SIZE PIPE_MAX_FRAME
+
+// messages waiting for the writer thread, by default
+#define PIPE_OUT_QUEUE_SIZE 64
+
+// frames handed to one writev(), by default; never more than IOV_MAX
+#define PIPE_OUT_BATCH 16
+
+// frame buffers come in BUF_SIZE, 4KB, 32KB and PIPE_MAX_FRAME sizes, allocated
+// when first needed and kept for reuse, never more than the queue and a batch hold
+#define PIPE_OUT_SIZE_CLASSES 4
+
+// client ids in one header, packed ids of 10 bytes at most keep it within 16 bit length
+#define PIPE_MAX_RECIPIENTS 6500
+
 class PipeException: public std::exception {};
 
+// what writeMsgToPipe() does when the writer thread is pipe_queue_size messages behind
+enum AmberPipesOverflow {
+	AMBER_PIPES_BLOCK = 0,		// waits until the writer makes room
+	AMBER_PIPES_DROP_OLDEST		// the oldest message waiting is dropped
+};
+
+// one serialized frame, in the smallest size class it fits
+struct AmberPipesBuffer {
+	unsigned char *data;
+	size_t capacity;
+	size_t length;
+	int sizeClass;
+
+	AmberPipesBuffer(int sizeClassIndex, size_t size): data(new unsigned char[size]), capacity(size),
+			length(0), sizeClass(sizeClassIndex) {};
+	~AmberPipesBuffer() {
+		delete[] data;
+	}
+
+private:
+	AmberPipesBuffer(const AmberPipesBuffer&);
+	AmberPipesBuffer& operator=(const AmberPipesBuffer&);
+};
+
 class MessageHandler {
 public:
 	virtual ~MessageHandler() {};
@@ -26,31 +77,88 @@ public:
 	virtual void handleClientDiedMsg(int clientID) = 0;
 };
 
+/*
+ * Messages are framed on the caller's thread and queued, one writer thread
+ * puts them on the pipe, so a slow mediator holds up nobody but the writer
+ * until the queue fills up.
+ *
+ * The writer takes up to batchSize frames per writev(). With a latency
+ * budget (us) it holds the first frame that long for more to join it,
+ * so a scheduler pass answering many clients costs one syscall, not one
+ * per client. A full queue cuts the wait short.
+ */
 class AmberPipes {
 public:
-	AmberPipes(MessageHandler *messageHandler, int pipeInFd, int pipeOutFd);
+	AmberPipes(MessageHandler *messageHandler, int pipeInFd, int pipeOutFd,
+			unsigned int outQueueSize = PIPE_OUT_QUEUE_SIZE, AmberPipesOverflow overflow = AMBER_PIPES_BLOCK,
+			unsigned int batchSize = PIPE_OUT_BATCH, unsigned int latencyBudget = 0);
 	virtual ~AmberPipes();
 
+	// "block" or "drop_oldest", throws std::invalid_argument otherwise
+	static AmberPipesOverflow parseOverflow(const std::string& name);
+
 	void operator()();
 	void handlePingMsg(amber::DriverHdr *driverMsgHeader, amber::DriverMsg *driverMsg);
+
+	// throws PipeException if the header or the message is over 0xffff bytes, write errors are only logged
 	void writeMsgToPipe(amber::DriverHdr *driverMsgHeader, amber::DriverMsg *driverMsg);
 
+	// one frame addressed to all of them, or one per PIPE_MAX_RECIPIENTS; the message is serialized once
+	void writeMsgToPipe(const std::vector<int>& clientIds, amber::DriverMsg *driverMsg);
+
 private:
 	MessageHandler *_messageHandler;
 
 	int _pipeInFd, _pipeOutFd;
-	unsigned char _pipeInBuffer[BUF_SIZE];
-	unsigned char _pipeOutBuffer[BUF_SIZE];
 
-	boost::interprocess::interprocess_mutex _pipeWriteMutex;
+	// bytes read but not handled yet are [_pipeInStart, _pipeInEnd), pipes thread only
+	unsigned char *_pipeInBuffer;
+	size_t _pipeInStart;
+	size_t _pipeInEnd;
+
+	typedef boost::lockfree::queue<AmberPipesBuffer *, boost::lockfree::fixed_sized<true> > BufferQueue;
+
+	AmberPipesOverflow _overflow;
+	int _batchSize;
+	unsigned int _latencyBudget;	// us
+
+	// writer thread only
+	AmberPipesBuffer **_batch;
+	struct iovec *_iov;
+
+	BufferQueue _outQueue;
+	BufferQueue *_bufferPools[PIPE_OUT_SIZE_CLASSES];	// spare buffers by size, more are allocated if one runs dry
+
+	// only for sleeping, the queues don't need it
+	boost::interprocess::interprocess_mutex _writerMutex;
+	boost::interprocess::interprocess_condition _messageQueued;
+	boost::interprocess::interprocess_condition _queueDrained;
+	boost::atomic<bool> _writerIdle;
+	boost::atomic<bool> _writerHolding;	// waiting out the latency budget
+	boost::atomic<int> _blockedProducers;
+	bool _stopping;
+
+	boost::atomic<unsigned int> _dropped;
+
+	boost::thread *_writerThread;
 
 	static log4cxx::LoggerPtr _logger;
 
 	void readMsgFromPipe();
+	size_t frameLength(const unsigned char *frame, size_t available);
+	void handleFrame(const unsigned char *frame);
+	void dispatchMsg(amber::DriverHdr *header, amber::DriverMsg *message);
 	void runProcess();
 
-	ssize_t readExact(ssize_t len);
-	ssize_t writeExact(ssize_t len);
+	int messageSize(amber::DriverMsg *message);
+	AmberPipesBuffer *frameHeader(amber::DriverHdr *header, int messageLen);
+	AmberPipesBuffer *takeBuffer(size_t length);
+	void releaseBuffer(AmberPipesBuffer *buffer);
+	void enqueue(AmberPipesBuffer *buffer);
+	void writer();
+	int waitForMessages(AmberPipesBuffer **batch);
+	int collectBatch(AmberPipesBuffer **batch, int count);
+	void writeBatch(AmberPipesBuffer **batch, int count);
 };
 
 
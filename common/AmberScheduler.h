@@ -53,6 +53,13 @@ class AmberSchedulerListener {
 public:
 	virtual ~AmberSchedulerListener() {};
 	virtual void handleSchedulerEvent(int clientId, T *event) = 0;
+
+	// all entries due in one scheduler pass, override to share work between them
+	virtual void handleSchedulerEvents(std::vector<AmberSchedulerEntry<T>*>& entries) {
+		for (typename std::vector<AmberSchedulerEntry<T>*>::iterator it = entries.begin(); it != entries.end(); ++it) {
+			handleSchedulerEvent((*it)->clientId, (*it)->details);
+		}
+	}
 };
 
 template <class T>
@@ -74,6 +81,7 @@ private:
 	std::map<int, AmberSchedulerEntry<T>* > _schedulerMap;
 	//NinedofSchedulerSet _schedulerSet;
 	AmberSchedulerListener<T> *_listener;
+	boost::system_time _epoch;	// entries fire at multiples of their freq from here
 	boost::interprocess::interprocess_mutex _schedulerMutex;
 	boost::interprocess::interprocess_condition _noClient;
 
@@ -84,7 +92,8 @@ template <class T>
 LoggerPtr AmberScheduler<T>::_logger (Logger::getLogger("Amber.Scheduler"));
 
 template <class T>
-AmberScheduler<T>::AmberScheduler(AmberSchedulerListener<T> *listener): _listener(listener) {
+AmberScheduler<T>::AmberScheduler(AmberSchedulerListener<T> *listener): _listener(listener),
+		_epoch(boost::get_system_time()) {
 	//_logger->setLevel(Level::getOff());
 }
 
@@ -98,12 +107,19 @@ void AmberScheduler<T>::addClient(int clientId, int freq, T *details) {
 	boost::interprocess::scoped_lock<boost::interprocess::interprocess_mutex> lock(_schedulerMutex);
 
 	if (_schedulerMap.count(clientId) != 0) {
-		return;
+		if (!_schedulerMap[clientId]->outdated) {
+			return;
+		}
+
+		// removed but not popped yet, the queue deletes it
+		_schedulerMap.erase(clientId);
 	}
 
 	AmberSchedulerEntry<T> *entry = new AmberSchedulerEntry<T>(clientId, freq);
-	entry->nextTime = boost::get_system_time();
-	entry->nextTime += boost::posix_time::milliseconds(freq);
+
+	// aligned to the epoch, so clients at the same freq come due together
+	long long elapsed = (boost::get_system_time() - _epoch).total_milliseconds();
+	entry->nextTime = _epoch + boost::posix_time::milliseconds((elapsed / freq + 1) * freq);
 	entry->details = details;
 	
 	_schedulerMap.insert(std::pair<int, AmberSchedulerEntry<T>* >(clientId, entry));
@@ -141,6 +157,8 @@ void AmberScheduler<T>::runScheduler() {
 	LOG4CXX_INFO(_logger, "Scheduler thread started.");
 
 	boost::system_time actTime;
+	boost::system_time nextTime;
+	std::vector<AmberSchedulerEntry<T>*> dueEntries;
 
 	while (1) {
 		{
@@ -170,21 +188,45 @@ void AmberScheduler<T>::runScheduler() {
 
 				if (entry->outdated) {
 					//LOG4CXX_DEBUG(_logger, "Outdated: " << entry->clientId);
-					_schedulerMap.erase(entry->clientId);
+					// the client may have subscribed again in the meantime
+					if (_schedulerMap.count(entry->clientId) > 0 && _schedulerMap[entry->clientId] == entry) {
+						_schedulerMap.erase(entry->clientId);
+					}
 					//LOG4CXX_DEBUG(_logger, "After utdated: " << entry->clientId);
 					delete entry;
 				} else {
-					_listener->handleSchedulerEvent(entry->clientId, entry->details);
-					entry->nextTime += boost::posix_time::milliseconds(entry->freq);
-					//LOG4CXX_DEBUG(_logger, "Adding back: " << entry->clientId << " millis: " << entry->nextTime.time_of_day().total_milliseconds());
-					_schedulerQueue.push(entry);
+					dueEntries.push_back(entry);
 				}
 			}
+
+			if (!dueEntries.empty()) {
+				_listener->handleSchedulerEvents(dueEntries);
+			}
+
+			for (typename std::vector<AmberSchedulerEntry<T>*>::iterator it = dueEntries.begin(); it != dueEntries.end(); ++it) {
+				AmberSchedulerEntry<T> *entry = *it;
+
+				// fell behind, skip the missed periods but keep the phase
+				do {
+					entry->nextTime += boost::posix_time::milliseconds(entry->freq);
+				} while (entry->nextTime <= actTime);
+
+				//LOG4CXX_DEBUG(_logger, "Adding back: " << entry->clientId << " millis: " << entry->nextTime.time_of_day().total_milliseconds());
+				_schedulerQueue.push(entry);
+			}
+
+			dueEntries.clear();
+
+			if (_schedulerQueue.empty()) {
+				continue;
+			}
+
+			nextTime = _schedulerQueue.top()->nextTime;
 		}
 
 
 		//LOG4CXX_DEBUG(_logger, "Going sleep: ");
-		boost::thread::sleep(_schedulerQueue.top()->nextTime);
+		boost::thread::sleep(nextTime);
 	}
 }
 
@@ -0,0 +1,70 @@
+/*
+ * AmberSeqlock.h
+ *
+ *  Created on: 17-10-2026
+ */
+
+#ifndef AMBERSEQLOCK_H_
+#define AMBERSEQLOCK_H_
+
+#include <boost/atomic.hpp>
+#include <boost/interprocess/sync/interprocess_mutex.hpp>
+#include <boost/interprocess/sync/scoped_lock.hpp>
+
+/*
+ * Latest-value cell for plain data structs. Readers never block and never
+ * take a lock, they retry if a write was in progress. Writers are serialized
+ * with a mutex, so any thread may publish.
+ */
+template <class T>
+class AmberSeqlock {
+public:
+	AmberSeqlock(): _sequence(0), _value() {};
+
+	AmberSeqlock(const T& value): _sequence(0), _value(value) {};
+
+	void write(const T& value) {
+		boost::interprocess::scoped_lock<boost::interprocess::interprocess_mutex> lock(_writeMutex);
+
+		// odd sequence means write in progress
+		unsigned int sequence = _sequence.load(boost::memory_order_relaxed);
+		_sequence.store(sequence + 1, boost::memory_order_relaxed);
+		boost::atomic_thread_fence(boost::memory_order_release);
+
+		_value = value;
+
+		_sequence.store(sequence + 2, boost::memory_order_release);
+	}
+
+	T read() const {
+		T value;
+		unsigned int before, after;
+
+		do {
+			before = _sequence.load(boost::memory_order_acquire);
+
+			if (before & 1) {
+				continue;
+			}
+
+			value = _value;
+
+			boost::atomic_thread_fence(boost::memory_order_acquire);
+			after = _sequence.load(boost::memory_order_relaxed);
+
+		} while ((before & 1) || before != after);
+
+		return value;
+	}
+
+private:
+	boost::atomic<unsigned int> _sequence;
+	T _value;
+
+	boost::interprocess::interprocess_mutex _writeMutex;
+
+	AmberSeqlock(const AmberSeqlock&);
+	AmberSeqlock& operator=(const AmberSeqlock&);
+};
+
+#endif /* AMBERSEQLOCK_H_ */
@@ -9,6 +9,7 @@
 #define NINEDOFCOMMIN_H_
 
 #include <linux/types.h>
+#include <string>
 
 struct axes_data {
 	__s16 x_axis;
@@ -29,6 +30,11 @@ struct NinedofConfiguration {
 
 	std::string i2c_port;
 
+	__u32 pipe_queue_size;
+	std::string pipe_overflow;	// block or drop_oldest
+	__u32 pipe_batch_size;
+	__u32 pipe_latency_budget;	// us
+
 };
 
 #endif /* NINEDOFCOMMIN_H_ */
@@ -33,7 +33,9 @@ NinedofController::NinedofController(int pipeInFd, int pipeOutFd, const char *co
 
 	_ninedofDriver = new NinedofDriver(_configuration);
 	_amberScheduler = new AmberScheduler<NinedofSchedulerEntry>(this);
-	_amberPipes = new AmberPipes(this, pipeInFd, pipeOutFd);
+	_amberPipes = new AmberPipes(this, pipeInFd, pipeOutFd, _configuration->pipe_queue_size,
+			AmberPipes::parseOverflow(_configuration->pipe_overflow), _configuration->pipe_batch_size,
+			_configuration->pipe_latency_budget);
 
 	_dataStruct = _ninedofDriver->getDataStruct();
 
@@ -113,18 +115,28 @@ int NinedofController::toDPS(__s16 value) {
 DriverMsg *NinedofController::buildSensorDataMsg(bool accel, bool gyro, bool magnet) {
 	scoped_lock<interprocess_mutex> lock(_ninedofDriver->dataMutex);
 
-	_ninedofDriver->needToGetData = true;
-	_ninedofDriver->noNeedToGetData.notify_one();
-
-	_ninedofDriver->dataNotReady.wait(lock);
+	readSensorData(lock);
 
 	DriverMsg *message = new DriverMsg();
 	message->set_type(DriverMsg_MsgType_DATA);
 
-	ninedof_proto::SensorData *sensorData = message->MutableExtension(ninedof_proto::sensorData);
-
 	//LOG4CXX_DEBUG(_logger, "buildSensorDataMsg " << accel << " " << gyro << " " << magnet);
 
+	fillSensorData(message->MutableExtension(ninedof_proto::sensorData), accel, gyro, magnet);
+
+	return message;
+}
+
+// wakes the driver up for a fresh reading and waits for it, dataMutex held
+void NinedofController::readSensorData(scoped_lock<interprocess_mutex>& lock) {
+	_ninedofDriver->needToGetData = true;
+	_ninedofDriver->noNeedToGetData.notify_one();
+
+	_ninedofDriver->dataNotReady.wait(lock);
+}
+
+// from the last reading, dataMutex held
+void NinedofController::fillSensorData(ninedof_proto::SensorData *sensorData, bool accel, bool gyro, bool magnet) {
 	ninedof_proto::SensorData::AxisData *axisData;
 	if (accel) {
 		axisData = sensorData->mutable_accel();
@@ -146,8 +158,6 @@ DriverMsg *NinedofController::buildSensorDataMsg(bool accel, bool gyro, bool mag
 		axisData->set_yaxis(toMilliGauss(_dataStruct->magnet.y_axis));
 		axisData->set_zaxis(toMilliGauss(_dataStruct->magnet.z_axis));
 	}
-
-	return message;
 }
 
 void NinedofController::handleSchedulerEvent(int clientId, NinedofSchedulerEntry *entry) {
@@ -162,6 +172,50 @@ void NinedofController::handleSchedulerEvent(int clientId, NinedofSchedulerEntry
 	sendSensorDataMsg(clientId, 0, entry->accel, entry->gyro, entry->magnet);
 }
 
+// Subscribers due together share one reading and get one message per set of
+// axes, serialized once and addressed to all of them.
+void NinedofController::handleSchedulerEvents(vector<AmberSchedulerEntry<NinedofSchedulerEntry>*>& entries) {
+	// indexed by axes: 1 - accel, 2 - gyro, 4 - magnet
+	vector<int> recipients[8];
+
+	for (vector<AmberSchedulerEntry<NinedofSchedulerEntry>*>::iterator it = entries.begin(); it != entries.end(); ++it) {
+		NinedofSchedulerEntry *entry = (*it)->details;
+		int axes = (entry->accel ? 1 : 0) | (entry->gyro ? 2 : 0) | (entry->magnet ? 4 : 0);
+
+		recipients[axes].push_back((*it)->clientId);
+	}
+
+	if (_logger->isDebugEnabled()) {
+		LOG4CXX_DEBUG(_logger, "Handling scheduler events, clients: " << entries.size());
+	}
+
+	DriverMsg messages[8];
+
+	{
+		scoped_lock<interprocess_mutex> lock(_ninedofDriver->dataMutex);
+
+		readSensorData(lock);
+
+		for (int axes = 0; axes < 8; axes++) {
+			if (recipients[axes].empty()) {
+				continue;
+			}
+
+			messages[axes].set_type(DriverMsg_MsgType_DATA);
+			messages[axes].set_acknum(0);
+
+			fillSensorData(messages[axes].MutableExtension(ninedof_proto::sensorData),
+					axes & 1, axes & 2, axes & 4);
+		}
+	}
+
+	for (int axes = 0; axes < 8; axes++) {
+		if (!recipients[axes].empty()) {
+			_amberPipes->writeMsgToPipe(recipients[axes], &messages[axes]);
+		}
+	}
+}
+
 void NinedofController::handleDataMsg(DriverHdr *driverHdr, DriverMsg *driverMsg) {
 
 	// TODO: hack for now
@@ -207,6 +261,10 @@ void NinedofController::parseConfigurationFile(const char *filename) {
 	options_description desc("Ninedof options");
 	desc.add_options()
 			("ninedof.i2c_port", value<string>(&_configuration->i2c_port)->default_value("/dev/i2c-4"))
+			("ninedof.pipe_queue_size", value<unsigned int>(&_configuration->pipe_queue_size)->default_value(PIPE_OUT_QUEUE_SIZE))
+			("ninedof.pipe_overflow", value<string>(&_configuration->pipe_overflow)->default_value("drop_oldest"))
+			("ninedof.pipe_batch_size", value<unsigned int>(&_configuration->pipe_batch_size)->default_value(PIPE_OUT_BATCH))
+			("ninedof.pipe_latency_budget", value<unsigned int>(&_configuration->pipe_latency_budget)->default_value(0))
 	;
 
 	variables_map vm;
@@ -215,8 +273,12 @@ void NinedofController::parseConfigurationFile(const char *filename) {
 		store(parse_config_file<char>(filename, desc), vm);
 		notify(vm);
 
+		// a typo fails here, not once the pipes are created
+		AmberPipes::parseOverflow(_configuration->pipe_overflow);
+
 	} catch (std::exception& e) {
 		LOG4CXX_ERROR(_logger, "Error in parsing configuration file: " << e.what());
+		exit(1);
 	}
 
 }
@@ -7,6 +7,7 @@
 #ifndef NINEDOFCONTROLLER_H_
 #define NINEDOFCONTROLLER_H_
 
+#include <vector>
 #include <log4cxx/logger.h>
 #include <boost/thread.hpp>
 #include <boost/ref.hpp>
@@ -43,6 +44,7 @@ public:
 	void handleDataRequestMsg(int sender, int synNum, amber::ninedof_proto::DataRequest *dataRequest);
 	void handleSubscribeActionMsg(int sender, amber::ninedof_proto::SubscribeAction *subscribeAction);
 	void handleSchedulerEvent(int clientId, NinedofSchedulerEntry *entry);
+	void handleSchedulerEvents(std::vector<AmberSchedulerEntry<NinedofSchedulerEntry>*>& entries);
 	void handleDataMsg(amber::DriverHdr *driverHdr, amber::DriverMsg *driverMsg);
 	void handleClientDiedMsg(int clientID);
 	void operator()();
@@ -61,6 +63,8 @@ private:
 	static log4cxx::LoggerPtr _logger;
 
 	amber::DriverMsg *buildSensorDataMsg(bool accel, bool gyro, bool magnet);
+	void readSensorData(boost::interprocess::scoped_lock<boost::interprocess::interprocess_mutex>& lock);
+	void fillSensorData(amber::ninedof_proto::SensorData *sensorData, bool accel, bool gyro, bool magnet);
 	void parseConfigurationFile(const char *filename);
 
 	int toMilliG(__s16 value);
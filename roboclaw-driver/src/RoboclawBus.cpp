@@ -0,0 +1,193 @@
+/*
+ * RoboclawBus.cpp
+ *
+ *  Created on: 17-10-2026
+ */
+
+#include <cstring>
+
+#include <boost/bind.hpp>
+#include <boost/interprocess/sync/scoped_lock.hpp>
+
+#include "RoboclawBus.h"
+#include "RoboclawLib.h"
+
+using namespace boost;
+using namespace boost::interprocess;
+using namespace log4cxx;
+
+LoggerPtr RoboclawBus::_logger (Logger::getLogger("Roboclaw.Bus"));
+
+// us from enqueue to start, after that the job counts as a deadline miss
+static const __u64 busDeadlines[RC_BUS_CLASSES] = { 5000, 10000, 20000, 100000 };
+
+static const char *busClassNames[RC_BUS_CLASSES] = { "safety", "motion", "speed read", "monitoring" };
+
+RoboclawBus::RoboclawBus(const std::string& name, unsigned int queueSize, unsigned int statsInterval):
+		_name(name), _queueSize(queueSize > 0 ? queueSize : 1), _statsInterval(statsInterval), _running(false),
+		_stopping(false), _busThread(NULL) {
+
+	memset(_stats, 0, sizeof(_stats));
+	_statsStart = rc_monotonic_us();
+}
+
+RoboclawBus::~RoboclawBus() {
+	{
+		scoped_lock<interprocess_mutex> lock(_busMutex);
+		_running = false;
+		_stopping = true;
+
+		// nobody is left to run them, whoever waits gets done with nothing filled in
+		for (int i = 0; i < RC_BUS_CLASSES; i++) {
+			for (std::deque<Job>::iterator it = _queues[i].begin(); it != _queues[i].end(); ++it) {
+				*it->done = true;
+			}
+			_queues[i].clear();
+		}
+
+		_jobQueued.notify_all();
+		_queueNotFull.notify_all();
+		_jobDone.notify_all();
+	}
+
+	if (_busThread != NULL) {
+		_busThread->join();
+		delete _busThread;
+	}
+}
+
+void RoboclawBus::start() {
+	LOG4CXX_INFO(_logger, "Starting bus thread, port: " << _name << ", queue size: " << _queueSize << ", stats interval: " << _statsInterval << "ms");
+
+	_running = true;
+	_busThread = new boost::thread(boost::ref(*this));
+}
+
+void RoboclawBus::execute(RoboclawBusClass busClass, boost::function<void ()> job) {
+	bool done = false;
+
+	submit(busClass, job, &done);
+	wait(&done);
+}
+
+void RoboclawBus::submit(RoboclawBusClass busClass, boost::function<void ()> job, bool *done) {
+
+	// jobs issued from the bus thread itself (e.g. stop from a monitoring job) run in place
+	if (_busThread != NULL && boost::this_thread::get_id() == _busThread->get_id()) {
+		job();
+
+		*done = true;
+		return;
+	}
+
+	scoped_lock<interprocess_mutex> lock(_busMutex);
+
+	if (_queues[busClass].size() >= _queueSize) {
+		_stats[busClass].queueFullWaits++;
+
+		while (!_stopping && _queues[busClass].size() >= _queueSize) {
+			_queueNotFull.wait(lock);
+		}
+	}
+
+	if (_stopping) {
+		*done = true;
+		_jobDone.notify_all();
+		return;
+	}
+
+	Job entry;
+	entry.work = job;
+	entry.enqueueTime = rc_monotonic_us();
+	entry.done = done;
+
+	_queues[busClass].push_back(entry);
+	_jobQueued.notify_one();
+}
+
+void RoboclawBus::wait(bool *done) {
+	scoped_lock<interprocess_mutex> lock(_busMutex);
+
+	while (!*done) {
+		_jobDone.wait(lock);
+	}
+}
+
+void RoboclawBus::operator()() {
+	boost::system_time nextStatsTime = boost::get_system_time() + boost::posix_time::milliseconds(_statsInterval);
+
+	scoped_lock<interprocess_mutex> lock(_busMutex);
+
+	while (_running) {
+		int busClass = 0;
+		while (busClass < RC_BUS_CLASSES && _queues[busClass].empty()) {
+			busClass++;
+		}
+
+		if (busClass == RC_BUS_CLASSES) {
+			if (_statsInterval > 0) {
+				_jobQueued.timed_wait(lock, nextStatsTime);
+			} else {
+				_jobQueued.wait(lock);
+			}
+
+		} else {
+			Job entry = _queues[busClass].front();
+			_queues[busClass].pop_front();
+			_queueNotFull.notify_all();
+
+			__u64 delay = rc_monotonic_us() - entry.enqueueTime;
+
+			RoboclawBusStats *stats = &_stats[busClass];
+			stats->jobs++;
+			stats->queueDelaySum += delay;
+			if (delay > stats->queueDelayMax) {
+				stats->queueDelayMax = delay;
+			}
+			if (delay > busDeadlines[busClass]) {
+				stats->deadlineMisses++;
+			}
+
+			lock.unlock();
+			__u64 start = rc_monotonic_us();
+			entry.work();
+			__u64 busy = rc_monotonic_us() - start;
+			lock.lock();
+
+			stats->busyTime += busy;
+
+			*entry.done = true;
+			_jobDone.notify_all();
+		}
+
+		if (_statsInterval > 0 && boost::get_system_time() >= nextStatsTime) {
+			logStats();
+			nextStatsTime = boost::get_system_time() + boost::posix_time::milliseconds(_statsInterval);
+		}
+	}
+}
+
+// called with _busMutex held
+void RoboclawBus::logStats() {
+	__u64 now = rc_monotonic_us();
+	__u64 elapsed = now > _statsStart ? now - _statsStart : 1;
+	__u64 busy = 0;
+
+	for (int i = 0; i < RC_BUS_CLASSES; i++) {
+		RoboclawBusStats *stats = &_stats[i];
+		busy += stats->busyTime;
+
+		if (stats->jobs > 0 || stats->queueFullWaits > 0) {
+			LOG4CXX_INFO(_logger, "Bus " << _name << ", " << busClassNames[i] << ": jobs: " << stats->jobs
+					<< ", queue delay avg: " << (stats->jobs > 0 ? stats->queueDelaySum / stats->jobs : 0)
+					<< "us, max: " << stats->queueDelayMax << "us, deadline misses: " << stats->deadlineMisses
+					<< ", queue full waits: " << stats->queueFullWaits
+					<< ", utilization: " << 100.0 * (double)stats->busyTime / (double)elapsed << "%");
+		}
+	}
+
+	LOG4CXX_INFO(_logger, "Bus " << _name << " utilization: " << 100.0 * (double)busy / (double)elapsed << "% over " << elapsed / 1000 << "ms");
+
+	memset(_stats, 0, sizeof(_stats));
+	_statsStart = now;
+}
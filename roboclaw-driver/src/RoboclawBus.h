@@ -0,0 +1,94 @@
+/*
+ * RoboclawBus.h
+ *
+ *  Created on: 17-10-2026
+ */
+
+#ifndef ROBOCLAWBUS_H_
+#define ROBOCLAWBUS_H_
+
+#include <deque>
+#include <string>
+
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+#include <boost/interprocess/sync/interprocess_condition.hpp>
+#include <boost/interprocess/sync/interprocess_mutex.hpp>
+#include <log4cxx/logger.h>
+
+#include "RoboclawCommon.h"
+
+// Lower value is served first
+enum RoboclawBusClass {
+	RC_BUS_SAFETY = 0,		// stop, reset, settings after reset
+	RC_BUS_MOTION,			// motors commands
+	RC_BUS_SPEED_READ,		// current speed reads
+	RC_BUS_MONITORING,		// battery, error status, temperature
+	RC_BUS_CLASSES
+};
+
+struct RoboclawBusStats {
+
+	__u32 jobs;
+	__u32 deadlineMisses;
+	__u32 queueFullWaits;
+	__u64 queueDelaySum;	// us
+	__u64 queueDelayMax;	// us
+	__u64 busyTime;			// us spent running jobs
+
+};
+
+/*
+ * Owns one serial port: every transaction runs on one thread, picked from
+ * bounded per-class queues in priority order. A running transaction is never
+ * interrupted, so a motors command waits at most for one telemetry job.
+ */
+class RoboclawBus {
+
+public:
+	RoboclawBus(const std::string& name, unsigned int queueSize, unsigned int statsInterval);
+	virtual ~RoboclawBus();
+
+	void start();
+
+	// runs job on the bus thread and blocks until it's done
+	void execute(RoboclawBusClass busClass, boost::function<void ()> job);
+
+	// queues job and returns, done is set once it ran; a full queue blocks the caller;
+	// lets one caller keep several buses busy at once
+	void submit(RoboclawBusClass busClass, boost::function<void ()> job, bool *done);
+	void wait(bool *done);
+
+	void operator()();
+
+private:
+
+	struct Job {
+		boost::function<void ()> work;
+		__u64 enqueueTime;		// monotonic, us
+		bool *done;
+	};
+
+	static log4cxx::LoggerPtr _logger;
+
+	std::string _name;
+	unsigned int _queueSize;
+	unsigned int _statsInterval;
+	bool _running;
+	bool _stopping;			// jobs still queued or submitted later don't run, their waiters are released
+
+	std::deque<Job> _queues[RC_BUS_CLASSES];
+	RoboclawBusStats _stats[RC_BUS_CLASSES];
+	__u64 _statsStart;		// monotonic, us
+
+	boost::interprocess::interprocess_mutex _busMutex;
+	boost::interprocess::interprocess_condition _jobQueued;
+	boost::interprocess::interprocess_condition _queueNotFull;
+	boost::interprocess::interprocess_condition _jobDone;
+
+	boost::thread *_busThread;
+
+	void logStats();
+};
+
+#endif /* ROBOCLAWBUS_H_ */
@@ -11,13 +11,82 @@
 #include <exception>
 #include <linux/types.h>
 #include <string>
+#include <vector>
+
+// 0x80 - 0x87, all addresses a Roboclaw can take, so at most that many on one port
+#define RC_MAX_CONTROLLERS 8
+#define RC_MAX_WHEELS (2 * RC_MAX_CONTROLLERS)
+
+// front left, front right, rear left and rear right of MotorsSpeed
+#define RC_NAMED_WHEELS 4
+
+// per wheel arrays are in the wheel map order, RoboclawConfiguration::wheels
 
 struct MotorsSpeedStruct {
 
-	int frontLeftSpeed;
-	int frontRightSpeed;
-	int rearLeftSpeed;
-	int rearRightSpeed;
+	int speed[RC_MAX_WHEELS];	// qpps
+
+	__u32 acceleration;		// qpps/s, commands only, 0 - reach the speed at once
+
+};
+
+// raw encoder registers, wrap around at 32 bits
+struct MotorsEncoderStruct {
+
+	__u32 count[RC_MAX_WHEELS];
+	__u8 status[RC_MAX_WHEELS];	// RC_ENCODER_*
+	bool valid[RC_MAX_WHEELS];	// false if the read failed
+	__u32 resets;			// controllers resets so far, counters restart from 0 after each
+	__u64 timestamp;		// monotonic, us, when the reads completed
+
+};
+
+// one step of a buffered trajectory, speeds in qpps, distances in pulses
+struct MotorsSegmentStruct {
+
+	MotorsSpeedStruct speed;
+
+	__u32 distance[RC_MAX_WHEELS];
+
+	__u32 acceleration;		// qpps/s, all wheels
+
+};
+
+// commands waiting in the controllers buffers, 0 while the last one executes, RC_BUFFER_IDLE once it's done
+struct MotorsBufferStruct {
+
+	__u8 length[RC_MAX_WHEELS];
+	bool valid;				// false if any read failed
+
+};
+
+struct CurrentSpeedSnapshot {
+
+	MotorsSpeedStruct speed;
+	__u64 timestamp; // monotonic, us
+	bool valid;
+
+};
+
+enum RoboclawWheelSide {
+	RC_WHEEL_LEFT = 0,
+	RC_WHEEL_RIGHT
+};
+
+struct RoboclawControllerConfiguration {
+
+	std::string name;
+	__u8 address;
+	std::string uart_port;
+
+};
+
+struct RoboclawWheelConfiguration {
+
+	std::string name;
+	int controller;			// index in RoboclawConfiguration::controllers
+	int motor;				// 1 or 2
+	RoboclawWheelSide side;	// for odometry, skid-steer wheels are either left or right
 
 };
 
@@ -25,33 +94,67 @@ struct RoboclawConfiguration {
 
 	std::string uart_port;
 	unsigned int uart_speed;
+	bool uart_command_drain;
+	__u32 uart_reply_timeout;
+	__u32 uart_stats_interval;
+
+	__u32 bus_queue_size;
+	__u32 bus_stats_interval;
+
+	__u32 pipe_queue_size;
+	std::string pipe_overflow;			// block or drop_oldest
+	__u32 pipe_batch_size;
+	__u32 pipe_latency_budget;			// us
 
 	std::string reset_gpio_path;
 	__u32 reset_delay;
 
 	std::string led1_gpio_path;
 	std::string led2_gpio_path;
+	__u32 led_activity_hold;			// ms, LED1 stays lit this long after a message
 
-	__u8 front_rc_address;
-	__u8 rear_rc_address;
+	// ports are opened in the order their first controller comes
+	std::vector<RoboclawControllerConfiguration> controllers;
+	std::vector<RoboclawWheelConfiguration> wheels;
+
+	// wheels behind the named MotorsSpeed fields, -1 if the map has no such wheel
+	int front_left_wheel;
+	int front_right_wheel;
+	int rear_left_wheel;
+	int rear_right_wheel;
 
 	__u32 motors_max_qpps;
 	__u32 motors_p_const;
 	__u32 motors_i_const;
 	__u32 motors_d_const;
+	__u32 motors_command_keepalive;
+	__u32 motors_acceleration;			// mm/s^2, 0 - reach commanded speed at once
 
 	__u32 pulses_per_revolution;
 	__u32 wheel_radius;
+	__u32 track_width;
+
+	__u32 odometry_interval;
+
+	__u32 trajectory_poll_interval;
+	__u32 trajectory_queue_depth;		// segments kept in the controllers buffers
+	__u32 trajectory_acceleration;		// mm/s^2, for segments without one
 	
 	__u32 battery_monitor_interval;
-	__u32 error_monitor_interval;
+	__u32 error_monitor_interval;		// fastest error status poll
+	__u32 error_monitor_max_interval;	// slowest one, while idle
+	__u32 error_monitor_fault_hold;
 	__u32 temperature_monitor_interval;
+	__u32 health_merge_window;
 
 	__u16 temperature_critical;
 	__u16 temperature_drop;
 
 	__u32 critical_read_repeats;
 
+	__u32 speed_poll_interval;
+	__u32 speed_max_age;
+
 	__u32 stop_idle_timeout;
 	__u32 reset_idle_timeout;
 
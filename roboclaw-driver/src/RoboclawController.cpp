@@ -9,10 +9,18 @@
 
 #include "RoboclawController.h"
 #include "RoboclawCommon.h"
+#include "RoboclawTopology.h"
 
 #include <boost/program_options.hpp>
 #include <string>
 #include <cmath>
+#include <cerrno>
+#include <csignal>
+#include <ctime>
+#include <cstring>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/timerfd.h>
 
 using namespace std;
 using namespace boost;
@@ -23,42 +31,54 @@ using namespace amber;
 
 LoggerPtr RoboclawController::_logger (Logger::getLogger("Roboclaw.Controller"));
 
+// ms, idle timeouts don't touch the serial port, they are only checked this often
+#define HEALTH_TIMEOUTS_INTERVAL 100
+
 RoboclawController::RoboclawController(int pipeInFd, int pipeOutFd, const char *confFilename) {
 
 	parseConfigurationFile(confFilename);
 	_roboclawDisabled = false;
-	_overheated = false;
-	_batteryLow = false;
+	_healthState = RC_HEALTH_NORMAL;
 
 	_roboclawDriver = new RoboclawDriver(_configuration);
-	_amberPipes = new AmberPipes(this, pipeInFd, pipeOutFd);
+	_amberPipes = new AmberPipes(this, pipeInFd, pipeOutFd, _configuration->pipe_queue_size,
+			AmberPipes::parseOverflow(_configuration->pipe_overflow), _configuration->pipe_batch_size,
+			_configuration->pipe_latency_budget);
 
 	_roboclawDriver->initializeDriver();
 
-	_timeoutMonitorThread = new boost::thread(boost::bind(&RoboclawController::timeoutMonitor, this));	
+	_leds = new RoboclawLeds(_configuration);
+	_leds->initializeLeds();
+	_leds->start();
 
-	if (_configuration->battery_monitor_interval > 0) {
-		_batteryMonitorThread = new boost::thread(boost::bind(&RoboclawController::batteryMonitor, this));	
-	}
+	_motorsMailbox = new RoboclawMailbox(_roboclawDriver, _configuration->bus_stats_interval);
+	_motorsMailbox->start();
+
+	_trajectory = new RoboclawTrajectory(_roboclawDriver, _configuration, this);
+	_trajectory->start();
 
-	if (_configuration->error_monitor_interval > 0) {
-		_errorMonitorThread = new boost::thread(boost::bind(&RoboclawController::errorMonitor, this));	
+	_healthMonitorThread = new boost::thread(boost::bind(&RoboclawController::healthMonitor, this));
+
+	if (_configuration->speed_poll_interval > 0) {
+		_speedPollerThread = new boost::thread(boost::bind(&RoboclawController::speedPoller, this));
 	}
 
-	if (_configuration->temperature_monitor_interval > 0) {
-		_temperatureMonitorThread = new boost::thread(boost::bind(&RoboclawController::temperatureMonitor, this));	
+	_statisticsMonitorThread = new boost::thread(boost::bind(&RoboclawController::statisticsMonitor, this));
+
+	_odometry = NULL;
+	if (_configuration->odometry_interval > 0) {
+		_odometry = new RoboclawOdometry(_roboclawDriver, _configuration);
+		_odometry->start();
 	}
-	
-	_roboclawDriver->setLed1(true);
-	_roboclawDriver->setLed2(false);
-	
+
+	_amberScheduler = new AmberScheduler<RoboclawSchedulerEntry>(this);
+	_schedulerThread = new boost::thread(boost::ref(*_amberScheduler));
 }
 
 RoboclawController::~RoboclawController() {
 	LOG4CXX_INFO(_logger, "Stopping controller.");
-	 
-	_roboclawDriver->setLed1(false);
 
+	delete _amberScheduler;
 	delete _roboclawDriver;
 	delete _amberPipes;
 }
@@ -69,7 +89,7 @@ void RoboclawController::handleDataMsg(amber::DriverHdr *driverHdr, amber::Drive
 		LOG4CXX_DEBUG(_logger, "Message came");
 	}
 
-	_roboclawDriver->setLed1(true);
+	_leds->activity(RC_LED1);
 
 	// TODO: hack for now
 	int clientId = driverHdr->clientids_size() > 0 ? driverHdr->clientids(0) : 0;
@@ -83,71 +103,204 @@ void RoboclawController::handleDataMsg(amber::DriverHdr *driverHdr, amber::Drive
 		}
 
 		if (driverMsg->GetExtension(roboclaw_proto::currentSpeedRequest)) {
-			handleCurrentSpeedRequest(clientId, driverMsg->synnum());	
+			__u32 maxAge = driverMsg->HasExtension(roboclaw_proto::currentSpeedMaxAge) ?
+					driverMsg->GetExtension(roboclaw_proto::currentSpeedMaxAge) : _configuration->speed_max_age;
+
+			handleCurrentSpeedRequest(clientId, driverMsg->synnum(), maxAge);	
 		}
 
 	} else if (driverMsg->HasExtension(roboclaw_proto::motorsCommand)) {
 		handleMotorsEncoderCommand(driverMsg->MutableExtension(roboclaw_proto::motorsCommand));
-	}
 
-	_roboclawDriver->setLed1(false);
+	} else if (driverMsg->HasExtension(roboclaw_proto::wheelsCommand)) {
+		handleWheelsCommand(driverMsg->MutableExtension(roboclaw_proto::wheelsCommand));
+
+	} else if (driverMsg->HasExtension(roboclaw_proto::odometryRequest)) {
+
+		if (!driverMsg->has_synnum()) {
+			LOG4CXX_WARN(_logger, "Got OdometryRequest, but syn num not set. Ignoring.");
+			return;
+		}
+
+		if (driverMsg->GetExtension(roboclaw_proto::odometryRequest)) {
+			sendOdometryMsg(clientId, driverMsg->synnum());
+		}
+
+	} else if (driverMsg->HasExtension(roboclaw_proto::subscribeAction)) {
+		handleSubscribeActionMsg(clientId, driverMsg->MutableExtension(roboclaw_proto::subscribeAction));
+
+	} else if (driverMsg->HasExtension(roboclaw_proto::trajectory)) {
+		handleTrajectoryMsg(clientId, driverMsg->has_synnum() ? driverMsg->synnum() : 0,
+				driverMsg->MutableExtension(roboclaw_proto::trajectory));
+	}
 }
 
 void RoboclawController::handleClientDiedMsg(int clientID) {
 	LOG4CXX_INFO(_logger, "Client " << clientID << " died");
 
-	_roboclawDriver->stopMotors();
+	if (_amberScheduler->hasClient(clientID)) {
+		_amberScheduler->removeClient(clientID);
+	}
+
+	stopMotors();
+}
+
+void RoboclawController::handleSchedulerEvent(int clientId, RoboclawSchedulerEntry *entry) {
+	AmberSchedulerEntry<RoboclawSchedulerEntry> schedulerEntry(clientId, 0);
+	schedulerEntry.details = entry;
+
+	std::vector<AmberSchedulerEntry<RoboclawSchedulerEntry>*> entries(1, &schedulerEntry);
+	handleSchedulerEvents(entries);
+}
+
+// Subscribers due together (all at the same rate are) share one speed read
+// and get one message per content, serialized once and addressed to all of them.
+void RoboclawController::handleSchedulerEvents(std::vector<AmberSchedulerEntry<RoboclawSchedulerEntry>*>& entries) {
+	// indexed by content: 1 - current speed, 2 - odometry, 3 - both
+	std::vector<int> recipients[4];
+	bool speedWanted = false;
+
+	for (std::vector<AmberSchedulerEntry<RoboclawSchedulerEntry>*>::iterator it = entries.begin(); it != entries.end(); ++it) {
+		RoboclawSchedulerEntry *entry = (*it)->details;
+		int content = (entry->currentSpeed ? 1 : 0) | (entry->odometry ? 2 : 0);
+
+		if (content != 0) {
+			recipients[content].push_back((*it)->clientId);
+			speedWanted = speedWanted || entry->currentSpeed;
+		}
+	}
+
+	if (_logger->isDebugEnabled()) {
+		LOG4CXX_DEBUG(_logger, "Handling scheduler events, clients: " << entries.size()
+			<< ", current speed: " << recipients[1].size() + recipients[3].size()
+			<< ", odometry: " << recipients[2].size() + recipients[3].size());
+	}
+
+	MotorsSpeedStruct mss;
+	bool speedValid = speedWanted && getCurrentSpeed(&mss, _configuration->speed_max_age);
+
+	for (int content = 1; content < 4; content++) {
+		if (recipients[content].empty()) {
+			continue;
+		}
+
+		amber::DriverMsg message;
+		message.set_type(amber::DriverMsg_MsgType_DATA);
+		message.set_acknum(0);
+
+		if (content & 1) {
+			fillCurrentSpeed(&message, &mss, speedValid);
+		}
+
+		if (content & 2) {
+			fillOdometry(message.MutableExtension(roboclaw_proto::odometry));
+		}
+
+		_amberPipes->writeMsgToPipe(recipients[content], &message);
+	}
 }
 
 void RoboclawController::operator()() {
 	_amberPipes->operator ()();
 }
 
-amber::DriverMsg *RoboclawController::buildCurrentSpeedMsg() {
+amber::DriverMsg *RoboclawController::buildCurrentSpeedMsg(__u32 maxAge) {
 	amber::DriverMsg *message = new amber::DriverMsg();
 	message->set_type(amber::DriverMsg_MsgType_DATA);
 
-	roboclaw_proto::MotorsSpeed *currentSpeed = message->MutableExtension(roboclaw_proto::currentSpeed);
-
 	MotorsSpeedStruct mc;
-	bool speedReadSuccess = false;
+	bool speedReadSuccess = getCurrentSpeed(&mc, maxAge);
 
-	if (!_roboclawDisabled) {
-		
-		// repeat reads in case of read errors
-		for (unsigned int i = 0; i < _configuration->critical_read_repeats; i++) {
-			try {
-				_roboclawDriver->readCurrentSpeed(&mc);
-				speedReadSuccess = true;
-				break;
-			} catch (RoboclawSerialException& e) {
-				// do nothing
-			}	
-		}
+	fillCurrentSpeed(message, &mc, speedReadSuccess);
+			
+	return message;
+}
+
+bool RoboclawController::getCurrentSpeed(MotorsSpeedStruct *mss, __u32 maxAge) {
+	if (_roboclawDisabled) {
+		return false;
+	}
+
+	CurrentSpeedSnapshot snapshot = _currentSpeed.read();
+
+	// answer from memory if the last read is fresh enough, otherwise go to the serial port
+	if (snapshot.valid && rc_monotonic_us() - snapshot.timestamp <= (__u64)maxAge * 1000) {
+		*mss = snapshot.speed;
+		return true;
 	}
 
-	if (speedReadSuccess) {
-		currentSpeed->set_frontleftspeed(toMmps(mc.frontLeftSpeed));
-		currentSpeed->set_frontrightspeed(toMmps(mc.frontRightSpeed));
-		currentSpeed->set_rearleftspeed(toMmps(mc.rearLeftSpeed));
-		currentSpeed->set_rearrightspeed(toMmps(mc.rearRightSpeed));
+	return readCurrentSpeed(mss);
+}
+
+// both the named wheels and the whole wheel map, zeros if the read failed
+void RoboclawController::fillCurrentSpeed(amber::DriverMsg *message, MotorsSpeedStruct *mss, bool valid) {
+	roboclaw_proto::MotorsSpeed *currentSpeed = message->MutableExtension(roboclaw_proto::currentSpeed);
+	roboclaw_proto::WheelsSpeed *wheelsSpeed = message->MutableExtension(roboclaw_proto::currentWheelsSpeed);
+
+	int mmps[RC_MAX_WHEELS];
+
+	if (valid) {
+		_units->toMmps(mss->speed, mmps, (int)_configuration->wheels.size());
 	} else {
-		currentSpeed->set_frontleftspeed(0);
-		currentSpeed->set_frontrightspeed(0);
-		currentSpeed->set_rearleftspeed(0);
-		currentSpeed->set_rearrightspeed(0);
+		memset(mmps, 0, sizeof(mmps));
 	}
-			
-	return message;
+
+	for (unsigned int i = 0; i < _configuration->wheels.size(); i++) {
+		wheelsSpeed->add_speeds(mmps[i]);
+	}
+
+	currentSpeed->set_frontleftspeed(getNamedWheel(mmps, _configuration->front_left_wheel));
+	currentSpeed->set_frontrightspeed(getNamedWheel(mmps, _configuration->front_right_wheel));
+	currentSpeed->set_rearleftspeed(getNamedWheel(mmps, _configuration->rear_left_wheel));
+	currentSpeed->set_rearrightspeed(getNamedWheel(mmps, _configuration->rear_right_wheel));
 }
 
+int RoboclawController::getNamedWheel(const int *values, int wheel) {
+	return wheel >= 0 ? values[wheel] : 0;
+}
 
-void RoboclawController::sendCurrentSpeedMsg(int receiver, int ackNum) {
+// named is front left, front right, rear left, rear right
+void RoboclawController::setNamedWheels(int *values, const int *named) {
+	const int wheels[RC_NAMED_WHEELS] = { _configuration->front_left_wheel, _configuration->front_right_wheel,
+			_configuration->rear_left_wheel, _configuration->rear_right_wheel };
+
+	for (int i = 0; i < RC_NAMED_WHEELS; i++) {
+		if (wheels[i] >= 0) {
+			values[wheels[i]] = named[i];
+		}
+	}
+}
+
+
+bool RoboclawController::readCurrentSpeed(MotorsSpeedStruct *mss) {
+
+	// repeat reads in case of read errors
+	for (unsigned int i = 0; i < _configuration->critical_read_repeats; i++) {
+		try {
+			_roboclawDriver->readCurrentSpeed(mss);
+
+			CurrentSpeedSnapshot snapshot;
+			snapshot.speed = *mss;
+			snapshot.timestamp = rc_monotonic_us();
+			snapshot.valid = true;
+
+			_currentSpeed.write(snapshot);
+
+			return true;
+		} catch (RoboclawSerialException& e) {
+			// do nothing
+		}	
+	}
+
+	return false;
+}
+
+void RoboclawController::sendCurrentSpeedMsg(int receiver, int ackNum, __u32 maxAge) {
 	if (_logger->isDebugEnabled()) {
 		LOG4CXX_DEBUG(_logger, "Sending currentSpeedRequest message");
 	}
 
-	amber::DriverMsg *currentSpeedMsg = buildCurrentSpeedMsg();
+	amber::DriverMsg *currentSpeedMsg = buildCurrentSpeedMsg(maxAge);
 	currentSpeedMsg->set_acknum(ackNum);
 	amber::DriverHdr *header = new amber::DriverHdr();
 	header->add_clientids(receiver);
@@ -159,222 +312,686 @@ void RoboclawController::sendCurrentSpeedMsg(int receiver, int ackNum) {
 }
 
 
-void RoboclawController::handleCurrentSpeedRequest(int sender, int synNum) {
+void RoboclawController::handleCurrentSpeedRequest(int sender, int synNum, __u32 maxAge) {
 	if (_logger->isDebugEnabled()) {	
 		LOG4CXX_DEBUG(_logger, "Handling currentSpeedRequest message");
 	}
 
-	sendCurrentSpeedMsg(sender, synNum);
+	sendCurrentSpeedMsg(sender, synNum, maxAge);
 }
 
-void RoboclawController::handleMotorsEncoderCommand(roboclaw_proto::MotorsSpeed *motorsCommand) {
-	if (_batteryLow) {
+// pose comes from memory, the odometry thread is the only one reading encoders
+amber::DriverMsg *RoboclawController::buildOdometryMsg() {
+	amber::DriverMsg *message = new amber::DriverMsg();
+	message->set_type(amber::DriverMsg_MsgType_DATA);
+
+	fillOdometry(message->MutableExtension(roboclaw_proto::odometry));
+
+	return message;
+}
+
+// left empty when disabled or before the first successful read
+void RoboclawController::fillOdometry(roboclaw_proto::Odometry *odometry) {
+	if (_odometry == NULL) {
 		return;
 	}
 
+	OdometrySnapshot pose = _odometry->getPose();
+
+	if (pose.valid) {
+		odometry->set_x(pose.x);
+		odometry->set_y(pose.y);
+		odometry->set_theta(pose.theta);
+		odometry->set_timestamp(pose.timestamp);
+	}
+}
+
+void RoboclawController::sendOdometryMsg(int receiver, int ackNum) {
 	if (_logger->isDebugEnabled()) {
-		LOG4CXX_DEBUG(_logger, "Handling motorsEncoderCommand message");
+		LOG4CXX_DEBUG(_logger, "Sending odometry message");
+	}
+
+	amber::DriverMsg *odometryMsg = buildOdometryMsg();
+	odometryMsg->set_acknum(ackNum);
+	amber::DriverHdr *header = new amber::DriverHdr();
+	header->add_clientids(receiver);
+
+	_amberPipes->writeMsgToPipe(header, odometryMsg);
+
+	delete odometryMsg;
+	delete header;
+}
+
+void RoboclawController::handleSubscribeActionMsg(int sender, roboclaw_proto::SubscribeAction *subscribeAction) {
+	if (_logger->isDebugEnabled()) {
+		LOG4CXX_DEBUG(_logger, "Got SubscribeAction message");
+	}
+
+	if (subscribeAction->freq() == 0) {
+
+		if (_logger->isDebugEnabled()) {
+			LOG4CXX_DEBUG(_logger, "Removing client id: " << sender);
+		}
+
+		if (_amberScheduler->hasClient(sender)) {
+			_amberScheduler->removeClient(sender);
+		}
+	} else {
+
+		if (_logger->isDebugEnabled()) {
+			LOG4CXX_DEBUG(_logger, "Adding new client id: " << sender << ", freq: " << subscribeAction->freq());
+		}
+
+		_amberScheduler->addClient(sender, subscribeAction->freq(),
+				new RoboclawSchedulerEntry(subscribeAction->odometry(), subscribeAction->currentspeed()));
+	}
+}
+
+void RoboclawController::handleTrajectoryMsg(int sender, int synNum, roboclaw_proto::Trajectory *trajectory) {
+	if (_healthState == RC_HEALTH_BATTERY_LOW) {
+		return;
+	}
+
+	if (_logger->isDebugEnabled()) {
+		LOG4CXX_DEBUG(_logger, "Handling trajectory message, segments: " << trajectory->segments_size());
 	}
 
 	resetTimeouts();
 
-	MotorsSpeedStruct mc;
+	if (trajectory->segments_size() == 0) {
+		stopMotors();
+		return;
+	}
 
-	mc.frontLeftSpeed = toQpps(motorsCommand->frontleftspeed());
-	mc.frontRightSpeed = toQpps(motorsCommand->frontrightspeed());
-	mc.rearLeftSpeed = toQpps(motorsCommand->rearleftspeed());
-	mc.rearRightSpeed = toQpps(motorsCommand->rearrightspeed());
+	// controllers are being reset, the trajectory is refused like speed commands are dropped
+	if (_roboclawDisabled) {
+		RoboclawTrajectoryProgress progress;
+		progress.total = (__u32)trajectory->segments_size();
+		progress.completed = 0;
+		progress.queued = 0;
+		progress.finished = true;
+		progress.cancelled = true;
 
-	if (!_roboclawDisabled) {
+		handleTrajectoryProgress(sender, synNum, &progress);
+		return;
+	}
 
-		try {
-			_roboclawDriver->sendMotorsEncoderCommand(&mc);	
-		} catch (RoboclawSerialException& e) {
-			// do nothing
-		}	
+	std::vector<MotorsSegmentStruct> segments(trajectory->segments_size());
+
+	for (int i = 0; i < trajectory->segments_size(); i++) {
+		const roboclaw_proto::TrajectorySegment& in = trajectory->segments(i);
+		MotorsSegmentStruct *out = &segments[i];
+
+		memset(out, 0, sizeof(*out));
+
+		int distances[RC_MAX_WHEELS];
+		memset(distances, 0, sizeof(distances));
+
+		if (in.speeds_size() > 0) {
+			int wheels = std::min(in.speeds_size(), (int)_configuration->wheels.size());
+			_units->toQpps(in.speeds().data(), out->speed.speed, wheels);
+
+			for (int w = 0; w < in.distances_size() && w < (int)_configuration->wheels.size(); w++) {
+				distances[w] = (int)in.distances(w);
+			}
+		} else {
+			int named[RC_NAMED_WHEELS] = { in.frontleftspeed(), in.frontrightspeed(), in.rearleftspeed(),
+					in.rearrightspeed() };
+			_units->toQpps(named, named, RC_NAMED_WHEELS);
+			setNamedWheels(out->speed.speed, named);
+
+			int namedDistances[RC_NAMED_WHEELS] = { (int)in.frontleftdistance(), (int)in.frontrightdistance(),
+					(int)in.rearleftdistance(), (int)in.rearrightdistance() };
+			setNamedWheels(distances, namedDistances);
+		}
+
+		// same scale, mm to pulses
+		_units->toQpps(distances, distances, (int)_configuration->wheels.size());
+
+		for (unsigned int w = 0; w < _configuration->wheels.size(); w++) {
+			out->distance[w] = (__u32)distances[w];
+		}
+
+		out->acceleration = (__u32)_units->toQpps(in.has_acceleration() ?
+				(int)in.acceleration() : (int)_configuration->trajectory_acceleration);
 	}
+
+	// a speed command still waiting would cut the trajectory short
+	_motorsMailbox->clear();
+
+	_trajectory->follow(sender, synNum, segments);
 }
 
-int RoboclawController::toQpps(int in) {
-	double rps = in / (double)(_configuration->wheel_radius * M_PI * 2);
-	int out = (int)(rps * _configuration->pulses_per_revolution);
+void RoboclawController::handleTrajectoryProgress(int clientId, int synNum, RoboclawTrajectoryProgress *progress) {
+	if (_logger->isDebugEnabled()) {
+		LOG4CXX_DEBUG(_logger, "Sending trajectory progress, completed: " << progress->completed << "/" << progress->total);
+	}
+
+	amber::DriverMsg message;
+	message.set_type(amber::DriverMsg_MsgType_DATA);
+	message.set_acknum(synNum);
+
+	roboclaw_proto::TrajectoryProgress *trajectoryProgress = message.MutableExtension(roboclaw_proto::trajectoryProgress);
+	trajectoryProgress->set_total(progress->total);
+	trajectoryProgress->set_completed(progress->completed);
+	trajectoryProgress->set_queued(progress->queued);
+	trajectoryProgress->set_finished(progress->finished);
+	trajectoryProgress->set_cancelled(progress->cancelled);
+
+	amber::DriverHdr header;
+	header.add_clientids(clientId);
+
+	_amberPipes->writeMsgToPipe(&header, &message);
+}
 
+void RoboclawController::handleMotorsEncoderCommand(roboclaw_proto::MotorsSpeed *motorsCommand) {
 	if (_logger->isDebugEnabled()) {
-		LOG4CXX_DEBUG(_logger, "toOpps: " << in << ", " <<  out);
+		LOG4CXX_DEBUG(_logger, "Handling motorsEncoderCommand message");
 	}
 
-	return out;
+	MotorsSpeedStruct mc;
+	memset(&mc, 0, sizeof(mc));
+
+	int named[RC_NAMED_WHEELS] = { motorsCommand->frontleftspeed(), motorsCommand->frontrightspeed(),
+			motorsCommand->rearleftspeed(), motorsCommand->rearrightspeed() };
+	_units->toQpps(named, named, RC_NAMED_WHEELS);
+	setNamedWheels(mc.speed, named);
+
+	// limits current spikes on step changes, which otherwise trip overcurrent and a reset
+	mc.acceleration = (__u32)_units->toQpps(motorsCommand->has_acceleration() ?
+			(int)motorsCommand->acceleration() : (int)_configuration->motors_acceleration);
+
+	sendMotorsCommand(&mc);
 }
 
-int RoboclawController::toMmps(int in) {
-	int out = (int)(in * (int)_configuration->wheel_radius * M_PI * 2 / (double)_configuration->pulses_per_revolution);
-	
+void RoboclawController::handleWheelsCommand(roboclaw_proto::WheelsSpeed *wheelsCommand) {
 	if (_logger->isDebugEnabled()) {
-		LOG4CXX_DEBUG(_logger, "toMmps: " << in << ", " <<  out);
+		LOG4CXX_DEBUG(_logger, "Handling wheelsCommand message, wheels: " << wheelsCommand->speeds_size());
 	}
 
-	return out;
+	MotorsSpeedStruct mc;
+	memset(&mc, 0, sizeof(mc));
+
+	int wheels = std::min(wheelsCommand->speeds_size(), (int)_configuration->wheels.size());
+	_units->toQpps(wheelsCommand->speeds().data(), mc.speed, wheels);
+
+	mc.acceleration = (__u32)_units->toQpps(wheelsCommand->has_acceleration() ?
+			(int)wheelsCommand->acceleration() : (int)_configuration->motors_acceleration);
+
+	sendMotorsCommand(&mc);
 }
 
-void RoboclawController::batteryMonitor() {
-	LOG4CXX_INFO(_logger, "Battery monitor thread started, interval: " << _configuration->battery_monitor_interval << "ms");
+void RoboclawController::sendMotorsCommand(MotorsSpeedStruct *mc) {
+	if (_healthState == RC_HEALTH_BATTERY_LOW) {
+		return;
+	}
 
-	__u16 voltage;
+	resetTimeouts();
 
-	while (1) {
-		boost::this_thread::sleep(boost::posix_time::milliseconds(_configuration->battery_monitor_interval)); 
+	// plain speed commands override buffered ones on the controllers
+	_trajectory->cancel();
 
-		if (!_roboclawDisabled) {
-			
-			try {
-				_roboclawDriver->readMainBatteryVoltage(&voltage);
-				LOG4CXX_INFO(_logger, "Main battery voltage level: " << voltage/10.0 << "V");
-			} catch (RoboclawSerialException& e) {
-				// do nothing
-			}				
-		}		
-	}	
+	if (!_roboclawDisabled) {
+		_motorsMailbox->post(*mc);
+	}
 }
 
-void RoboclawController::errorMonitor() {
-	LOG4CXX_INFO(_logger, "Hardware error monitor started, interval: " << _configuration->error_monitor_interval << "ms");
+void RoboclawController::stopMotors() {
+	// a command still waiting in the mailbox must not restart motors after the stop
+	_motorsMailbox->clear();
 
-	__u8 frontErrorStatus, rearErrorStatus, frontErrorStatusTmp, rearErrorStatusTmp;
-	bool same_errors;
+	// the stop doesn't wait for the trajectory, a segment that was on its way gets stopped again
+	_roboclawDriver->stopMotors();
+
+	if (_trajectory->cancel()) {
+		_roboclawDriver->stopMotors();
+	}
+}
+
+// Battery, error status, temperature and idle timeouts on one timerfd driven thread.
+// Serial checks start out of phase so they don't come due together, the ones that
+// still do (within health_merge_window) are read in one pipelined bus job.
+void RoboclawController::healthMonitor() {
+	LOG4CXX_INFO(_logger, "Health monitor thread started, battery: " << _configuration->battery_monitor_interval
+			<< "ms, errors: " << _configuration->error_monitor_interval << "-"
+			<< std::max(_configuration->error_monitor_max_interval, _configuration->error_monitor_interval) << "ms, temperature: "
+			<< _configuration->temperature_monitor_interval << "ms, merge window: " << _configuration->health_merge_window
+			<< "ms, stop_timeout: " << _configuration->stop_idle_timeout << "ms, reset_timeout: "
+			<< _configuration->reset_idle_timeout << "ms");
+
+	int timerFd = timerfd_create(CLOCK_MONOTONIC, 0);
+	if (timerFd < 0) {
+		LOG4CXX_FATAL(_logger, "Unable to create health monitor timer. Aborting.");
+		exit(1);
+	}
+
+	resetTimeouts();
+	initHealthTasks();
 
 	while (1) {
-		boost::this_thread::sleep(boost::posix_time::milliseconds(_configuration->error_monitor_interval)); 
-		
-		try {
-			_roboclawDriver->readErrorStatus(&frontErrorStatus, &rearErrorStatus);
+		__u64 now = rc_monotonic_us();
+		__u64 horizon = now + (__u64)_configuration->health_merge_window * 1000;
+		int due = 0;
 
-			if (frontErrorStatus != RC_ERROR_NORMAL || rearErrorStatus != RC_ERROR_NORMAL) {
+		for (int i = 0; i < RC_HEALTH_TASKS; i++) {
+			RoboclawHealthTask *task = &_healthTasks[i];
 
-				frontErrorStatusTmp = frontErrorStatus;
-				rearErrorStatusTmp = rearErrorStatus;
+			if (task->interval == 0 || (!task->confirm && task->due > horizon)) {
+				continue;
+			}
 
-				// check again in case of read errors
-				same_errors = true;
+			due |= 1 << i;
+			task->confirm = false;
 
-				for (unsigned int i = 0; i < _configuration->critical_read_repeats; i++) {
-					_roboclawDriver->readErrorStatus(&frontErrorStatus, &rearErrorStatus);
+			if (task->due <= horizon) {
+				task->due += (__u64)task->interval * 1000;
 
-					if (frontErrorStatus != frontErrorStatusTmp || rearErrorStatus != rearErrorStatusTmp) {
-						same_errors = false;
-						break;
-					}
+				// fell behind, don't try to catch up with a burst of reads
+				if (task->due <= now) {
+					task->due = now + (__u64)task->interval * 1000;
 				}
+			}
+		}
+
+		runHealthTasks(due);
+		updateErrorPolling(due, now);
 
-				// if errors still the same
-				if (same_errors) {
-					if (frontErrorStatus != RC_ERROR_NORMAL) {
-						LOG4CXX_WARN(_logger, "Front Roboclaw error: " << getErorDescription(frontErrorStatus)); 
-					}
+		__u64 next = 0;
+		for (int i = 0; i < RC_HEALTH_TASKS; i++) {
+			RoboclawHealthTask *task = &_healthTasks[i];
 
-					if (rearErrorStatus != RC_ERROR_NORMAL) {
-						LOG4CXX_WARN(_logger, "Rear Roboclaw error: " << getErorDescription(rearErrorStatus)); 
-					}
+			if (task->interval == 0) {
+				continue;
+			}
 
-					if (frontErrorStatus == RC_ERROR_M1_OVERCURRENT || frontErrorStatus == RC_ERROR_M2_OVERCURRENT ||
-						rearErrorStatus == RC_ERROR_M1_OVERCURRENT || rearErrorStatus == RC_ERROR_M2_OVERCURRENT) {
+			__u64 taskNext = task->confirm ? now : task->due;
+			if (next == 0 || taskNext < next) {
+				next = taskNext;
+			}
+		}
 
-						resetAndWait();
-					} else if (frontErrorStatus == RC_ERROR_MAIN_BATTERY_LOW || rearErrorStatus == RC_ERROR_MAIN_BATTERY_LOW) {
-						_roboclawDriver->setLed2(true);
+		if (next == 0) {
+			LOG4CXX_INFO(_logger, "Nothing left to monitor, health monitor thread exits");
+			close(timerFd);
+			return;
+		}
 
-						_batteryLow = true;
-						return;
-					}
-				}
+		struct itimerspec spec;
+		memset(&spec, 0, sizeof(spec));
+		spec.it_value.tv_sec = (time_t)(next / 1000000);
+		spec.it_value.tv_nsec = (long)(next % 1000000) * 1000;
+
+		__u64 expirations;
+		if (timerfd_settime(timerFd, TFD_TIMER_ABSTIME, &spec, NULL) < 0 ||
+				read(timerFd, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+			boost::this_thread::sleep(boost::posix_time::milliseconds(HEALTH_TIMEOUTS_INTERVAL));
+		}
+	}
+}
+
+void RoboclawController::initHealthTasks() {
+	_healthTasks[RC_HEALTH_TASK_BATTERY].interval = _configuration->battery_monitor_interval;
+	_healthTasks[RC_HEALTH_TASK_ERRORS].interval = _configuration->error_monitor_interval;
+	_healthTasks[RC_HEALTH_TASK_TEMPERATURE].interval = _configuration->temperature_monitor_interval;
+	_healthTasks[RC_HEALTH_TASK_TIMEOUTS].interval = HEALTH_TIMEOUTS_INTERVAL;
+
+	// serial checks get evenly spaced phases within the shortest of their intervals
+	__u32 shortest = 0;
+	int serialTasks = 0;
+	for (int i = RC_HEALTH_TASK_BATTERY; i <= RC_HEALTH_TASK_TEMPERATURE; i++) {
+		if (_healthTasks[i].interval > 0) {
+			serialTasks++;
+
+			if (shortest == 0 || _healthTasks[i].interval < shortest) {
+				shortest = _healthTasks[i].interval;
 			}
+		}
+	}
 
-			
+	__u64 now = rc_monotonic_us();
+	int phase = 0;
 
-		} catch (RoboclawSerialException& e) {
-			// do nothing
-		}		
+	for (int i = 0; i < RC_HEALTH_TASKS; i++) {
+		RoboclawHealthTask *task = &_healthTasks[i];
+
+		task->confirm = false;
+		task->due = now + (__u64)task->interval * 1000;
+
+		if (i <= RC_HEALTH_TASK_TEMPERATURE && task->interval > 0) {
+			task->due += (__u64)shortest * 1000 * phase / serialTasks;
+			phase++;
+		}
 	}
 
+	_errorConfirmations = 0;
+	_temperatureConfirmations = 0;
+
+	_lastErrorPoll = now;
+	_lastFault = 0;
+	_seenSerialFailures = _roboclawDriver->getSerialFailures();
 }
 
-void RoboclawController::temperatureMonitor() {
-	LOG4CXX_INFO(_logger, "Temperature monitor thread started, interval: " << _configuration->temperature_monitor_interval << "ms");
+void RoboclawController::runHealthTasks(int due) {
+	if (due & (1 << RC_HEALTH_TASK_TIMEOUTS)) {
+		checkTimeouts();
+	}
+
+	if (_roboclawDisabled) {
+		return;
+	}
+
+	int controllers = (int)_configuration->controllers.size();
+	rc_health health[RC_MAX_CONTROLLERS];
+	int what = 0;
+
+	if (due & (1 << RC_HEALTH_TASK_ERRORS)) {
+		what |= RC_HEALTH_ERROR_STATUS;
+	}
+
+	if (due & (1 << RC_HEALTH_TASK_TEMPERATURE)) {
+		what |= RC_HEALTH_TEMPERATURE;
+	}
+
+	for (int i = 0; i < controllers; i++) {
+		health[i].what = what;
+	}
+
+	// battery is shared, one controller is enough
+	if (due & (1 << RC_HEALTH_TASK_BATTERY)) {
+		health[0].what |= RC_HEALTH_MAIN_BATTERY;
+	}
+
+	if (health[0].what == 0) {
+		return;
+	}
+
+	try {
+		_roboclawDriver->readHealth(health);
+	} catch (RoboclawSerialException& e) {
+		return;
+	}
+
+	if (health[0].result & RC_HEALTH_MAIN_BATTERY) {
+		LOG4CXX_INFO(_logger, "Main battery voltage level: " << health[0].main_battery/10.0 << "V");
+	}
+
+	// acted upon only when all controllers answered
+	int result = what;
+	__u8 errorStatus[RC_MAX_CONTROLLERS];
+	__u16 temperature[RC_MAX_CONTROLLERS];
+
+	for (int i = 0; i < controllers; i++) {
+		result &= health[i].result;
+		errorStatus[i] = health[i].error_status;
+		temperature[i] = health[i].temperature;
+	}
+
+	if (result & RC_HEALTH_ERROR_STATUS) {
+		checkErrors(errorStatus);
+	}
+
+	if (result & RC_HEALTH_TEMPERATURE) {
+		checkTemperature(temperature);
+	}
+}
+
+void RoboclawController::checkErrors(const __u8 *errorStatus) {
+	int controllers = (int)_configuration->controllers.size();
+	bool normal = true;
+	bool same = true;
+
+	for (int i = 0; i < controllers; i++) {
+		normal = normal && errorStatus[i] == RC_ERROR_NORMAL;
+		same = same && errorStatus[i] == _suspectedErrors[i];
+	}
+
+	if (normal) {
+		_errorConfirmations = 0;
+		return;
+	}
+
+	_lastFault = rc_monotonic_us();
+
+	// check again in case of read errors, act only if the errors stay the same
+	if (_errorConfirmations == 0 || !same) {
+		memcpy(_suspectedErrors, errorStatus, controllers * sizeof(__u8));
+		_errorConfirmations = 0;
+	}
+
+	if (_errorConfirmations < _configuration->critical_read_repeats) {
+		_errorConfirmations++;
+		_healthTasks[RC_HEALTH_TASK_ERRORS].confirm = true;
+		return;
+	}
+
+	_errorConfirmations = 0;
+
+	bool overcurrent = false;
+	bool batteryLow = false;
+
+	for (int i = 0; i < controllers; i++) {
+		if (errorStatus[i] != RC_ERROR_NORMAL) {
+			LOG4CXX_WARN(_logger, "Roboclaw " << _configuration->controllers[i].name << " error: " << getErorDescription(errorStatus[i]));
+		}
+
+		overcurrent = overcurrent || errorStatus[i] == RC_ERROR_M1_OVERCURRENT || errorStatus[i] == RC_ERROR_M2_OVERCURRENT;
+		batteryLow = batteryLow || errorStatus[i] == RC_ERROR_MAIN_BATTERY_LOW;
+	}
+
+	if (overcurrent) {
+		resetAndWait();
+	} else if (batteryLow) {
+		enterBatteryLow();
+	}
+}
+
+void RoboclawController::checkTemperature(const __u16 *temperature) {
+	int controllers = (int)_configuration->controllers.size();
+	bool allBelowDrop = true;
+	bool anyCritical = false;
+
+	for (int i = 0; i < controllers; i++) {
+		LOG4CXX_INFO(_logger, "Roboclaw " << _configuration->controllers[i].name << " temperature: " << temperature[i]/10.0 << "C");
+
+		allBelowDrop = allBelowDrop && temperature[i] < _configuration->temperature_drop;
+		anyCritical = anyCritical || temperature[i] > _configuration->temperature_critical;
+	}
+
+	bool escalate;
+
+	if (_healthState == RC_HEALTH_OVERHEATED) {
+		// temperature dropped down below drop level
+		escalate = allBelowDrop;
+	} else {
+		escalate = anyCritical;
+	}
+	if (!escalate) {
+		_temperatureConfirmations = 0;
+		return;
+	}
+
+	// check again in case of read errors
+	if (_temperatureConfirmations < _configuration->critical_read_repeats) {
+		_temperatureConfirmations++;
+		_healthTasks[RC_HEALTH_TASK_TEMPERATURE].confirm = true;
+		return;
+	}
+
+	_temperatureConfirmations = 0;
 
-	__u16 frontTemperature, rearTemperature;
+	if (_healthState == RC_HEALTH_OVERHEATED) {
+		LOG4CXX_INFO(_logger, "Roboclaw cooled down, reseting");
+
+		_healthState = RC_HEALTH_NORMAL;
+		resetAndWait();
+	} else {
+		_healthState = RC_HEALTH_OVERHEATED;
+		stopMotors();
+
+		LOG4CXX_WARN(_logger, "Roboclaw overheated, waiting for cool down to " << _configuration->temperature_drop/10.0 << "C");
+	}
+}
+
+// Error status is polled every error_monitor_interval while motors are commanded, for
+// error_monitor_fault_hold after a fault and after any failed serial transaction.
+// Otherwise every idle poll doubles the interval, up to error_monitor_max_interval.
+void RoboclawController::updateErrorPolling(int due, __u64 now) {
+	RoboclawHealthTask *task = &_healthTasks[RC_HEALTH_TASK_ERRORS];
+
+	if (task->interval == 0) {
+		return;
+	}
+
+	__u32 fastInterval = _configuration->error_monitor_interval;
+	__u32 idleInterval = std::max(_configuration->error_monitor_max_interval, fastInterval);
+
+	bool active;
+	{
+		scoped_lock<interprocess_mutex> lock(_timeoutsMutex);
+		active = _motorsStopTimerEnabled;
+	}
+
+	if (_lastFault != 0 && now - _lastFault < (__u64)_configuration->error_monitor_fault_hold * 1000) {
+		active = true;
+	}
+
+	unsigned int serialFailures = _roboclawDriver->getSerialFailures();
+	if (serialFailures != _seenSerialFailures) {
+		_seenSerialFailures = serialFailures;
+		active = true;
+	}
+
+	bool polled = (due & (1 << RC_HEALTH_TASK_ERRORS)) != 0;
+	if (polled) {
+		_lastErrorPoll = now;
+	}
+
+	__u32 interval = task->interval;
+	if (active) {
+		interval = fastInterval;
+	} else if (polled) {
+		interval = std::min(interval * 2, idleInterval);
+	}
+
+	// a shorter interval pulls the next poll in, after a failure it comes as soon as the bound allows
+	if (polled || interval != task->interval) {
+		if (_logger->isDebugEnabled() && interval != task->interval) {
+			LOG4CXX_DEBUG(_logger, "Error status poll interval: " << interval << "ms");
+		}
+
+		task->interval = interval;
+		task->due = _lastErrorPoll + (__u64)interval * 1000;
+	}
+}
+
+void RoboclawController::checkTimeouts() {
+	// motors follow a trajectory, that's not idle
+	if (_trajectory->isActive()) {
+		resetTimeouts();
+	}
+
+	boost::system_time actTime = boost::get_system_time();
+	bool doStop;
+	bool doReset;
+
+	{
+		scoped_lock<interprocess_mutex> lock(_timeoutsMutex);
+
+		doStop = false;
+		if (_motorsStopTimerEnabled && _motorsStopTime <= actTime) {
+			doStop = true;
+			_motorsStopTimerEnabled = false;
+		}
+
+		doReset = false;
+		if (_resetTime <= actTime) {
+			doReset = true;
+			_resetTime = actTime + boost::posix_time::milliseconds(_configuration->reset_idle_timeout);
+		}
+	}
+
+	if (doStop) {
+		stopMotors();
+	}
+
+	if (doReset) {
+		resetAndWait();
+	}
+}
+
+// nothing but the battery is watched from now on, motors commands are ignored
+void RoboclawController::enterBatteryLow() {
+	_leds->set(RC_LED2, true);
+
+	_healthState = RC_HEALTH_BATTERY_LOW;
+
+	_healthTasks[RC_HEALTH_TASK_ERRORS].interval = 0;
+	_healthTasks[RC_HEALTH_TASK_TEMPERATURE].interval = 0;
+	_healthTasks[RC_HEALTH_TASK_TIMEOUTS].interval = 0;
+}
+
+void RoboclawController::speedPoller() {
+	LOG4CXX_INFO(_logger, "Speed poller thread started, interval: " << _configuration->speed_poll_interval << "ms");
+
+	MotorsSpeedStruct mc;
+	boost::system_time nextTime = boost::get_system_time();
 
 	while (1) {
-		boost::this_thread::sleep(boost::posix_time::milliseconds(_configuration->temperature_monitor_interval)); 
+		nextTime += boost::posix_time::milliseconds(_configuration->speed_poll_interval);
 
-		if (_batteryLow) {
-			return;
+		boost::system_time actTime = boost::get_system_time();
+		if (nextTime < actTime) {
+			// fell behind, don't try to catch up with a burst of reads
+			nextTime = actTime;
 		}
 
-		if (!_roboclawDisabled) {
-			_roboclawDriver->readTemperature(&frontTemperature, &rearTemperature);
-
-			LOG4CXX_INFO(_logger, "Front temperature: " << frontTemperature/10.0 << "C, " <<
-			"rear temperature: " << rearTemperature/10.0 << "C");
-
-			if (_overheated) {
-				// if temperature droped down below drop level
-				if (frontTemperature < _configuration->temperature_drop && rearTemperature < _configuration->temperature_drop) {
-					_overheated = false;
-
-					// check again in case of read errors
-					for (unsigned int i = 0; i < _configuration->critical_read_repeats; i++) {
-						_roboclawDriver->readTemperature(&frontTemperature, &rearTemperature);
-
-						if (frontTemperature > _configuration->temperature_drop || rearTemperature > _configuration->temperature_drop) {
-							_overheated = true;
-							break;
-						}
-					}
-
-					// if still cool and ok
-					if (!_overheated) {
-						LOG4CXX_INFO(_logger, "Roboclaw cooled down, reseting");
-						resetAndWait();
-					}
-				}
+		boost::thread::sleep(nextTime);
 
-			} else {
-				// if temperature above critical
-				if (frontTemperature > _configuration->temperature_critical || rearTemperature > _configuration->temperature_critical) {
-					
-					_overheated = true;
+		if (!_roboclawDisabled) {
+			readCurrentSpeed(&mc);
+		}
+	}
+}
 
-					// check again in case of read errors
-					for (unsigned int i = 0; i < _configuration->critical_read_repeats; i++) {
-						_roboclawDriver->readTemperature(&frontTemperature, &rearTemperature);
+// SIGUSR1 (blocked in all threads by main) or uart_stats_interval dumps serial statistics
+void RoboclawController::statisticsMonitor() {
+	LOG4CXX_INFO(_logger, "Statistics monitor thread started, interval: " << _configuration->uart_stats_interval << "ms");
 
-						if (frontTemperature < _configuration->temperature_critical && rearTemperature < _configuration->temperature_critical) {
-							_overheated = false;
-							break;
-						}
-					}
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGUSR1);
 
-					// if still _overheated
-					if (_overheated) {
-						_roboclawDriver->stopMotors();
+	struct timespec interval;
+	interval.tv_sec = _configuration->uart_stats_interval / 1000;
+	interval.tv_nsec = (long)(_configuration->uart_stats_interval % 1000) * 1000000;
 
-						LOG4CXX_WARN(_logger, "Roboclaw _overheated, waiting for cool down to " << _configuration->temperature_drop/10.0 << "C");
-					}					
-				}
-			}
+	while (1) {
+		int sig = _configuration->uart_stats_interval > 0 ?
+				sigtimedwait(&signals, NULL, &interval) : sigwaitinfo(&signals, NULL);
 
+		if (sig < 0 && errno != EAGAIN) {
+			continue;
 		}
+
+		_roboclawDriver->logUartStatistics();
 	}
-	
 }
 
 void RoboclawController::resetAndWait() {
-	if (_batteryLow) {
+	if (_healthState == RC_HEALTH_BATTERY_LOW) {
 		return;
 	}
 
 	LOG4CXX_INFO(_logger, "Reseting Roboclaws and waiting " << _configuration->reset_delay << "ms");
 
 	_roboclawDisabled = true;
+	_motorsMailbox->clear();
+
+	// controllers lose their buffers
+	_trajectory->cancel();
+
+	// speeds read before the reset are no longer valid
+	_currentSpeed.write(CurrentSpeedSnapshot());
 
 	_roboclawDriver->reset();
 	boost::this_thread::sleep(boost::posix_time::milliseconds(_configuration->reset_delay)); 
@@ -439,29 +1056,55 @@ void RoboclawController::parseConfigurationFile(const char *filename) {
 
 	unsigned int front_rc_address;
 	unsigned int rear_rc_address;
+	vector<string> controllers;
+	vector<string> wheels;
 
 	options_description desc("Roboclaw options");
 	desc.add_options()
 			("roboclaw.uart_port", value<string>(&_configuration->uart_port)->default_value("/dev/ttyO3"))
 			("roboclaw.uart_speed", value<unsigned int>(&_configuration->uart_speed)->default_value(38400))
+			("roboclaw.uart_command_drain", value<bool>(&_configuration->uart_command_drain)->default_value(true))
+			("roboclaw.uart_reply_timeout", value<unsigned int>(&_configuration->uart_reply_timeout)->default_value(RC_UART_REPLY_TIMEOUT_US))
+			("roboclaw.uart_stats_interval", value<unsigned int>(&_configuration->uart_stats_interval)->default_value(0))
+			("roboclaw.bus_queue_size", value<unsigned int>(&_configuration->bus_queue_size)->default_value(16))
+			("roboclaw.bus_stats_interval", value<unsigned int>(&_configuration->bus_stats_interval)->default_value(0))
+			("roboclaw.pipe_queue_size", value<unsigned int>(&_configuration->pipe_queue_size)->default_value(PIPE_OUT_QUEUE_SIZE))
+			("roboclaw.pipe_overflow", value<string>(&_configuration->pipe_overflow)->default_value("block"))
+			("roboclaw.pipe_batch_size", value<unsigned int>(&_configuration->pipe_batch_size)->default_value(PIPE_OUT_BATCH))
+			("roboclaw.pipe_latency_budget", value<unsigned int>(&_configuration->pipe_latency_budget)->default_value(0))
 			("roboclaw.reset_gpio_path", value<string>(&_configuration->reset_gpio_path)->default_value("/sys/class/gpio/gpio136/value"))
 			("roboclaw.reset_delay", value<unsigned int>(&_configuration->reset_delay)->default_value(260))
 			("roboclaw.led1_gpio_path", value<string>(&_configuration->led1_gpio_path)->default_value("/sys/class/gpio/gpio139/value"))
 			("roboclaw.led2_gpio_path", value<string>(&_configuration->led2_gpio_path)->default_value("/sys/class/gpio/gpio137/value"))			
+			("roboclaw.led_activity_hold", value<unsigned int>(&_configuration->led_activity_hold)->default_value(50))
 			("roboclaw.front_rc_address", value<unsigned int>(&front_rc_address)->default_value(128))
 			("roboclaw.rear_rc_address", value<unsigned int>(&rear_rc_address)->default_value(129))
+			("roboclaw.controller", value<vector<string> >(&controllers)->composing())
+			("roboclaw.wheel", value<vector<string> >(&wheels)->composing())
 			("roboclaw.motors_max_qpps", value<unsigned int>(&_configuration->motors_max_qpps)->default_value(13800))
 			("roboclaw.motors_p_const", value<unsigned int>(&_configuration->motors_p_const)->default_value(65536))
 			("roboclaw.motors_i_const", value<unsigned int>(&_configuration->motors_i_const)->default_value(32768))
 			("roboclaw.motors_d_const", value<unsigned int>(&_configuration->motors_d_const)->default_value(16384))
+			("roboclaw.motors_command_keepalive", value<unsigned int>(&_configuration->motors_command_keepalive)->default_value(0))
+			("roboclaw.motors_acceleration", value<unsigned int>(&_configuration->motors_acceleration)->default_value(0))
 			("roboclaw.pulses_per_revolution", value<unsigned int>(&_configuration->pulses_per_revolution)->default_value(1865))
 			("roboclaw.wheel_radius", value<unsigned int>(&_configuration->wheel_radius)->default_value(60))
+			("roboclaw.track_width", value<unsigned int>(&_configuration->track_width)->default_value(280))
+			("roboclaw.odometry_interval", value<unsigned int>(&_configuration->odometry_interval)->default_value(0))
+			("roboclaw.trajectory_poll_interval", value<unsigned int>(&_configuration->trajectory_poll_interval)->default_value(50))
+			("roboclaw.trajectory_queue_depth", value<unsigned int>(&_configuration->trajectory_queue_depth)->default_value(4))
+			("roboclaw.trajectory_acceleration", value<unsigned int>(&_configuration->trajectory_acceleration)->default_value(1000))
 			("roboclaw.battery_monitor_interval", value<unsigned int>(&_configuration->battery_monitor_interval)->default_value(0))
 			("roboclaw.error_monitor_interval", value<unsigned int>(&_configuration->error_monitor_interval)->default_value(0))
+			("roboclaw.error_monitor_max_interval", value<unsigned int>(&_configuration->error_monitor_max_interval)->default_value(0))
+			("roboclaw.error_monitor_fault_hold", value<unsigned int>(&_configuration->error_monitor_fault_hold)->default_value(5000))
 			("roboclaw.temperature_monitor_interval", value<unsigned int>(&_configuration->temperature_monitor_interval)->default_value(0))
+			("roboclaw.health_merge_window", value<unsigned int>(&_configuration->health_merge_window)->default_value(20))
 			("roboclaw.temperature_critical", value<__u16>(&_configuration->temperature_critical)->default_value(70))
 			("roboclaw.temperature_drop", value<__u16>(&_configuration->temperature_drop)->default_value(60))
 			("roboclaw.critical_read_repeats", value<unsigned int>(&_configuration->critical_read_repeats)->default_value(0))
+			("roboclaw.speed_poll_interval", value<unsigned int>(&_configuration->speed_poll_interval)->default_value(0))
+			("roboclaw.speed_max_age", value<unsigned int>(&_configuration->speed_max_age)->default_value(0))
 			("roboclaw.stop_idle_timeout", value<unsigned int>(&_configuration->stop_idle_timeout)->default_value(1000))
 			("roboclaw.reset_idle_timeout", value<unsigned int>(&_configuration->reset_idle_timeout)->default_value(10000));
 
@@ -472,8 +1115,17 @@ void RoboclawController::parseConfigurationFile(const char *filename) {
 		store(parse_config_file<char>(filename, desc), vm);
 		notify(vm);
 
-		_configuration->front_rc_address = (__u8)front_rc_address;
-		_configuration->rear_rc_address = (__u8)rear_rc_address;
+		// without a wheel map it's the front/rear pair on uart_port
+		if (controllers.empty()) {
+			RoboclawTopology::setDefault(_configuration, (__u8)front_rc_address, (__u8)rear_rc_address);
+		} else {
+			RoboclawTopology::parse(_configuration, controllers, wheels);
+		}
+
+		_units = new RoboclawUnits(_configuration);
+
+		// a typo fails here, not once the pipes are created
+		AmberPipes::parseOverflow(_configuration->pipe_overflow);
 
 	} catch (std::exception& e) {
 		LOG4CXX_ERROR(_logger, "Error in parsing configuration file: " << e.what());
@@ -482,51 +1134,6 @@ void RoboclawController::parseConfigurationFile(const char *filename) {
 
 }
 
-void RoboclawController::timeoutMonitor() {
-	LOG4CXX_INFO(_logger, "Timeouts monitor thread started, stop_timeout: " << _configuration->stop_idle_timeout << 
-		"ms, reset_timeout: " << _configuration->reset_idle_timeout << " ms");
-
-	resetTimeouts();
-
-	boost::system_time actTime;
-	bool doStop;
-	bool doReset;
-
-	while(1) {
-		if (_batteryLow) {
-			return;
-		}
-
-		actTime = boost::get_system_time();
-
-		{
-			scoped_lock<interprocess_mutex> lock(_timeoutsMutex);
-
-			doStop = false;
-			if (_motorsStopTimerEnabled && _motorsStopTime <= actTime) {
-				doStop = true;
-				_motorsStopTimerEnabled = false;
-			}
-
-			doReset = false;
-			if (_resetTime <= actTime) {
-				doReset = true;
-				_resetTime = actTime + boost::posix_time::milliseconds(_configuration->reset_idle_timeout);
-			}
-		}
-
-		if (doStop) {
-			_roboclawDriver->stopMotors();
-		}
-
-		if (doReset) {
-			resetAndWait();
-		}
-
-		boost::thread::sleep(actTime + boost::posix_time::milliseconds(100));
-	}
-}
-
 void RoboclawController::resetTimeouts() {
 	scoped_lock<interprocess_mutex> lock(_timeoutsMutex);
 
@@ -549,6 +1156,12 @@ int main(int argc, char *argv[]) {
 
 	PropertyConfigurator::configure(logConfFile);
 
+	// handled synchronously by the statistics thread, threads created later inherit the mask
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGUSR1);
+	pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
 	// STDIN_FD = 0, STDOUT_FD = 1
 	// pipe_in_fd = 0, pipe_out_fd = 1
 	LoggerPtr logger (Logger::getLogger("main"));
@@ -16,57 +16,130 @@
 
 #include "AmberScheduler.h"
 #include "AmberPipes.h"
+#include "AmberSeqlock.h"
 #include "RoboclawDriver.h"
+#include "RoboclawLeds.h"
+#include "RoboclawMailbox.h"
+#include "RoboclawOdometry.h"
+#include "RoboclawTrajectory.h"
+#include "RoboclawUnits.h"
 #include "drivermsg.pb.h"
 #include "roboclaw.pb.h"
 #include "RoboclawLib.h"
 
-class RoboclawController: public MessageHandler {
+enum RoboclawHealthState {
+	RC_HEALTH_NORMAL = 0,
+	RC_HEALTH_OVERHEATED,		// motors stopped, waiting for temperature_drop
+	RC_HEALTH_BATTERY_LOW		// final, only the battery is still watched
+};
+
+enum RoboclawHealthTaskId {
+	RC_HEALTH_TASK_BATTERY = 0,
+	RC_HEALTH_TASK_ERRORS,
+	RC_HEALTH_TASK_TEMPERATURE,
+	RC_HEALTH_TASK_TIMEOUTS,
+	RC_HEALTH_TASKS
+};
+
+struct RoboclawHealthTask {
+	__u32 interval;		// ms, 0 - disabled
+	__u64 due;			// monotonic, us
+	bool confirm;		// read again right away to confirm a suspected change
+};
+
+struct RoboclawSchedulerEntry {
+	const bool odometry;
+	const bool currentSpeed;
+
+	RoboclawSchedulerEntry(): odometry(false), currentSpeed(false) {
+	}
+
+	RoboclawSchedulerEntry(bool withOdometry, bool withCurrentSpeed): odometry(withOdometry), currentSpeed(withCurrentSpeed) {}
+};
+
+class RoboclawController: public AmberSchedulerListener<RoboclawSchedulerEntry>, RoboclawTrajectoryListener, MessageHandler {
 public:
 	RoboclawController(int pipeInFd, int pipeOutFd, const char *confFilename);
 	virtual ~RoboclawController();
 
 	void handleDataMsg(amber::DriverHdr *driverHdr, amber::DriverMsg *driverMsg);
 	void handleClientDiedMsg(int clientID);
+	void handleSchedulerEvent(int clientId, RoboclawSchedulerEntry *entry);
+	void handleSchedulerEvents(std::vector<AmberSchedulerEntry<RoboclawSchedulerEntry>*>& entries);
+	void handleTrajectoryProgress(int clientId, int synNum, RoboclawTrajectoryProgress *progress);
 	void operator()();
 
 private:
 	RoboclawDriver *_roboclawDriver;
+	RoboclawLeds *_leds;
+	RoboclawMailbox *_motorsMailbox;
+	RoboclawOdometry *_odometry;
+	RoboclawTrajectory *_trajectory;
+	RoboclawUnits *_units;
+	AmberScheduler<RoboclawSchedulerEntry> *_amberScheduler;
 	AmberPipes *_amberPipes;
 
 	bool _roboclawDisabled;
-	bool _overheated;
-	bool _batteryLow;
 
 	RoboclawConfiguration *_configuration;
-	boost::thread *_batteryMonitorThread;
-	boost::thread *_errorMonitorThread;
-	boost::thread *_temperatureMonitorThread;
-	boost::thread *_timeoutMonitorThread;
+	boost::thread *_healthMonitorThread;
+	boost::thread *_speedPollerThread;
+	boost::thread *_statisticsMonitorThread;
+	boost::thread *_schedulerThread;
+
+	AmberSeqlock<CurrentSpeedSnapshot> _currentSpeed;
 
 	boost::interprocess::interprocess_mutex _timeoutsMutex;
 	boost::system_time _motorsStopTime;
 	boost::system_time _resetTime;
 	bool _motorsStopTimerEnabled;
 
+	// owned by the health monitor thread, except for _healthState which others only read
+	RoboclawHealthState _healthState;
+	RoboclawHealthTask _healthTasks[RC_HEALTH_TASKS];
+	unsigned int _errorConfirmations;
+	unsigned int _temperatureConfirmations;
+	__u8 _suspectedErrors[RC_MAX_CONTROLLERS];
+	__u64 _lastErrorPoll;				// monotonic, us
+	__u64 _lastFault;					// monotonic, us, 0 - none yet
+	unsigned int _seenSerialFailures;
+
 	static log4cxx::LoggerPtr _logger;
 
-	amber::DriverMsg *buildCurrentSpeedMsg();
-	void sendCurrentSpeedMsg(int receiver, int ackNum);
-	void handleCurrentSpeedRequest(int sender, int synNum);
+	amber::DriverMsg *buildCurrentSpeedMsg(__u32 maxAge);
+	bool getCurrentSpeed(MotorsSpeedStruct *mss, __u32 maxAge);
+	bool readCurrentSpeed(MotorsSpeedStruct *mss);
+	void fillCurrentSpeed(amber::DriverMsg *message, MotorsSpeedStruct *mss, bool valid);
+	void fillOdometry(amber::roboclaw_proto::Odometry *odometry);
+	void sendCurrentSpeedMsg(int receiver, int ackNum, __u32 maxAge);
+	void handleCurrentSpeedRequest(int sender, int synNum, __u32 maxAge);
+	amber::DriverMsg *buildOdometryMsg();
+	void sendOdometryMsg(int receiver, int ackNum);
+	void handleSubscribeActionMsg(int sender, amber::roboclaw_proto::SubscribeAction *subscribeAction);
+	void handleTrajectoryMsg(int sender, int synNum, amber::roboclaw_proto::Trajectory *trajectory);
 	void handleMotorsEncoderCommand(amber::roboclaw_proto::MotorsSpeed *motorsCommand);
+	void handleWheelsCommand(amber::roboclaw_proto::WheelsSpeed *wheelsCommand);
+	void sendMotorsCommand(MotorsSpeedStruct *mc);
 	void parseConfigurationFile(const char *filename);
 	void resetAndWait();
 	void resetTimeouts();
-
-	void batteryMonitor();
-	void errorMonitor();
-	void temperatureMonitor();
-	void timeoutMonitor();
+	void stopMotors();
+
+	void healthMonitor();
+	void initHealthTasks();
+	void runHealthTasks(int due);
+	// one entry per controller
+	void checkErrors(const __u8 *errorStatus);
+	void checkTemperature(const __u16 *temperature);
+	void checkTimeouts();
+	void updateErrorPolling(int due, __u64 now);
+	void enterBatteryLow();
+	void speedPoller();
+	void statisticsMonitor();
 
 	std::string getErorDescription(__u8 errorStatus);
-	int toQpps(int in);
-	int toMmps(int in);
+	int getNamedWheel(const int *values, int wheel);
+	void setNamedWheels(int *values, const int *named);
 
 };
 
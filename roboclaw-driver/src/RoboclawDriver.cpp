@@ -11,16 +11,22 @@
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <termios.h>
+#include <sstream>
+#include <cstring>
+#include <algorithm>
 
 #include <log4cxx/logger.h>
 
 #include <boost/date_time/posix_time/posix_time.hpp>
 #include <boost/thread.hpp>
 #include <boost/thread/thread_time.hpp>
+#include <boost/bind.hpp>
 
 #include "RoboclawCommon.h"
 #include "RoboclawDriver.h"
 #include "RoboclawLib.h"
+#include "RoboclawPacket.h"
+#include "RoboclawTopology.h"
 
 using namespace std;
 using namespace boost;
@@ -29,56 +35,85 @@ using namespace log4cxx;
 using namespace boost::posix_time;
 LoggerPtr RoboclawDriver::_logger (Logger::getLogger("Roboclaw.Driver"));
 
-RoboclawDriver::RoboclawDriver(RoboclawConfiguration *configuration):
-		driverReady(false), _configuration(configuration) {
+RoboclawDriver::RoboclawDriver(RoboclawConfiguration *configuration): _configuration(configuration), _serialFailures(0) {
+	vector<string> paths = RoboclawTopology::getPorts(configuration);
+
+	for (unsigned int i = 0; i < paths.size(); i++) {
+		RoboclawPort *port = new RoboclawPort();
+		port->index = (int)i;
+		port->path = paths[i];
+		port->fd = -1;
+		port->bus = new RoboclawBus(paths[i], configuration->bus_queue_size, configuration->bus_stats_interval);
+		port->count = 0;
+		port->resets = 0;
+
+		for (unsigned int c = 0; c < configuration->controllers.size(); c++) {
+			if (configuration->controllers[c].uart_port != paths[i]) {
+				continue;
+			}
+
+			int n = port->count++;
+			port->addresses[n] = configuration->controllers[c].address;
+			port->controllers[n] = (int)c;
+			port->m1Wheels[n] = -1;
+			port->m2Wheels[n] = -1;
+
+			for (unsigned int w = 0; w < configuration->wheels.size(); w++) {
+				if (configuration->wheels[w].controller == (int)c) {
+					if (configuration->wheels[w].motor == 1) {
+						port->m1Wheels[n] = (int)w;
+					} else {
+						port->m2Wheels[n] = (int)w;
+					}
+				}
+			}
+		}
 
+		invalidateSetpoints(port);
+		_ports.push_back(port);
+	}
 }
 
 RoboclawDriver::~RoboclawDriver() {
 	LOG4CXX_INFO(_logger, "Stopping driver."); 
-	rc_uart_close(_fd);
+
+	for (unsigned int i = 0; i < _ports.size(); i++) {
+		delete _ports[i]->bus;
+		rc_uart_close(_ports[i]->fd);
+		delete _ports[i];
+	}
+
 	rc_gpio_close(_gpioFd);
 }
 
 void RoboclawDriver::initializeDriver() {
-	scoped_lock<interprocess_mutex> lock(serialPortMutex);
+	for (unsigned int i = 0; i < _ports.size(); i++) {
+		RoboclawPort *port = _ports[i];
 
-	_fd = rc_uart_open(_configuration->uart_port.c_str());
-	if (_fd == -1) {
-		LOG4CXX_FATAL(_logger, "Unable to open uart port: " << _configuration->uart_port);
-		exit(1);
-	}
-
-	speed_t uart_speed;
-	switch(_configuration->uart_speed) {
+		port->fd = rc_uart_open(port->path.c_str());
+		if (port->fd == -1) {
+			LOG4CXX_FATAL(_logger, "Unable to open uart port: " << port->path);
+			exit(1);
+		}
 
-	case 2400:
-		uart_speed = B2400;
-		break;
+		LOG4CXX_INFO(_logger, "Initializing driver, port: " << port->path << ", baud: " << _configuration->uart_speed
+				<< ", controllers: " << describeAddresses(port));
 
-	case 9600:
-		uart_speed = B9600;
-		break;
+		// standard rates map to termios constants, anything else goes through termios2/BOTHER
+		if (rc_uart_init_baud(port->fd, _configuration->uart_speed) < 0) {
+			LOG4CXX_FATAL(_logger, "Unable to set uart speed: " << _configuration->uart_speed << ". Aborting.");
+			exit(1);
+		}
 
-	case 19200:
-		uart_speed = B19200;
-		break;
+		// write-only commands (drive, stop) don't need to wait until the bytes leave the wire
+		rc_uart_set_command_drain(port->fd, _configuration->uart_command_drain);
 
-	case 38400:
-		uart_speed = B38400;
-		break;
+		// microseconds allowed for a reply on top of its transmission time
+		rc_uart_set_reply_timeout(port->fd, _configuration->uart_reply_timeout);
 
-	default:
-		LOG4CXX_FATAL(_logger, "Unknown uart speed: " << _configuration->uart_speed << ". Aborting.");
-		exit(1);
+		doSendEncoderSettings(port);
 	}
 
-	LOG4CXX_INFO(_logger, "Initializing driver, port: " << _configuration->uart_port.c_str()
-			<< ", baud: " << uart_speed);
-	rc_uart_init(_fd, uart_speed);
-
-	sendEncoderSettings();
-
 	LOG4CXX_INFO(_logger, "Opening reset gpio: " << _configuration->reset_gpio_path);
 	_gpioFd = rc_gpio_open(_configuration->reset_gpio_path.c_str());
 	if (_gpioFd == -1) {
@@ -86,214 +121,436 @@ void RoboclawDriver::initializeDriver() {
 		exit(1);
 	}
 
-	LOG4CXX_INFO(_logger, "Opening LED1 gpio: " << _configuration->led1_gpio_path);
-	_led1GpioFd = rc_gpio_open(_configuration->led1_gpio_path.c_str());
-	if (_led1GpioFd == -1) {
-		LOG4CXX_FATAL(_logger, "Unable to open LED1 gpio: " << _configuration->led1_gpio_path);
-		exit(1);
+	// from now on the ports belong to the bus threads, jobs queued before start wait for them
+	for (unsigned int i = 0; i < _ports.size(); i++) {
+		_ports[i]->bus->start();
 	}
+}
 
-	LOG4CXX_INFO(_logger, "Opening LED2 gpio: " << _configuration->led2_gpio_path);
-	_led2GpioFd = rc_gpio_open(_configuration->led2_gpio_path.c_str());
-	if (_led2GpioFd == -1) {
-		LOG4CXX_FATAL(_logger, "Unable to open LED2 gpio: " << _configuration->led2_gpio_path);
-		exit(1);
+// all ports work on it at once, returns when the slowest one is done
+void RoboclawDriver::executeOnPorts(RoboclawBusClass busClass, boost::function<void (RoboclawPort *)> job) {
+	bool done[RC_MAX_CONTROLLERS];
+
+	for (unsigned int i = 0; i < _ports.size(); i++) {
+		done[i] = false;
+		_ports[i]->bus->submit(busClass, boost::bind(job, _ports[i]), &done[i]);
 	}
 
-	driverReady = true;
-	driverIsNotReady.notify_all();
+	for (unsigned int i = 0; i < _ports.size(); i++) {
+		_ports[i]->bus->wait(&done[i]);
+	}
 }
 
+// throws if any wheel couldn't be read, the others are filled in anyway
 void RoboclawDriver::readCurrentSpeed(MotorsSpeedStruct *mss) throw(RoboclawSerialException) {
-	scoped_lock<interprocess_mutex> lock(serialPortMutex);
+	bool valid[RC_MAX_CONTROLLERS];
 
-	while (!driverReady) {
-		driverIsNotReady.wait(lock);
-	}
+	mss->acceleration = 0;
 
-	unsigned int flQpps, frQpps, rlQpps, rrQpps;
-	unsigned char flDir, frDir, rlDir, rrDir;
+	executeOnPorts(RC_BUS_SPEED_READ, boost::bind(&RoboclawDriver::doReadCurrentSpeed, this, _1, mss, valid));
 
-	if (rc_read_speed_m1(_fd, _configuration->front_rc_address, &frQpps, &frDir) < 0) {
-		LOG4CXX_WARN(_logger, "rc_read_speed_m1, " << (int)_configuration->front_rc_address << ": error");
+	for (unsigned int i = 0; i < _ports.size(); i++) {
+		if (!valid[i]) {
+			throw RoboclawSerialException();
+		}
 	}
 
-	if (rc_read_speed_m2(_fd, _configuration->front_rc_address, &flQpps, &flDir) < 0) {
-		LOG4CXX_WARN(_logger, "rc_read_speed_m2, " << (int)_configuration->front_rc_address << ": error");
+	if (_logger->isDebugEnabled()) {
+		LOG4CXX_DEBUG(_logger, "current_speed, " << describeWheels(mss->speed));
 	}
+}
 
-	if (rc_read_speed_m1(_fd, _configuration->rear_rc_address, &rrQpps, &rrDir) < 0) {
-		LOG4CXX_WARN(_logger, "rc_read_speed_m1, " << (int)_configuration->rear_rc_address << ": error");
-	}
+void RoboclawDriver::readEncoders(MotorsEncoderStruct *mes) throw(RoboclawSerialException) {
+	__u32 resets[RC_MAX_CONTROLLERS];
 
-	if (rc_read_speed_m2(_fd, _configuration->rear_rc_address, &rlQpps, &rlDir) < 0) {
-		LOG4CXX_WARN(_logger, "rc_read_speed_m2, " << (int)_configuration->rear_rc_address << ": error");
+	executeOnPorts(RC_BUS_SPEED_READ, boost::bind(&RoboclawDriver::doReadEncoders, this, _1, mes, resets));
+
+	mes->resets = 0;
+	for (unsigned int i = 0; i < _ports.size(); i++) {
+		mes->resets += resets[i];
 	}
 
-	mss->frontLeftSpeed = flDir == 0 ? (int)flQpps : -(int)flQpps;
-	mss->frontRightSpeed = frDir == 0 ? (int)frQpps : -(int)frQpps;
-	mss->rearLeftSpeed = rlDir == 0 ? (int)rlQpps : -(int)rlQpps;
-	mss->rearRightSpeed = rrDir == 0 ? (int)rrQpps : -(int)rrQpps;
+	mes->timestamp = rc_monotonic_us();
+}
+
+void RoboclawDriver::sendEncoderSettings() {
+	executeOnPorts(RC_BUS_SAFETY, boost::bind(&RoboclawDriver::doSendEncoderSettings, this, _1));
+}
+
+void RoboclawDriver::stopMotors() throw(RoboclawSerialException) {
+	LOG4CXX_INFO(_logger, "Stopping motors.");
+
+	executeOnPorts(RC_BUS_SAFETY, boost::bind(&RoboclawDriver::doStopMotors, this, _1));
+}
+
+void RoboclawDriver::sendMotorsEncoderCommand(MotorsSpeedStruct *mss) throw(RoboclawSerialException) {
+	if (mss == NULL) {
+		return;
+	}
 
 	if (_logger->isDebugEnabled()) {
-		LOG4CXX_DEBUG(_logger, "current_speed, fl: " << mss->frontLeftSpeed << ", fr: " << mss->frontRightSpeed << ", rl: " << mss->rearLeftSpeed << ", rr: " << mss->rearRightSpeed);
+		LOG4CXX_DEBUG(_logger, "rc_drive_speed, " << describeWheels(mss->speed) << ", accel: " << mss->acceleration);
 	}
 
-	return;
+	executeOnPorts(RC_BUS_MOTION, boost::bind(&RoboclawDriver::doSendMotorsEncoderCommand, this, _1, mss));
 }
 
-void RoboclawDriver::sendEncoderSettings() {
-	if (rc_set_pid_consts_m1(_fd, _configuration->front_rc_address, _configuration->motors_d_const,
-			_configuration->motors_p_const, _configuration->motors_i_const, _configuration->motors_max_qpps) < 0) {
-		LOG4CXX_WARN(_logger, "rc_set_pid_consts_m1, " << (int)_configuration->front_rc_address << ": error");
-	}
-	if (rc_set_pid_consts_m2(_fd, _configuration->front_rc_address, _configuration->motors_d_const,
-				_configuration->motors_p_const, _configuration->motors_i_const, _configuration->motors_max_qpps) < 0) {
-		LOG4CXX_WARN(_logger, "rc_set_pid_consts_m2, " << (int)_configuration->front_rc_address << ": error");
+// false if a write failed, the controllers may or may not have queued it
+bool RoboclawDriver::sendBufferedSegment(MotorsSegmentStruct *segment, bool now) throw(RoboclawSerialException) {
+	if (_logger->isDebugEnabled()) {
+		LOG4CXX_DEBUG(_logger, "rc_buffered_drive_speed_accel_dist, " << describeWheels(segment->speed.speed)
+				<< ", accel: " << segment->acceleration << ", now: " << now);
 	}
 
-	if (rc_set_pid_consts_m1(_fd, _configuration->rear_rc_address, _configuration->motors_d_const,
-				_configuration->motors_p_const, _configuration->motors_i_const, _configuration->motors_max_qpps) < 0) {
-		LOG4CXX_WARN(_logger, "rc_set_pid_consts_m1, " << (int)_configuration->rear_rc_address << ": error");
+	bool sent[RC_MAX_CONTROLLERS];
+	for (unsigned int i = 0; i < _ports.size(); i++) {
+		sent[i] = false;
 	}
 
-	if (rc_set_pid_consts_m2(_fd, _configuration->rear_rc_address, _configuration->motors_d_const,
-				_configuration->motors_p_const, _configuration->motors_i_const, _configuration->motors_max_qpps) < 0) {
-		LOG4CXX_WARN(_logger, "rc_set_pid_consts_m2, " << (int)_configuration->rear_rc_address << ": error");
+	executeOnPorts(RC_BUS_MOTION, boost::bind(&RoboclawDriver::doSendBufferedSegment, this, _1, segment, now, sent));
+
+	for (unsigned int i = 0; i < _ports.size(); i++) {
+		if (!sent[i]) {
+			return false;
+		}
 	}
+
+	return true;
 }
 
-void RoboclawDriver::stopMotors() throw(RoboclawSerialException) {
-	scoped_lock<interprocess_mutex> lock(serialPortMutex);
+void RoboclawDriver::readBufferLengths(MotorsBufferStruct *buffers) throw(RoboclawSerialException) {
+	bool valid[RC_MAX_CONTROLLERS];
+
+	executeOnPorts(RC_BUS_SPEED_READ, boost::bind(&RoboclawDriver::doReadBufferLengths, this, _1, buffers, valid));
 
-	while (!driverReady) {
-		driverIsNotReady.wait(lock);
+	buffers->valid = true;
+	for (unsigned int i = 0; i < _ports.size(); i++) {
+		buffers->valid = buffers->valid && valid[i];
 	}
+}
 
-	LOG4CXX_INFO(_logger, "Stopping motors.");
-	rc_drive_forward(_fd, _configuration->front_rc_address, 0);
-	rc_drive_forward(_fd, _configuration->rear_rc_address, 0);
+// battery is shared, the first controller reads it
+void RoboclawDriver::readMainBatteryVoltage(__u16 *voltage) throw(RoboclawSerialException) {
+	_ports[0]->bus->execute(RC_BUS_MONITORING, boost::bind(&RoboclawDriver::doReadMainBatteryVoltage, this, _ports[0], voltage));
+}
 
+// everything due in one job per port, requests to one controller are pipelined
+void RoboclawDriver::readHealth(rc_health *health) throw(RoboclawSerialException) {
+	executeOnPorts(RC_BUS_MONITORING, boost::bind(&RoboclawDriver::doReadHealth, this, _1, health));
 }
 
-void RoboclawDriver::sendMotorsEncoderCommand(MotorsSpeedStruct *mss) throw(RoboclawSerialException) {
-	scoped_lock<interprocess_mutex> lock(serialPortMutex);
+// one reset line for all controllers, every port drops its setpoints
+void RoboclawDriver::reset() {
+	executeOnPorts(RC_BUS_SAFETY, boost::bind(&RoboclawDriver::doReset, this, _1));
+}
 
-	while (!driverReady) {
-		driverIsNotReady.wait(lock);
-	}
+// wheel behind the i-th motor of the port, m1 and m2 of each controller in turn, -1 - none
+static int portWheel(RoboclawPort *port, int i) {
+	return i % 2 == 0 ? port->m1Wheels[i / 2] : port->m2Wheels[i / 2];
+}
 
-	if (mss != NULL) {
-		if (_logger->isDebugEnabled()) {
-			LOG4CXX_DEBUG(_logger, "rc_drive_speed, fl: " << mss->frontLeftSpeed << ", fr: " << mss->frontRightSpeed << ", rl: " << mss->rearLeftSpeed << ", rr: " << mss->rearRightSpeed);
-		}
+// motors without a wheel are held still
+static int wheelSpeed(const int *speeds, int wheel) {
+	return wheel >= 0 ? speeds[wheel] : 0;
+}
 
-		if (rc_drive_speed(_fd, _configuration->front_rc_address, mss->frontRightSpeed, mss->frontLeftSpeed) < 0) {
-			LOG4CXX_WARN(_logger, "rc_read_drive_speed, " << (int)_configuration->front_rc_address << ": error");
-		}
+void RoboclawDriver::doReadCurrentSpeed(RoboclawPort *port, MotorsSpeedStruct *mss, bool *valid) {
+	// requests to one controller are pipelined
+	__u32 qpps[2 * RC_MAX_CONTROLLERS];
+	__u8 dirs[2 * RC_MAX_CONTROLLERS];
+
+	memset(qpps, 0, sizeof(qpps));
+	memset(dirs, 0, sizeof(dirs));
+
+	valid[port->index] = rc_read_speeds(port->fd, port->addresses, port->count, qpps, dirs) == 2 * port->count;
 
-		if (rc_drive_speed(_fd, _configuration->rear_rc_address, mss->rearRightSpeed, mss->rearLeftSpeed) < 0) {
-			LOG4CXX_WARN(_logger, "rc_read_drive_speed, " << (int)_configuration->rear_rc_address << ": error");	
+	if (!valid[port->index]) {
+		LOG4CXX_WARN(_logger, "rc_read_speeds, " << describeAddresses(port) << ": error");
+		_serialFailures++;
+	}
+
+	for (int i = 0; i < 2 * port->count; i++) {
+		int wheel = portWheel(port, i);
+
+		if (wheel >= 0) {
+			mss->speed[wheel] = dirs[i] == 0 ? (int)qpps[i] : -(int)qpps[i];
 		}
 	}
 }
 
-void RoboclawDriver::readMainBatteryVoltage(__u16 *voltage) throw(RoboclawSerialException) {
-	scoped_lock<interprocess_mutex> lock(serialPortMutex);
+void RoboclawDriver::doReadEncoders(RoboclawPort *port, MotorsEncoderStruct *mes, __u32 *resets) {
+	// requests to one controller are pipelined
+	__u32 counts[2 * RC_MAX_CONTROLLERS];
+	__u8 statuses[2 * RC_MAX_CONTROLLERS];
+	int results[2 * RC_MAX_CONTROLLERS];
 
-	while (!driverReady) {
-		driverIsNotReady.wait(lock);
+	memset(counts, 0, sizeof(counts));
+	memset(statuses, 0, sizeof(statuses));
+
+	if (rc_read_encoders(port->fd, port->addresses, port->count, counts, statuses, results) < 2 * port->count) {
+		LOG4CXX_WARN(_logger, "rc_read_encoders, " << describeAddresses(port) << ": error");
+		_serialFailures++;
 	}
 
-	if (voltage != NULL) {
-		if (rc_read_main_battery_voltage_level(_fd, _configuration->front_rc_address, voltage) < 0) {
-			LOG4CXX_WARN(_logger, "rc_read_main_battery_voltage_level: error");
+	for (int i = 0; i < 2 * port->count; i++) {
+		int wheel = portWheel(port, i);
+
+		if (wheel >= 0) {
+			mes->count[wheel] = counts[i];
+			mes->status[wheel] = statuses[i];
+			mes->valid[wheel] = results[i] == 0;
 		}
-	} 
+	}
+
+	// read on the same thread as the reset, so it matches the counts
+	resets[port->index] = port->resets;
+}
 
+void RoboclawDriver::doSendEncoderSettings(RoboclawPort *port) {
+	invalidateSetpoints(port);
+
+	// all motors of the port in one write
+	rc_batch<2 * RC_MAX_CONTROLLERS * rc_cmd_set_pid_consts_m1::size> batch;
+
+	for (int i = 0; i < port->count; i++) {
+		rc_cmd_set_pid_consts_m1::encode(batch.next<rc_cmd_set_pid_consts_m1>(), port->addresses[i],
+				_configuration->motors_d_const, _configuration->motors_p_const, _configuration->motors_i_const, _configuration->motors_max_qpps);
+		rc_cmd_set_pid_consts_m2::encode(batch.next<rc_cmd_set_pid_consts_m2>(), port->addresses[i],
+				_configuration->motors_d_const, _configuration->motors_p_const, _configuration->motors_i_const, _configuration->motors_max_qpps);
+	}
+
+	if (batch.write(port->fd) < 0) {
+		LOG4CXX_WARN(_logger, "rc_set_pid_consts, " << describeAddresses(port) << ": error");
+		_serialFailures++;
+	}
 }
 
-void RoboclawDriver::readErrorStatus(__u8 *frontErrorStatus, __u8 *rearErrorStatus) throw(RoboclawSerialException) {
-	scoped_lock<interprocess_mutex> lock(serialPortMutex);
+void RoboclawDriver::doStopMotors(RoboclawPort *port) {
+	invalidateSetpoints(port);
 
-	while (!driverReady) {
-		driverIsNotReady.wait(lock);
+	rc_batch<RC_MAX_CONTROLLERS * rc_cmd_drive_forward::size> batch;
+
+	for (int i = 0; i < port->count; i++) {
+		rc_cmd_drive_forward::encode(batch.next<rc_cmd_drive_forward>(), port->addresses[i], 0);
+	}
+
+	if (batch.write(port->fd) < 0) {
+		LOG4CXX_WARN(_logger, "rc_drive_forward, " << describeAddresses(port) << ": error");
+		_serialFailures++;
 	}
 
-	if (frontErrorStatus != NULL) {
-		if (rc_read_error_status(_fd, _configuration->front_rc_address, frontErrorStatus) < 0) {
-			LOG4CXX_WARN(_logger, "rc_read_error_status, " << (int)_configuration->front_rc_address << ": error");
+}
+
+void RoboclawDriver::doSendMotorsEncoderCommand(RoboclawPort *port, MotorsSpeedStruct *mss) {
+	__u64 now = rc_monotonic_us();
+	bool send[RC_MAX_CONTROLLERS];
+
+	// all controllers of the port in one write, acceleration limited commands are the longer ones
+	rc_batch<RC_MAX_CONTROLLERS * rc_cmd_drive_speed_accel::size> batch;
+
+	for (int i = 0; i < port->count; i++) {
+		int m1Speed = wheelSpeed(mss->speed, port->m1Wheels[i]);
+		int m2Speed = wheelSpeed(mss->speed, port->m2Wheels[i]);
+
+		send[i] = needsSending(&port->setpoints[i], m1Speed, m2Speed, mss->acceleration, now);
+		if (!send[i]) {
+			continue;
 		}
+
+		if (mss->acceleration > 0) {
+			rc_cmd_drive_speed_accel::encode(batch.next<rc_cmd_drive_speed_accel>(), port->addresses[i],
+					mss->acceleration, m1Speed, m2Speed);
+		} else {
+			rc_cmd_drive_speed::encode(batch.next<rc_cmd_drive_speed>(), port->addresses[i], m1Speed, m2Speed);
+		}
+	}
+
+	if (batch.empty()) {
+		return;
 	}
 
-	if (rearErrorStatus != NULL) {
-		if (rc_read_error_status(_fd, _configuration->rear_rc_address, rearErrorStatus) < 0) {
-			LOG4CXX_WARN(_logger, "rc_read_error_status, " << (int)_configuration->rear_rc_address << ": error");
+	if (batch.write(port->fd) < 0) {
+		LOG4CXX_WARN(_logger, "rc_drive_speed, " << describeAddresses(port) << ": error");
+		_serialFailures++;
+		invalidateSetpoints(port);
+		return;
+	}
+
+	for (int i = 0; i < port->count; i++) {
+		if (send[i]) {
+			updateSetpoint(&port->setpoints[i], wheelSpeed(mss->speed, port->m1Wheels[i]),
+					wheelSpeed(mss->speed, port->m2Wheels[i]), mss->acceleration, now);
 		}
 	}
+}
+
+// now drops whatever the controllers still have buffered and starts this segment at once
+void RoboclawDriver::doSendBufferedSegment(RoboclawPort *port, MotorsSegmentStruct *segment, bool now, bool *sent) {
+	// motors no longer follow the last drive command
+	invalidateSetpoints(port);
+
+	rc_batch<RC_MAX_CONTROLLERS * rc_cmd_buffered_drive_speed_accel_dist::size> batch;
+
+	for (int i = 0; i < port->count; i++) {
+		int m1Wheel = port->m1Wheels[i];
+		int m2Wheel = port->m2Wheels[i];
+
+		rc_cmd_buffered_drive_speed_accel_dist::encode(batch.next<rc_cmd_buffered_drive_speed_accel_dist>(), port->addresses[i],
+				segment->acceleration, wheelSpeed(segment->speed.speed, m1Wheel), m1Wheel >= 0 ? segment->distance[m1Wheel] : 0,
+				wheelSpeed(segment->speed.speed, m2Wheel), m2Wheel >= 0 ? segment->distance[m2Wheel] : 0, now ? 1 : 0);
+	}
+
+	if (batch.write(port->fd) < 0) {
+		LOG4CXX_WARN(_logger, "rc_buffered_drive_speed_accel_dist, " << describeAddresses(port) << ": error");
+		_serialFailures++;
+		return;
+	}
 
+	sent[port->index] = true;
 }
 
-void RoboclawDriver::readTemperature(__u16 *frontTemperature, __u16 *rearTemperature) throw(RoboclawSerialException) {
-	scoped_lock<interprocess_mutex> lock(serialPortMutex);
+void RoboclawDriver::doReadBufferLengths(RoboclawPort *port, MotorsBufferStruct *buffers, bool *valid) {
+	__u8 lengths[2 * RC_MAX_CONTROLLERS];
+	int results[RC_MAX_CONTROLLERS];
 
-	while (!driverReady) {
-		driverIsNotReady.wait(lock);
+	if (rc_read_buffer_lengths(port->fd, port->addresses, port->count, lengths, results) < port->count) {
+		LOG4CXX_WARN(_logger, "rc_read_buffer_lengths, " << describeAddresses(port) << ": error");
+		_serialFailures++;
 	}
 
-	if (frontTemperature != NULL) {
-		if (rc_read_temperature(_fd, _configuration->front_rc_address, frontTemperature) < 0) {
-			LOG4CXX_WARN(_logger, "rc_read_temperature, " << (int)_configuration->front_rc_address << ": error");
-		}
+	valid[port->index] = true;
+
+	for (int i = 0; i < port->count; i++) {
+		valid[port->index] = valid[port->index] && results[i] == 0;
 	}
 
-	if (rearTemperature != NULL) {
-		if (rc_read_temperature(_fd, _configuration->rear_rc_address, rearTemperature) < 0) {
-			LOG4CXX_WARN(_logger, "rc_read_temperature, " << (int)_configuration->rear_rc_address << ": error");
+	for (int i = 0; i < 2 * port->count; i++) {
+		int wheel = portWheel(port, i);
+
+		if (wheel >= 0) {
+			buffers->length[wheel] = lengths[i];
 		}
 	}
 }
 
-void RoboclawDriver::reset() {
-	scoped_lock<interprocess_mutex> lock(serialPortMutex);
+// same setpoint is only resent when the keepalive expires, motors_command_keepalive = 0 sends every time
+bool RoboclawDriver::needsSending(RoboclawSetpoint *setpoint, int m1Speed, int m2Speed, __u32 acceleration, __u64 now) {
+	return _configuration->motors_command_keepalive == 0 || !setpoint->valid ||
+			setpoint->m1Speed != m1Speed || setpoint->m2Speed != m2Speed || setpoint->acceleration != acceleration ||
+			now - setpoint->sendTime >= (__u64)_configuration->motors_command_keepalive * 1000;
+}
+
+void RoboclawDriver::updateSetpoint(RoboclawSetpoint *setpoint, int m1Speed, int m2Speed, __u32 acceleration, __u64 now) {
+	setpoint->m1Speed = m1Speed;
+	setpoint->m2Speed = m2Speed;
+	setpoint->acceleration = acceleration;
+	setpoint->sendTime = now;
+	setpoint->valid = true;
+}
+
+void RoboclawDriver::invalidateSetpoints(RoboclawPort *port) {
+	for (int i = 0; i < RC_MAX_CONTROLLERS; i++) {
+		port->setpoints[i].valid = false;
+	}
+}
+
+string RoboclawDriver::describeAddresses(RoboclawPort *port) {
+	ostringstream out;
 
-	while (!driverReady) {
-		driverIsNotReady.wait(lock);
+	for (int i = 0; i < port->count; i++) {
+		out << (i > 0 ? ", " : "") << (int)port->addresses[i];
 	}
 
-	if (rc_reset(_gpioFd) < 0) {
-		LOG4CXX_WARN(_logger, "rc_reset: error");
+	return out.str();
+}
+
+string RoboclawDriver::describeWheels(const int *values) {
+	ostringstream out;
+
+	for (unsigned int i = 0; i < _configuration->wheels.size(); i++) {
+		out << (i > 0 ? ", " : "") << _configuration->wheels[i].name << ": " << values[i];
 	}
+
+	return out.str();
+}
+
+void RoboclawDriver::doReadMainBatteryVoltage(RoboclawPort *port, __u16 *voltage) {
+	if (voltage != NULL) {
+		if (rc_read_main_battery_voltage_level(port->fd, port->addresses[0], voltage) < 0) {
+			LOG4CXX_WARN(_logger, "rc_read_main_battery_voltage_level: error");
+			_serialFailures++;
+		}
+	} 
+
 }
 
-void RoboclawDriver::setLed1(bool state) {
-	scoped_lock<interprocess_mutex> lock(serialPortMutex);
+void RoboclawDriver::doReadHealth(RoboclawPort *port, rc_health *health) {
+	// up to three reads per controller, each call stays within one pipeline
+	const int perCall = RC_PIPELINE_MAX / 3;
+	rc_health portHealth[RC_MAX_CONTROLLERS];
+	bool failed = false;
 
-	while (!driverReady) {
-		driverIsNotReady.wait(lock);
+	for (int i = 0; i < port->count; i++) {
+		portHealth[i] = health[port->controllers[i]];
 	}
 
-	if (_logger->isDebugEnabled()) {
-		LOG4CXX_DEBUG(_logger, "rc_gpio_set, setting led1: " << state);
+	for (int first = 0; first < port->count; first += perCall) {
+		int count = std::min(perCall, port->count - first);
+
+		if (rc_read_health(port->fd, port->addresses + first, count, portHealth + first) < 0) {
+			failed = true;
+		}
 	}
 
-	if (rc_gpio_set(_led1GpioFd, !state) < 0) {
-		LOG4CXX_WARN(_logger, "rc_gpio_set, led1: error");
+	for (int i = 0; i < port->count; i++) {
+		failed = failed || portHealth[i].result != portHealth[i].what;
+		health[port->controllers[i]] = portHealth[i];
+	}
+
+	if (failed) {
+		LOG4CXX_WARN(_logger, "rc_read_health, " << describeAddresses(port) << ": error");
+		_serialFailures++;
 	}
 }
 
-void RoboclawDriver::setLed2(bool state) {
-	scoped_lock<interprocess_mutex> lock(serialPortMutex);
+void RoboclawDriver::doReset(RoboclawPort *port) {
+	invalidateSetpoints(port);
+	port->resets++;
 
-	while (!driverReady) {
-		driverIsNotReady.wait(lock);
+	if (port->index == 0 && rc_reset(_gpioFd) < 0) {
+		LOG4CXX_WARN(_logger, "rc_reset: error");
 	}
+}
 
-	if (_logger->isDebugEnabled()) {
-		LOG4CXX_DEBUG(_logger, "rc_gpio_set, setting led2: " << state);	
-	}
-	
-	if (rc_gpio_set(_led2GpioFd, !state) < 0) {
-		LOG4CXX_WARN(_logger, "rc_gpio_set, led2: error");
+static string histogramSummary(const rc_histogram *histogram) {
+	ostringstream out;
+
+	out << "p50: " << rc_histogram_percentile(histogram, 50) << "us, p99: " << rc_histogram_percentile(histogram, 99)
+			<< "us, max: " << histogram->max << "us";
+
+	return out.str();
+}
+
+unsigned int RoboclawDriver::getSerialFailures() {
+	return _serialFailures.load(boost::memory_order_relaxed);
+}
+
+// safe from any thread, counters are read without stopping the bus
+void RoboclawDriver::logUartStatistics() {
+	rc_command_stats stats;
+
+	for (int id = 0; id < RC_STATS_COMMANDS; id++) {
+		rc_stats_get((__u8)id, &stats);
+
+		if (stats.writes == 0 && stats.write_errors == 0) {
+			continue;
+		}
+
+		LOG4CXX_INFO(_logger, "Command " << id << ": writes: " << stats.writes << ", write errors: " << stats.write_errors
+				<< ", replies: " << stats.replies << ", timeouts: " << stats.timeouts << ", crc errors: " << stats.crc_errors
+				<< ", retries: " << stats.retries);
+		LOG4CXX_INFO(_logger, "Command " << id << " write: " << histogramSummary(&stats.write_time)
+				<< "; drain: " << histogramSummary(&stats.drain_wait)
+				<< "; reply: " << histogramSummary(&stats.reply_time));
 	}
-}
\ No newline at end of file
+}
@@ -11,13 +11,49 @@
 #include <boost/interprocess/sync/interprocess_condition.hpp>
 #include <boost/interprocess/sync/interprocess_mutex.hpp>
 #include <boost/interprocess/managed_shared_memory.hpp>
+#include <boost/atomic.hpp>
+#include <boost/function.hpp>
 #include <log4cxx/logger.h>
+#include <string>
+#include <vector>
 
 #include "RoboclawCommon.h"
+#include "RoboclawBus.h"
+#include "RoboclawLib.h"
 
 #define UART_SPEED B38400
 #define ROBOCLAW_PORT "/dev/ttyO3"
 
+// last drive command sent to one Roboclaw
+struct RoboclawSetpoint {
+	int m1Speed;
+	int m2Speed;
+	__u32 acceleration;
+	__u64 sendTime; // monotonic, us
+	bool valid;
+};
+
+// one uart with its controllers, everything but the bus is touched by the bus thread only
+struct RoboclawPort {
+	int index;
+	std::string path;
+	int fd;
+	RoboclawBus *bus;
+
+	int count;									// controllers on the port
+	__u8 addresses[RC_MAX_CONTROLLERS];
+	int controllers[RC_MAX_CONTROLLERS];		// index in RoboclawConfiguration::controllers
+	int m1Wheels[RC_MAX_CONTROLLERS];			// wheel driven by motor 1, -1 - none
+	int m2Wheels[RC_MAX_CONTROLLERS];
+	RoboclawSetpoint setpoints[RC_MAX_CONTROLLERS];
+	__u32 resets;								// controllers resets, counters restart after each
+};
+
+/*
+ * Every port has its own bus thread. Requests covering all controllers are
+ * handed to all buses at once and wait for the slowest port, so latency
+ * doesn't grow with the number of ports.
+ */
 class RoboclawDriver {
 
 public:
@@ -27,31 +63,51 @@ public:
 	void initializeDriver();
 	void sendEncoderSettings();
 	void readCurrentSpeed(MotorsSpeedStruct *mss) throw(RoboclawSerialException);
+	void readEncoders(MotorsEncoderStruct *mes) throw(RoboclawSerialException);
 	void sendMotorsEncoderCommand(MotorsSpeedStruct *mss) throw(RoboclawSerialException);
+	bool sendBufferedSegment(MotorsSegmentStruct *segment, bool now) throw(RoboclawSerialException);
+	void readBufferLengths(MotorsBufferStruct *buffers) throw(RoboclawSerialException);
 	void readMainBatteryVoltage(__u16 *voltage) throw(RoboclawSerialException);
-	void readErrorStatus(__u8 *frontErrorStatus, __u8 *rearErrorStatus) throw(RoboclawSerialException);
-	void readTemperature(__u16 *frontTemperature, __u16 *rearTemperature) throw(RoboclawSerialException);
+	// one entry per controller, in RoboclawConfiguration::controllers order
+	void readHealth(rc_health *health) throw(RoboclawSerialException);
 	void stopMotors() throw(RoboclawSerialException);
 	void reset();
-	void setLed1(bool state);
-	void setLed2(bool state);
-
-	boost::interprocess::interprocess_condition driverIsNotReady;
-	boost::interprocess::interprocess_mutex serialPortMutex;
-
-	bool driverReady;
+	void logUartStatistics();
+	unsigned int getSerialFailures();
 
 private:
 
 	static log4cxx::LoggerPtr _logger;
 
-	int _fd;
+	std::vector<RoboclawPort *> _ports;
+
 	int _gpioFd;
-	int _led1GpioFd;
-	int _led2GpioFd;
 
 	RoboclawConfiguration *_configuration;
 
+	// failed serial transactions so far, written by the bus threads only
+	boost::atomic<unsigned int> _serialFailures;
+
+	void executeOnPorts(RoboclawBusClass busClass, boost::function<void (RoboclawPort *)> job);
+
+	bool needsSending(RoboclawSetpoint *setpoint, int m1Speed, int m2Speed, __u32 acceleration, __u64 now);
+	void updateSetpoint(RoboclawSetpoint *setpoint, int m1Speed, int m2Speed, __u32 acceleration, __u64 now);
+	void invalidateSetpoints(RoboclawPort *port);
+	std::string describeAddresses(RoboclawPort *port);
+	std::string describeWheels(const int *values);
+
+	// run on the port's bus thread
+	void doReadCurrentSpeed(RoboclawPort *port, MotorsSpeedStruct *mss, bool *valid);
+	void doReadEncoders(RoboclawPort *port, MotorsEncoderStruct *mes, __u32 *resets);
+	void doSendEncoderSettings(RoboclawPort *port);
+	void doStopMotors(RoboclawPort *port);
+	void doSendMotorsEncoderCommand(RoboclawPort *port, MotorsSpeedStruct *mss);
+	// sent and valid are indexed by port
+	void doSendBufferedSegment(RoboclawPort *port, MotorsSegmentStruct *segment, bool now, bool *sent);
+	void doReadBufferLengths(RoboclawPort *port, MotorsBufferStruct *buffers, bool *valid);
+	void doReadMainBatteryVoltage(RoboclawPort *port, __u16 *voltage);
+	void doReadHealth(RoboclawPort *port, rc_health *health);
+	void doReset(RoboclawPort *port);
 
 
 };
@@ -0,0 +1,149 @@
+/*
+ * RoboclawLeds.cpp
+ *
+ *  Created on: 17-10-2026
+ */
+
+#include <cstdlib>
+
+#include <boost/interprocess/sync/scoped_lock.hpp>
+#include <boost/thread/thread_time.hpp>
+
+#include "RoboclawLeds.h"
+#include "RoboclawLib.h"
+
+using namespace boost;
+using namespace boost::interprocess;
+using namespace log4cxx;
+
+LoggerPtr RoboclawLeds::_logger (Logger::getLogger("Roboclaw.Leds"));
+
+RoboclawLeds::RoboclawLeds(RoboclawConfiguration *configuration): _configuration(configuration), _changed(false),
+		_ledsThread(NULL) {
+
+	_leds[RC_LED1].path = configuration->led1_gpio_path;
+	_leds[RC_LED2].path = configuration->led2_gpio_path;
+
+	for (int i = 0; i < RC_LEDS; i++) {
+		_leds[i].fd = -1;
+		_leds[i].state = false;
+		_leds[i].written = false;
+		_leds[i].known = false;
+		_leds[i].lastActivity = 0;
+		_leds[i].lit = false;
+	}
+}
+
+RoboclawLeds::~RoboclawLeds() {
+
+}
+
+void RoboclawLeds::initializeLeds() {
+	for (int i = 0; i < RC_LEDS; i++) {
+		LOG4CXX_INFO(_logger, "Opening LED" << i + 1 << " gpio: " << _leds[i].path);
+
+		_leds[i].fd = rc_gpio_open(_leds[i].path.c_str());
+		if (_leds[i].fd == -1) {
+			LOG4CXX_FATAL(_logger, "Unable to open LED" << i + 1 << " gpio: " << _leds[i].path);
+			exit(1);
+		}
+	}
+}
+
+void RoboclawLeds::start() {
+	_ledsThread = new boost::thread(boost::ref(*this));
+}
+
+void RoboclawLeds::set(RoboclawLed led, bool state) {
+	scoped_lock<interprocess_mutex> lock(_ledsMutex);
+
+	_leds[led].state = state;
+	_changed = true;
+
+	_ledsChanged.notify_one();
+}
+
+void RoboclawLeds::activity(RoboclawLed led) {
+	_leds[led].lastActivity.store(rc_monotonic_us());
+
+	// a lit led is checked again when its hold runs out, it sees this activity then
+	if (!_leds[led].lit.load()) {
+		scoped_lock<interprocess_mutex> lock(_ledsMutex);
+
+		_changed = true;
+		_ledsChanged.notify_one();
+	}
+}
+
+void RoboclawLeds::operator()() {
+	LOG4CXX_INFO(_logger, "Leds thread started, activity hold: " << _configuration->led_activity_hold << "ms");
+
+	__u64 hold = (__u64)_configuration->led_activity_hold * 1000;
+	bool states[RC_LEDS];
+	__u64 activities[RC_LEDS];
+
+	scoped_lock<interprocess_mutex> lock(_ledsMutex);
+
+	while (1) {
+		__u64 now = rc_monotonic_us();
+		__u64 expiry = 0; // monotonic, us, 0 - nothing to wait for
+
+		for (int i = 0; i < RC_LEDS; i++) {
+			activities[i] = _leds[i].lastActivity.load();
+
+			bool active = activities[i] != 0 && now - activities[i] < hold;
+			if (active && (expiry == 0 || activities[i] + hold < expiry)) {
+				expiry = activities[i] + hold;
+			}
+
+			states[i] = active || _leds[i].state;
+		}
+
+		_changed = false;
+
+		// gpio writes don't hold up set() and activity()
+		lock.unlock();
+
+		for (int i = 0; i < RC_LEDS; i++) {
+			if (!_leds[i].known || _leds[i].written != states[i]) {
+				write(&_leds[i], states[i]);
+			}
+
+			_leds[i].lit.store(states[i]);
+		}
+
+		lock.lock();
+
+		// activity() may have found the led still lit right before it went dark
+		for (int i = 0; i < RC_LEDS; i++) {
+			if (!states[i] && _leds[i].lastActivity.load() != activities[i]) {
+				_changed = true;
+			}
+		}
+
+		if (_changed) {
+			continue;
+		}
+
+		if (expiry == 0) {
+			_ledsChanged.wait(lock);
+		} else {
+			_ledsChanged.timed_wait(lock, boost::get_system_time() + boost::posix_time::microseconds(expiry - now));
+		}
+	}
+}
+
+void RoboclawLeds::write(Led *led, bool state) {
+	if (_logger->isDebugEnabled()) {
+		LOG4CXX_DEBUG(_logger, "rc_gpio_set, setting " << led->path << ": " << state);
+	}
+
+	// leds are active low
+	if (rc_gpio_set(led->fd, !state) < 0) {
+		LOG4CXX_WARN(_logger, "rc_gpio_set, " << led->path << ": error");
+		return;
+	}
+
+	led->written = state;
+	led->known = true;
+}
@@ -0,0 +1,76 @@
+/*
+ * RoboclawLeds.h
+ *
+ *  Created on: 17-10-2026
+ */
+
+#ifndef ROBOCLAWLEDS_H_
+#define ROBOCLAWLEDS_H_
+
+#include <string>
+
+#include <boost/atomic.hpp>
+#include <boost/thread.hpp>
+#include <boost/interprocess/sync/interprocess_condition.hpp>
+#include <boost/interprocess/sync/interprocess_mutex.hpp>
+#include <log4cxx/logger.h>
+
+#include "RoboclawCommon.h"
+
+enum RoboclawLed {
+	RC_LED1 = 0,
+	RC_LED2,
+	RC_LEDS
+};
+
+/*
+ * Status leds, written by their own thread and only when a led actually
+ * changes, so callers never touch the gpio or wait for the serial ports.
+ * Activity keeps a led lit for led_activity_hold after the last call, a
+ * stream of messages costs at most two writes per hold period.
+ */
+class RoboclawLeds {
+
+public:
+	RoboclawLeds(RoboclawConfiguration *configuration);
+	virtual ~RoboclawLeds();
+
+	void initializeLeds();
+	void start();
+
+	// state shown while there is no activity
+	void set(RoboclawLed led, bool state);
+
+	// cheap enough to call for every message, takes the lock only to light a dark led
+	void activity(RoboclawLed led);
+
+	void operator()();
+
+private:
+
+	struct Led {
+		std::string path;
+		int fd;
+		bool state;							// set() one
+		bool written;						// shown by the gpio, thread only
+		bool known;							// false until the first write
+		boost::atomic<__u64> lastActivity;	// monotonic, us, 0 - none yet
+		boost::atomic<bool> lit;			// written by the thread, activity() skips the lock while set
+	};
+
+	static log4cxx::LoggerPtr _logger;
+
+	RoboclawConfiguration *_configuration;
+
+	Led _leds[RC_LEDS];
+
+	boost::interprocess::interprocess_mutex _ledsMutex;
+	boost::interprocess::interprocess_condition _ledsChanged;
+	bool _changed;
+
+	boost::thread *_ledsThread;
+
+	void write(Led *led, bool state);
+};
+
+#endif /* ROBOCLAWLEDS_H_ */
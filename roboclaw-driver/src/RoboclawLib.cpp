@@ -1,15 +1,183 @@
 #include <cstdio>
+#include <cstdlib>
+#include <cerrno>
 #include <unistd.h>
 #include <linux/types.h>
 #include <termios.h>
 #include <fcntl.h>
 #include <sys/ioctl.h>
+#include <linux/gpio.h>
+#include <poll.h>
 #include <strings.h>
+#include <cstring>
+#include <time.h>
 
 #include <boost/thread.hpp>
 #include <boost/thread/thread_time.hpp>
 
 #include "RoboclawLib.h"
+#include "RoboclawPacket.h"
+
+// per-port settings, zero means default (38400 baud, drain after every write, RC_UART_REPLY_TIMEOUT_US)
+struct rc_uart_state {
+    __u32 baud;
+    bool skip_command_drain;
+    __u32 reply_timeout_us;
+    __u64 tx_idle_us;
+    __u8 command; // last command written, drain and reply time are booked on it
+};
+
+static rc_uart_state rc_uart_states[RC_UART_MAX_FDS];
+
+static rc_uart_state *rc_uart_get_state(int fd) {
+    if (fd < 0 || fd >= RC_UART_MAX_FDS) {
+        return NULL;
+    }
+
+    return &rc_uart_states[fd];
+}
+
+static const struct {
+    __u32 baud;
+    speed_t speed;
+} rc_uart_speeds[] = {
+    { 2400, B2400 },
+    { 4800, B4800 },
+    { 9600, B9600 },
+    { 19200, B19200 },
+    { 38400, B38400 },
+    { 57600, B57600 },
+    { 115200, B115200 },
+    { 230400, B230400 },
+    { 460800, B460800 },
+};
+
+#define RC_UART_SPEEDS_COUNT (sizeof(rc_uart_speeds) / sizeof(rc_uart_speeds[0]))
+
+static __u32 rc_speed_to_baud(speed_t speed) {
+    for (unsigned int i = 0; i < RC_UART_SPEEDS_COUNT; i++) {
+        if (rc_uart_speeds[i].speed == speed) {
+            return rc_uart_speeds[i].baud;
+        }
+    }
+
+    return RC_UART_DEFAULT_BAUD;
+}
+
+/*
+ * struct termios2 from <asm/termbits.h>, which can't be included together with <termios.h>.
+ * Lets the kernel take any integer baud rate (BOTHER) instead of one of the Bxxx constants.
+ */
+#define RC_TERMIOS2_NCCS 19
+#define RC_BOTHER 0010000
+
+struct rc_termios2 {
+    tcflag_t c_iflag;
+    tcflag_t c_oflag;
+    tcflag_t c_cflag;
+    tcflag_t c_lflag;
+    cc_t c_line;
+    cc_t c_cc[RC_TERMIOS2_NCCS];
+    speed_t c_ispeed;
+    speed_t c_ospeed;
+};
+
+#define RC_TCGETS2 _IOR('T', 0x2A, struct rc_termios2)
+#define RC_TCSETS2 _IOW('T', 0x2B, struct rc_termios2)
+
+// updated by the threads using the ports, readers may see a transaction half counted,
+// with several ports busy at once an increment may occasionally get lost
+static rc_command_stats rc_stats[RC_STATS_COMMANDS];
+
+static rc_command_stats *rc_stats_for(__u8 command_id) {
+    return command_id < RC_STATS_COMMANDS ? &rc_stats[command_id] : NULL;
+}
+
+static int rc_histogram_bucket(__u64 value) {
+    if (value < RC_HISTOGRAM_LINEAR) {
+        return (int)value;
+    }
+
+    int msb = 63 - __builtin_clzll(value);
+    int sub = (int)(value >> (msb - RC_HISTOGRAM_SUB_BITS)) & (RC_HISTOGRAM_SUB_BUCKETS - 1);
+    int bucket = RC_HISTOGRAM_LINEAR + (msb - RC_HISTOGRAM_LINEAR_BITS) * RC_HISTOGRAM_SUB_BUCKETS + sub;
+
+    return bucket < RC_HISTOGRAM_BUCKETS ? bucket : RC_HISTOGRAM_BUCKETS - 1;
+}
+
+// largest value falling into the bucket
+static __u64 rc_histogram_bucket_limit(int bucket) {
+    if (bucket < RC_HISTOGRAM_LINEAR) {
+        return (__u64)bucket;
+    }
+
+    int msb = RC_HISTOGRAM_LINEAR_BITS + (bucket - RC_HISTOGRAM_LINEAR) / RC_HISTOGRAM_SUB_BUCKETS;
+    int sub = (bucket - RC_HISTOGRAM_LINEAR) % RC_HISTOGRAM_SUB_BUCKETS;
+    __u64 width = (__u64)1 << (msb - RC_HISTOGRAM_SUB_BITS);
+
+    return ((__u64)1 << msb) + (__u64)(sub + 1) * width - 1;
+}
+
+static void rc_histogram_record(rc_histogram *histogram, __u64 value) {
+    histogram->counts[rc_histogram_bucket(value)]++;
+    histogram->count++;
+    histogram->sum += value;
+
+    if (value > histogram->max) {
+        histogram->max = value;
+    }
+}
+
+__u64 rc_histogram_percentile(const rc_histogram *histogram, double percentile) {
+    if (histogram->count == 0) {
+        return 0;
+    }
+
+    __u32 rank = (__u32)(percentile / 100.0 * histogram->count + 0.5);
+    if (rank < 1) {
+        rank = 1;
+    }
+
+    __u32 seen = 0;
+    for (int i = 0; i < RC_HISTOGRAM_BUCKETS; i++) {
+        seen += histogram->counts[i];
+
+        if (seen >= rank) {
+            __u64 limit = rc_histogram_bucket_limit(i);
+            return limit < histogram->max ? limit : histogram->max;
+        }
+    }
+
+    return histogram->max;
+}
+
+void rc_stats_get(__u8 command_id, rc_command_stats *stats) {
+    rc_command_stats *source = rc_stats_for(command_id);
+
+    if (source != NULL) {
+        *stats = *source;
+    } else {
+        memset(stats, 0, sizeof(*stats));
+    }
+}
+
+void rc_stats_retry(__u8 command_id) {
+    rc_command_stats *stats = rc_stats_for(command_id);
+    if (stats != NULL) {
+        stats->retries++;
+    }
+}
+
+void rc_stats_reset() {
+    memset(rc_stats, 0, sizeof(rc_stats));
+}
+
+__u64 rc_monotonic_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (__u64)ts.tv_sec * 1000000 + (__u64)ts.tv_nsec / 1000;
+}
 
 void fill_crc(__u8 *buf, int size) {
 	__u8 sum = 0;
@@ -28,7 +196,16 @@ bool check_crc(__u8 rc_address, __u8 command_id, __u8 *buf, int size) {
         sum = (__u8)(sum + buf[i]);
     }
 
-    return buf[size - 1] == (sum & 0x7F);
+    if (buf[size - 1] != (sum & 0x7F)) {
+        rc_command_stats *stats = rc_stats_for(command_id);
+        if (stats != NULL) {
+            stats->crc_errors++;
+        }
+
+        return false;
+    }
+
+    return true;
 }
 
 int rc_uart_open(const char *blockdevice) {
@@ -54,40 +231,247 @@ int rc_uart_init(int fd, speed_t speed)
     cfsetispeed(&termios, speed);
     cfsetospeed(&termios, speed);
 
+    rc_uart_state *state = rc_uart_get_state(fd);
+    if (state != NULL) {
+        state->baud = rc_speed_to_baud(speed);
+    }
+
     return tcsetattr(fd, TCSANOW, &termios);
 }
 
-ssize_t rc_uart_write(int fd, int bytes, __u8 *buf) {
-    ssize_t res, chars_in_tx_queue;
+int rc_uart_init_baud(int fd, __u32 baud) {
+    for (unsigned int i = 0; i < RC_UART_SPEEDS_COUNT; i++) {
+        if (rc_uart_speeds[i].baud == baud) {
+            return rc_uart_init(fd, rc_uart_speeds[i].speed);
+        }
+    }
+
+    // non-standard rate, configure the line and then override the speed
+    if (rc_uart_init(fd, B38400) < 0) {
+        return -1;
+    }
+
+    struct rc_termios2 termios2;
+    if (ioctl(fd, RC_TCGETS2, &termios2) < 0) {
+        return -1;
+    }
+
+    termios2.c_cflag &= ~(tcflag_t)CBAUD;
+    termios2.c_cflag |= RC_BOTHER;
+    termios2.c_ispeed = baud;
+    termios2.c_ospeed = baud;
+
+    if (ioctl(fd, RC_TCSETS2, &termios2) < 0) {
+        return -1;
+    }
+
+    rc_uart_state *state = rc_uart_get_state(fd);
+    if (state != NULL) {
+        state->baud = baud;
+    }
+
+    return 0;
+}
+
+void rc_uart_set_command_drain(int fd, bool drain) {
+    rc_uart_state *state = rc_uart_get_state(fd);
+    if (state != NULL) {
+        state->skip_command_drain = !drain;
+    }
+}
+
+void rc_uart_set_reply_timeout(int fd, __u32 timeout_us) {
+    rc_uart_state *state = rc_uart_get_state(fd);
+    if (state != NULL) {
+        state->reply_timeout_us = timeout_us;
+    }
+}
+
+__u32 rc_uart_tx_time_us(int fd, int bytes) {
+    rc_uart_state *state = rc_uart_get_state(fd);
+    __u32 baud = (state != NULL && state->baud > 0) ? state->baud : RC_UART_DEFAULT_BAUD;
+
+    // 8N1 framing: start bit, 8 data bits, stop bit
+    return (__u32)(((__u64)bytes * 10 * 1000000 + baud - 1) / baud);
+}
+
+static void rc_uart_account_tx(int fd, int bytes) {
+    rc_uart_state *state = rc_uart_get_state(fd);
+    if (state == NULL) {
+        return;
+    }
+
+    __u64 now = rc_monotonic_us();
+    if (state->tx_idle_us < now) {
+        state->tx_idle_us = now;
+    }
+
+    state->tx_idle_us += rc_uart_tx_time_us(fd, bytes);
+}
+
+static int rc_uart_wait_tx_idle(int fd, rc_uart_state *state) {
+    // bytes leave the wire at a known rate, sleep until the last one is out
+    __u64 now = rc_monotonic_us();
+    if (state->tx_idle_us > now) {
+        boost::this_thread::sleep(boost::posix_time::microseconds((long)(state->tx_idle_us - now)));
+    }
+
+    // confirm with the driver, the estimate ignores inter-byte gaps
+    __u64 deadline = state->tx_idle_us + RC_UART_DRAIN_SLACK_US;
+    int chars_in_tx_queue;
+
+    while (1) {
+        if (ioctl(fd, TIOCOUTQ, &chars_in_tx_queue) < 0 || chars_in_tx_queue <= 0) {
+            return 0;
+        }
+
+        now = rc_monotonic_us();
+        if (now >= deadline) {
+            return -1;
+        }
+
+        __u64 wait = rc_uart_tx_time_us(fd, chars_in_tx_queue);
+        if (now + wait > deadline) {
+            wait = deadline - now;
+        }
+
+        boost::this_thread::sleep(boost::posix_time::microseconds((long)wait));
+    }
+}
+
+int rc_uart_drain(int fd) {
+    rc_uart_state *state = rc_uart_get_state(fd);
+    if (state == NULL) {
+        return tcdrain(fd);
+    }
+
+    __u64 start = rc_monotonic_us();
+    int res = rc_uart_wait_tx_idle(fd, state);
+
+    rc_command_stats *stats = rc_stats_for(state->command);
+    if (stats != NULL) {
+        rc_histogram_record(&stats->drain_wait, rc_monotonic_us() - start);
+    }
+
+    return res;
+}
+
+static ssize_t rc_uart_write_nowait(int fd, int bytes, __u8 *buf) {
+    rc_uart_state *state = rc_uart_get_state(fd);
+    __u8 command = bytes >= 2 ? buf[1] : RC_STATS_COMMANDS;
+    if (state != NULL) {
+        state->command = command;
+    }
+
+    __u64 start = rc_monotonic_us();
+    ssize_t res = write(fd, buf, bytes);
+
+    rc_command_stats *stats = rc_stats_for(command);
+    if (stats != NULL) {
+        rc_histogram_record(&stats->write_time, rc_monotonic_us() - start);
+
+        if (res != bytes) {
+            stats->write_errors++;
+        } else {
+            stats->writes++;
+        }
+    }
 
-    res = write(fd, buf, bytes);
     if (res < 0) {
         return -1;
     }
 
-    // wait for buffer to empty
-    do {
-    	boost::this_thread::sleep(boost::posix_time::microseconds(500));
-    	ioctl (fd, TIOCOUTQ, &chars_in_tx_queue);
-    } while (chars_in_tx_queue > 0);
+    rc_uart_account_tx(fd, (int)res);
 
-    //tcdrain(fd);
+    return res;
+}
+
+ssize_t rc_uart_write(int fd, int bytes, __u8 *buf) {
+    ssize_t res = rc_uart_write_nowait(fd, bytes, buf);
+    if (res < 0) {
+        return -1;
+    }
+
+    rc_uart_drain(fd);
 
     return res;
 }
 
-ssize_t rc_uart_read(int fd, int to_read, __u8 *buf) {
-	ssize_t received;
+ssize_t rc_uart_write_command(int fd, int bytes, __u8 *buf) {
+    rc_uart_state *state = rc_uart_get_state(fd);
+
+    if (state != NULL && state->skip_command_drain) {
+        // don't wait for this command, but don't queue it behind one still on the wire
+        // either, otherwise a fast writer fills the tty buffer with stale commands
+        if (bytes >= 2) {
+            state->command = buf[1];
+        }
+        rc_uart_drain(fd);
+
+        return rc_uart_write_nowait(fd, bytes, buf);
+    }
+
+    return rc_uart_write(fd, bytes, buf);
+}
+
+static ssize_t rc_uart_read_until(int fd, int to_read, __u8 *buf, __u64 now, __u64 deadline) {
+    struct pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+
+    ssize_t received;
     ssize_t sum = 0;
 
     while (sum < to_read) {
-    	received = read(fd, buf, 1);
-    	buf += received;
-    	sum += received;
+        if (now >= deadline) {
+            return sum;
+        }
+
+        struct timespec timeout;
+        timeout.tv_sec = (time_t)((deadline - now) / 1000000);
+        timeout.tv_nsec = (long)((deadline - now) % 1000000) * 1000;
+
+        int res = ppoll(&pfd, 1, &timeout, NULL);
+        if (res < 0 && errno != EINTR) {
+            return sum;
+        }
+
+        if (res > 0) {
+            // take everything that already arrived in one call
+            received = read(fd, buf + sum, to_read - sum);
+            if (received <= 0) {
+                return sum;
+            }
+
+            sum += received;
+        }
+
+        now = rc_monotonic_us();
+    }
 
-    	if (received <= 0) {
-    		return sum;
-    	}
+    return sum;
+}
+
+ssize_t rc_uart_read(int fd, int to_read, __u8 *buf) {
+    rc_uart_state *state = rc_uart_get_state(fd);
+    __u32 reply_timeout = (state != NULL && state->reply_timeout_us > 0) ? state->reply_timeout_us : RC_UART_REPLY_TIMEOUT_US;
+
+    // the reply can't start before the request has left the wire
+    __u64 now = rc_monotonic_us();
+    __u64 start = (state != NULL && state->tx_idle_us > now) ? state->tx_idle_us : now;
+    __u64 deadline = start + rc_uart_tx_time_us(fd, to_read) + reply_timeout;
+
+    ssize_t sum = rc_uart_read_until(fd, to_read, buf, now, deadline);
+
+    rc_command_stats *stats = rc_stats_for(state != NULL ? state->command : RC_STATS_COMMANDS);
+    if (stats != NULL) {
+        rc_histogram_record(&stats->reply_time, rc_monotonic_us() - now);
+
+        if (sum < to_read) {
+            stats->timeouts++;
+        } else {
+            stats->replies++;
+        }
     }
 
     return sum;
@@ -97,12 +481,195 @@ int rc_uart_flush_input(int fd) {
      return tcflush(fd, TCIFLUSH);
 }
 
+// Drops the replies still on their way: returns once pending bytes came and the line
+// stayed quiet for a character, or once they had all the time a reply gets.
+static void rc_uart_settle(int fd, int pending) {
+    rc_uart_state *state = rc_uart_get_state(fd);
+    __u32 reply_timeout = (state != NULL && state->reply_timeout_us > 0) ? state->reply_timeout_us : RC_UART_REPLY_TIMEOUT_US;
+
+    __u64 now = rc_monotonic_us();
+    __u64 start = (state != NULL && state->tx_idle_us > now) ? state->tx_idle_us : now;
+    __u64 deadline = start + rc_uart_tx_time_us(fd, pending) + reply_timeout;
+    __u32 gap = rc_uart_tx_time_us(fd, 1);
+
+    struct pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+
+    __u8 discard[2 * RC_PIPELINE_MAX];
+    int received = 0;
+
+    while (now < deadline) {
+        __u64 wait = deadline - now;
+        if (received >= pending && wait > gap) {
+            wait = gap;
+        }
+
+        struct timespec timeout;
+        timeout.tv_sec = (time_t)(wait / 1000000);
+        timeout.tv_nsec = (long)(wait % 1000000) * 1000;
+
+        int res = ppoll(&pfd, 1, &timeout, NULL);
+        if (res < 0 && errno != EINTR) {
+            break;
+        }
+
+        if (res == 0 && received >= pending) {
+            break;
+        }
 
+        if (res > 0) {
+            ssize_t n = read(fd, discard, sizeof(discard));
+            if (n <= 0) {
+                break;
+            }
+
+            received += (int)n;
+        }
+
+        now = rc_monotonic_us();
+    }
+
+    rc_uart_flush_input(fd);
+}
+
+
+int rc_uart_transact(int fd, rc_transaction *transactions, int count) {
+    rc_uart_state *state = rc_uart_get_state(fd);
+    __u8 requests[2 * RC_PIPELINE_MAX];
+    int succeeded = 0;
+    int retries = 0;
+    int first = 0;
+
+    while (first < count) {
+        // requests to one controller go out together, its replies come back in order
+        int last = first;
+        while (last + 1 < count && last + 1 - first < RC_PIPELINE_MAX &&
+                transactions[last + 1].rc_address == transactions[first].rc_address) {
+            last++;
+        }
+
+        int request_size = 0;
+        for (int i = first; i <= last; i++) {
+            requests[request_size++] = transactions[i].rc_address;
+            requests[request_size++] = transactions[i].command_id;
+            transactions[i].result = -1;
+        }
+
+        rc_uart_flush_input(fd);
+
+        if (rc_uart_write_nowait(fd, request_size, requests) != request_size) {
+            first = last + 1;
+            continue;
+        }
+
+        int next = last + 1;
+
+        for (int i = first; i <= last; i++) {
+            rc_transaction *t = &transactions[i];
+
+            if (state != NULL) {
+                state->command = t->command_id;
+            }
+
+            ssize_t received = rc_uart_read(fd, t->reply_size, t->reply);
+
+            if (received != t->reply_size ||
+                !check_crc(t->rc_address, t->command_id, t->reply, t->reply_size)) {
+                // following replies can't be aligned any more, and a late one would pass for
+                // the next request's, so the line goes quiet before they are requested again
+                int pending = t->reply_size - (received > 0 ? (int)received : 0);
+                for (int j = i + 1; j <= last; j++) {
+                    pending += transactions[j].reply_size;
+                }
+
+                rc_uart_settle(fd, pending);
+
+                // this one too, a bounded number of times per call
+                next = retries < RC_TRANSACT_RETRIES ? i : i + 1;
+                if (next == i) {
+                    retries++;
+                }
+
+                for (int j = next; j <= last; j++) {
+                    rc_stats_retry(transactions[j].command_id);
+                }
+                break;
+            }
+
+            t->result = 0;
+            succeeded++;
+        }
+
+        first = next;
+    }
+
+    return succeeded;
+}
+
+// "/dev/gpiochipN:line" asks the character device for the line, anything else is a sysfs value file
 int rc_gpio_open(const char *gpio_path) {
+#ifdef GPIO_GET_LINEHANDLE_IOCTL
+    const char *separator = strrchr(gpio_path, ':');
+
+    if (strncmp(gpio_path, "/dev/gpiochip", 13) == 0 && separator != NULL) {
+        char chip_path[64];
+        int chip_path_size = (int)(separator - gpio_path);
+        char *end;
+        long line = strtol(separator + 1, &end, 10);
+
+        if (chip_path_size >= (int)sizeof(chip_path) || *end != '\0' || line < 0) {
+            errno = EINVAL;
+            return -1;
+        }
+
+        memcpy(chip_path, gpio_path, chip_path_size);
+        chip_path[chip_path_size] = '\0';
+
+        int chip_fd = open(chip_path, O_RDONLY);
+        if (chip_fd < 0) {
+            return -1;
+        }
+
+        // requested high, leds are active low and the reset line is released
+        struct gpiohandle_request request;
+        memset(&request, 0, sizeof(request));
+        request.lineoffsets[0] = (__u32)line;
+        request.flags = GPIOHANDLE_REQUEST_OUTPUT;
+        request.default_values[0] = 1;
+        request.lines = 1;
+        strncpy(request.consumer_label, "roboclaw", sizeof(request.consumer_label) - 1);
+
+        int res = ioctl(chip_fd, GPIO_GET_LINEHANDLE_IOCTL, &request);
+        close(chip_fd);
+
+        if (res < 0) {
+            return -1;
+        }
+
+        return request.fd;
+    }
+#endif
+
     return open(gpio_path, O_WRONLY);
 }
 
 int rc_gpio_set(int gpio_fd, bool state) {
+#ifdef GPIO_GET_LINEHANDLE_IOCTL
+    struct gpiohandle_data data;
+    memset(&data, 0, sizeof(data));
+    data.values[0] = state ? 1 : 0;
+
+    // a line handle takes one ioctl, sysfs files don't know it
+    if (ioctl(gpio_fd, GPIOHANDLE_SET_LINE_VALUES_IOCTL, &data) == 0) {
+        return 0;
+    }
+
+    if (errno != ENOTTY && errno != EINVAL) {
+        return -1;
+    }
+#endif
+
     const char *command;
 
     command = state ? "1" : "0";
@@ -135,257 +702,97 @@ int rc_reset(int gpio_fd) {
 }
 
 
-int rc_drive_forward_m1(int fd, __u8 rc_address, __u8 speed) {
-	const ssize_t command_size = 4;
+static int rc_write_encoded(int fd, __u8 *buf, int size) {
+    if (rc_uart_write_command(fd, size, buf) != size) {
+        return -1;
+    }
 
-    __u8 buffer[command_size] = {
-    		rc_address,
-    		DRIVE_FORWARD_M1,
-    		speed,
-    		0x00, // to be filled with CRC
-    };
-    fill_crc(buffer, command_size);
+    return 0;
+}
 
-    if (rc_uart_write(fd, command_size, buffer) != command_size) {
-    	return -1; 
-	}
+int rc_drive_forward_m1(int fd, __u8 rc_address, __u8 speed) {
+    __u8 buffer[rc_cmd_drive_forward_m1::size];
 
-    return 0;
+    return rc_write_encoded(fd, buffer, rc_cmd_drive_forward_m1::encode(buffer, rc_address, speed));
 } 
 
 int rc_drive_backwards_m1(int fd, __u8 rc_address, __u8 speed) {
-	const ssize_t command_size = 4;
+    __u8 buffer[rc_cmd_drive_backwards_m1::size];
 
-	__u8 buffer[command_size] = {
-    		rc_address,
-    		DRIVE_BACKWARDS_M1,
-    		speed,
-    		0x00, // to be filled with CRC
-	};
-	fill_crc(buffer, command_size);
-
-    if (rc_uart_write(fd, command_size, buffer) != command_size) {
-    	return -1; 
-	}
-	
-    return 0;
+    return rc_write_encoded(fd, buffer, rc_cmd_drive_backwards_m1::encode(buffer, rc_address, speed));
 }
 
 int rc_set_minimum_main_voltage(int fd, __u8 rc_address, __u8 voltage) {
-	const ssize_t command_size = 4;
-	
-	__u8 buffer[command_size] = {
-			rc_address,
-			SET_MINIMUM_MAIN_VOLTAGE,
-			voltage,
-    		0x00, // to be filled with CRC
-	};
-	fill_crc(buffer, command_size);
+    __u8 buffer[rc_cmd_set_minimum_main_voltage::size];
 
-    if (rc_uart_write(fd, command_size, buffer) != command_size) {
-    	return -1; 
-	}
-	
-    return 0;
+    return rc_write_encoded(fd, buffer, rc_cmd_set_minimum_main_voltage::encode(buffer, rc_address, voltage));
 }
 
 int rc_set_maximum_main_voltage(int fd, __u8 rc_address, __u8 voltage) {
-	const ssize_t command_size = 4;
-
-	__u8 buffer[command_size] = {
-			rc_address,
-			SET_MAXIMUM_MAIN_VOLTAGE,
-			voltage,
-    		0x00, // to be filled with CRC
-	};
-	fill_crc(buffer, command_size);
+    __u8 buffer[rc_cmd_set_maximum_main_voltage::size];
 
-    if (rc_uart_write(fd, command_size, buffer) != command_size) {
-    	return -1; 
-	}
-	
-    return 0;
+    return rc_write_encoded(fd, buffer, rc_cmd_set_maximum_main_voltage::encode(buffer, rc_address, voltage));
 }
 
 int rc_drive_forward_m2(int fd, __u8 rc_address, __u8 speed) {
-	const ssize_t command_size = 4;
+    __u8 buffer[rc_cmd_drive_forward_m2::size];
 
-    __u8 buffer[command_size] = {
-    		rc_address,
-    		DRIVE_FORWARD_M2,
-    		speed,
-    		0x00, // to be filled with CRC
-	};
-	fill_crc(buffer, command_size);
-
-    if (rc_uart_write(fd, command_size, buffer) != command_size) {
-    	return -1; 
-	}
-	
-    return 0;
+    return rc_write_encoded(fd, buffer, rc_cmd_drive_forward_m2::encode(buffer, rc_address, speed));
 }
 
 int rc_drive_backwards_m2(int fd, __u8 rc_address, __u8 speed) {
-	const ssize_t command_size = 4;
-
-	__u8 buffer[command_size] = {
-    		rc_address,
-    		DRIVE_BACKWARDS_M2,
-    		speed,
-    		0x00, // to be filled with CRC
-	};
-	fill_crc(buffer, command_size);
+    __u8 buffer[rc_cmd_drive_backwards_m2::size];
 
-    if (rc_uart_write(fd, command_size, buffer) != command_size) {
-    	return -1; 
-	}
-	
-    return 0;
+    return rc_write_encoded(fd, buffer, rc_cmd_drive_backwards_m2::encode(buffer, rc_address, speed));
 }
 
 int rc_drive_m1(int fd, __u8 rc_address, __u8 speed) {
-	const ssize_t command_size = 4;
-
-	__u8 buffer[command_size] = {
-    		rc_address,
-    		DRIVE_M1,
-    		speed,
-    		0x00, // to be filled with CRC
-	};
-	fill_crc(buffer, command_size);
+    __u8 buffer[rc_cmd_drive_m1::size];
 
-    if (rc_uart_write(fd, command_size, buffer) != command_size) {
-    	return -1; 
-	}
-	
-    return 0;
+    return rc_write_encoded(fd, buffer, rc_cmd_drive_m1::encode(buffer, rc_address, speed));
 }
 
 int rc_drive_m2(int fd, __u8 rc_address, __u8 speed) {
-	const ssize_t command_size = 4;
-
-	__u8 buffer[command_size] = {
-    		rc_address,
-    		DRIVE_M2,
-    		speed,
-    		0x00, // to be filled with CRC
-	};
-	fill_crc(buffer, command_size);
+    __u8 buffer[rc_cmd_drive_m2::size];
 
-    if (rc_uart_write(fd, command_size, buffer) != command_size) {
-    	return -1; 
-	}
-	
-    return 0;
+    return rc_write_encoded(fd, buffer, rc_cmd_drive_m2::encode(buffer, rc_address, speed));
 }
 
 int rc_drive_forward(int fd, __u8 rc_address, __u8 speed) {
-    const ssize_t command_size = 4;
+    __u8 buffer[rc_cmd_drive_forward::size];
 
-    __u8 buffer[command_size] = {
-    		rc_address,
-    		DRIVE_FORWARD,
-    		speed,
-    		0x00, // to be filled with CRC
-	};
-	fill_crc(buffer, command_size);
-
-    if (rc_uart_write(fd, command_size, buffer) != command_size) {
-    	return -1; 
-	}
-	
-    return 0;
+    return rc_write_encoded(fd, buffer, rc_cmd_drive_forward::encode(buffer, rc_address, speed));
 }
 
 int rc_drive_backwards(int fd, __u8 rc_address, __u8 speed) {
-    const ssize_t command_size = 4;
-
-    __u8 buffer[command_size] = {
-    		rc_address,
-    		DRIVE_BACKWARDS,
-    		speed,
-    		0x00, // to be filled with CRC
-	};
-	fill_crc(buffer, command_size);
+    __u8 buffer[rc_cmd_drive_backwards::size];
 
-    if (rc_uart_write(fd, command_size, buffer) != command_size) {
-    	return -1; 
-	}
-	
-    return 0;
+    return rc_write_encoded(fd, buffer, rc_cmd_drive_backwards::encode(buffer, rc_address, speed));
 }
 
 int rc_turn_right(int fd, __u8 rc_address, __u8 value) {
-	const ssize_t command_size = 4;
-
-    __u8 buffer[command_size] = {
-    		rc_address,
-    		TURN_RIGHT,
-    		value,
-    		0x00, // to be filled with CRC
-	};
-	fill_crc(buffer, command_size);
+    __u8 buffer[rc_cmd_turn_right::size];
 
-    if (rc_uart_write(fd, command_size, buffer) != command_size) {
-    	return -1; 
-	}
-	
-    return 0;
+    return rc_write_encoded(fd, buffer, rc_cmd_turn_right::encode(buffer, rc_address, value));
 }
 
 int rc_turn_left(int fd, __u8 rc_address, __u8 value) {
-    const ssize_t command_size = 4;
+    __u8 buffer[rc_cmd_turn_left::size];
 
-    __u8 buffer[command_size] = {
-    		rc_address,
-    		TURN_LEFT,
-    		value,
-    		0x00, // to be filled with CRC
-	};
-	fill_crc(buffer, command_size);
-
-    if (rc_uart_write(fd, command_size, buffer) != command_size) {
-    	return -1; 
-	}
-	
-    return 0;
+    return rc_write_encoded(fd, buffer, rc_cmd_turn_left::encode(buffer, rc_address, value));
 }
 
 
 int rc_drive(int fd, __u8 rc_address, __u8 speed) {
-	const ssize_t command_size = 4;
-
-    __u8 buffer[command_size] = {
-    		rc_address,
-    		DRIVE_FORWARD_OR_BACKWARD,
-    		speed,
-    		0x00, // to be filled with CRC
-	};
-	fill_crc(buffer, command_size);
+    __u8 buffer[rc_cmd_drive::size];
 
-    if (rc_uart_write(fd, command_size, buffer) != command_size) {
-    	return -1; 
-	}
-	
-    return 0;
+    return rc_write_encoded(fd, buffer, rc_cmd_drive::encode(buffer, rc_address, speed));
 }
 
 int rc_turn(int fd, __u8 rc_address, __u8 value) {
-	const ssize_t command_size = 4;
-
-    __u8 buffer[command_size] = {
-    		rc_address,
-    		TURN_LEFT_OR_RIGHT,
-    		value,
-    		0x00, // to be filled with CRC
-	};
-	fill_crc(buffer, command_size);
+    __u8 buffer[rc_cmd_turn::size];
 
-    if (rc_uart_write(fd, command_size, buffer) != command_size) {
-    	return -1; 
-	}
-	
-    return 0;
+    return rc_write_encoded(fd, buffer, rc_cmd_turn::encode(buffer, rc_address, value));
 }
 
 int rc_read_firmware_version(int fd, __u8 rc_address, unsigned char *str) {
@@ -424,817 +831,326 @@ int rc_read_firmware_version(int fd, __u8 rc_address, unsigned char *str) {
 }
 
 int rc_read_main_battery_voltage_level(int fd, __u8 rc_address, __u16 *value) {
-	const ssize_t command_size = 2;
-
-    __u8 buffer[4] = {
-    		rc_address,
-    		READ_MAIN_BATTEY_VOLTAGE_LEVEL};
-
-    rc_uart_flush_input(fd);
-
-    if (rc_uart_write(fd, command_size, buffer) != command_size) {
-    	return -1;
-    }
-
-    const ssize_t reply_size = 3;
-    __u8 in_buffer[reply_size];
-    if (rc_uart_read(fd, reply_size, in_buffer) != reply_size ||
-        !check_crc(rc_address, READ_MAIN_BATTEY_VOLTAGE_LEVEL, in_buffer, reply_size)) {
-    	return -1;
-    }
-
-    *value = (__u16)((in_buffer[0] << 8) | in_buffer[1]);
-
-    return 0;
+    return rc_qry_read_main_battery_voltage_level::run(fd, rc_address, value);
 }
 
 int rc_read_logic_battery_voltage_level(int fd, __u8 rc_address, __u16 *value) {
-    __u8 buffer[4] = {
-    		rc_address,
-    		READ_LOGIC_BATTERY_VOLTAGE_LEVEL};
-
-    rc_uart_flush_input(fd);
-
-    rc_uart_write(fd, 2, buffer);
-
-    const ssize_t reply_size = 3;
-    __u8 in_buffer[reply_size];
-    if (rc_uart_read(fd, reply_size, in_buffer) != reply_size ||
-         !check_crc(rc_address, READ_LOGIC_BATTERY_VOLTAGE_LEVEL, in_buffer, reply_size)) {
-    	return -1;
-    }
-
-    *value = (__u16)((in_buffer[0] << 8) | in_buffer[1]);
-
-    return 0;
+    return rc_qry_read_logic_battery_voltage_level::run(fd, rc_address, value);
 }
 
 int rc_set_minimum_logic_voltage_level(int fd, __u8 rc_address, __u8 voltage) {
-	const ssize_t command_size = 4;
-
-	__u8 buffer[command_size] = {
-			rc_address,
-			SET_MINIMUM_LOGIC_VOLTAGE_LEVEL,
-			voltage,
-    		0x00, // to be filled with CRC
-	};
-	fill_crc(buffer, command_size);
-
-	if (rc_uart_write(fd, command_size, buffer) != command_size) {
-    	return -1; 
-	}
-	
-    return 0;
+    __u8 buffer[rc_cmd_set_minimum_logic_voltage_level::size];
+
+    return rc_write_encoded(fd, buffer, rc_cmd_set_minimum_logic_voltage_level::encode(buffer, rc_address, voltage));
 }
 
 int rc_set_maximum_logic_voltage_level(int fd, __u8 rc_address, __u8 voltage) {
-	const ssize_t command_size = 4;
-
-	__u8 buffer[command_size] = {
-			rc_address,
-			SET_MAXIMUM_LOGIC_VOLTAGE_LEVEL,
-			voltage,
-    		0x00, // to be filled with CRC
-	};
-	fill_crc(buffer, command_size);
-
-	if (rc_uart_write(fd, command_size, buffer) != command_size) {
-    	return -1; 
-	}
-	
-    return 0;
+    __u8 buffer[rc_cmd_set_maximum_logic_voltage_level::size];
+
+    return rc_write_encoded(fd, buffer, rc_cmd_set_maximum_logic_voltage_level::encode(buffer, rc_address, voltage));
 }
 
 int rc_read_encoder_register_m1(int fd, __u8 rc_address, __u32 *value, __u8 *status) {
-	const ssize_t command_size = 2;
-
-    __u8 buffer[2] = {
-    		rc_address,
-    		READ_QUADRATURE_ENCODER_REGISTER_M1};
-
-    rc_uart_flush_input(fd);
-
-    if (rc_uart_write(fd, command_size, buffer) != command_size) {
-    	return -1;
-    }
-
-    const ssize_t reply_size = 6;
-    __u8 in_buffer[reply_size];
-    if (rc_uart_read(fd, reply_size, in_buffer) != reply_size ||
-        !check_crc(rc_address, READ_QUADRATURE_ENCODER_REGISTER_M1, in_buffer, reply_size)) {
-    	return -1;
-    }
-
-    *value = (in_buffer[0] << 24) | (in_buffer[1] << 16) | (in_buffer[2] << 8) | in_buffer[3];
-    *status = in_buffer[4];
-
-    return 0;
+    return rc_qry_read_encoder_register_m1::run(fd, rc_address, value, status);
 }
 
 int rc_read_encoder_register_m2(int fd, __u8 rc_address, __u32 *value, __u8 *status) {
-	const ssize_t command_size = 2;
-
-    __u8 buffer[4] = {
-    		rc_address,
-    		READ_QUADRATURE_ENCODER_REGISTER_M2};
-
-    rc_uart_flush_input(fd);
-
-    if (rc_uart_write(fd, command_size, buffer) != command_size) {
-    	return -1;
-    }
-
-    const ssize_t reply_size = 6;
-    __u8 in_buffer[reply_size];
-    if (rc_uart_read(fd, reply_size, in_buffer) != reply_size ||
-        !check_crc(rc_address, READ_QUADRATURE_ENCODER_REGISTER_M2, in_buffer, reply_size)) {
-    	return -1;
-    }
-
-	*value = (in_buffer[0] << 24) | (in_buffer[1] << 16) | (in_buffer[2] << 8) | in_buffer[3];
-	*status = in_buffer[4];
-
-	return 0;
+    return rc_qry_read_encoder_register_m2::run(fd, rc_address, value, status);
 }
 
 int rc_read_speed_m1(int fd, __u8 rc_address, __u32 *value, __u8 *direction) {
-	const ssize_t command_size = 2;
+    return rc_qry_read_speed_m1::run(fd, rc_address, value, direction);
+}
 
-    __u8 buffer[2] = {
-    		rc_address,
-    		READ_SPEED_M1};
 
-    rc_uart_flush_input(fd);
+int rc_read_speed_m2(int fd, __u8 rc_address, __u32 *value, __u8 *direction) {
+    return rc_qry_read_speed_m2::run(fd, rc_address, value, direction);
+}
 
-    if (rc_uart_write(fd, command_size, buffer) != command_size) {
-    	return -1;
+int rc_read_speeds(int fd, __u8 *rc_addresses, int count, __u32 *values, __u8 *directions) {
+    rc_transaction transactions[RC_PIPELINE_MAX];
+    __u8 replies[RC_PIPELINE_MAX][rc_qry_read_speed_m1::reply_size];
+
+    if (2 * count > RC_PIPELINE_MAX) {
+        return -1;
     }
 
-    const ssize_t reply_size = 6;
-    __u8 in_buffer[reply_size];
-    if (rc_uart_read(fd, reply_size, in_buffer) != reply_size || 
-        !check_crc(rc_address, READ_SPEED_M1, in_buffer, reply_size)) {
-    	return -1;
+    for (int i = 0; i < 2 * count; i++) {
+        transactions[i].rc_address = rc_addresses[i / 2];
+        transactions[i].command_id = (__u8)((i % 2 == 0) ? (int)rc_qry_read_speed_m1::id : (int)rc_qry_read_speed_m2::id);
+        transactions[i].reply = replies[i];
+        transactions[i].reply_size = rc_qry_read_speed_m1::reply_size;
     }
 
-	*value = (in_buffer[0] << 24) | (in_buffer[1] << 16) | (in_buffer[2] << 8) | in_buffer[3];
-	*direction = in_buffer[4];
+    int succeeded = rc_uart_transact(fd, transactions, 2 * count);
+
+    for (int i = 0; i < 2 * count; i++) {
+        if (transactions[i].result == 0) {
+            // checksum already verified by rc_uart_transact
+            rc_field<__u8>::get(rc_field<__u32>::get(replies[i], &values[i]), &directions[i]);
+        }
+    }
 
-	return 0;
+    return succeeded;
 }
 
+int rc_read_encoders(int fd, __u8 *rc_addresses, int count, __u32 *values, __u8 *statuses, int *results) {
+    rc_transaction transactions[RC_PIPELINE_MAX];
+    __u8 replies[RC_PIPELINE_MAX][rc_qry_read_encoder_register_m1::reply_size];
 
-int rc_read_speed_m2(int fd, __u8 rc_address, __u32 *value, __u8 *direction) {
-	const ssize_t command_size = 2;
+    if (2 * count > RC_PIPELINE_MAX) {
+        return -1;
+    }
 
-    __u8 buffer[2] = {
-    		rc_address,
-    		READ_SPEED_M2};
+    for (int i = 0; i < 2 * count; i++) {
+        transactions[i].rc_address = rc_addresses[i / 2];
+        transactions[i].command_id = (__u8)((i % 2 == 0) ?
+                (int)rc_qry_read_encoder_register_m1::id : (int)rc_qry_read_encoder_register_m2::id);
+        transactions[i].reply = replies[i];
+        transactions[i].reply_size = rc_qry_read_encoder_register_m1::reply_size;
+    }
 
-    rc_uart_flush_input(fd);
+    int succeeded = rc_uart_transact(fd, transactions, 2 * count);
 
-    if (rc_uart_write(fd, command_size, buffer) != command_size) {
-    	return -1;
-    }
+    for (int i = 0; i < 2 * count; i++) {
+        results[i] = transactions[i].result;
 
-    const ssize_t reply_size = 6;
-    __u8 in_buffer[reply_size];
-    if (rc_uart_read(fd, reply_size, in_buffer) != reply_size || 
-        !check_crc(rc_address, READ_SPEED_M2, in_buffer, reply_size)) {
-    	return -1;
+        if (transactions[i].result == 0) {
+            // checksum already verified by rc_uart_transact
+            rc_field<__u8>::get(rc_field<__u32>::get(replies[i], &values[i]), &statuses[i]);
+        }
     }
 
-	*value = (in_buffer[0] << 24) | (in_buffer[1] << 16) | (in_buffer[2] << 8) | in_buffer[3];
-	*direction = in_buffer[4];
-
-	return 0;
+    return succeeded;
 }
 
 int rc_set_pid_consts_m1(int fd, __u8 rc_address, __u32 d, __u32 p, __u32 i, __u32 qpps) {
-	const ssize_t command_size = 19;
-
-     __u8 buffer[command_size] = {
-	     rc_address,
-	     SET_PID_CONSTANTS_M1,
-
-	     BYTE(d, 3),
-	     BYTE(d, 2),
-	     BYTE(d, 1),
-	     BYTE(d, 0),
-
-	     BYTE(p, 3),
-	     BYTE(p, 2),
-	     BYTE(p, 1),
-	     BYTE(p, 0),
-
-	     BYTE(i, 3),
-	     BYTE(i, 2),
-	     BYTE(i, 1),
-	     BYTE(i, 0),
-
-	     BYTE(qpps, 3),
-	     BYTE(qpps, 2),
-	     BYTE(qpps, 1),
-	     BYTE(qpps, 0),
-
-	     0x00 // to be filled with CRC
-	};
-	fill_crc(buffer, command_size);
-
-	if (rc_uart_write(fd, command_size, buffer) != command_size) {
-    	return -1; 
-	}
-	
-    return 0;
+    __u8 buffer[rc_cmd_set_pid_consts_m1::size];
+
+    return rc_write_encoded(fd, buffer, rc_cmd_set_pid_consts_m1::encode(buffer, rc_address, d, p, i, qpps));
 }
 
 int rc_set_pid_consts_m2(int fd, __u8 rc_address, __u32 d, __u32 p, __u32 i, __u32 qpps) {
-	const ssize_t command_size = 19;
-    
-     __u8 buffer[command_size] = {
-	     rc_address,
-	     SET_PID_CONSTANTS_M2,
-
-	     BYTE(d, 3),
-	     BYTE(d, 2),
-	     BYTE(d, 1),
-	     BYTE(d, 0),
-
-	     BYTE(p, 3),
-	     BYTE(p, 2),
-	     BYTE(p, 1),
-	     BYTE(p, 0),
-
-	     BYTE(i, 3),
-	     BYTE(i, 2),
-	     BYTE(i, 1),
-	     BYTE(i, 0),
-
-	     BYTE(qpps, 3),
-	     BYTE(qpps, 2),
-	     BYTE(qpps, 1),
-	     BYTE(qpps, 0),
-
-	     0x00 // to be filled with CRC
-	};
-	fill_crc(buffer, command_size);
-
-	if (rc_uart_write(fd, command_size, buffer) != command_size) {
-    	return -1; 
-	}
-	
-    return 0;
+    __u8 buffer[rc_cmd_set_pid_consts_m2::size];
+
+    return rc_write_encoded(fd, buffer, rc_cmd_set_pid_consts_m2::encode(buffer, rc_address, d, p, i, qpps));
 }
 
 int rc_reset_encoder_counters(int fd, __u8 rc_address) {
-	const ssize_t command_size = 2;
+    __u8 buffer[rc_cmd_reset_encoder_counters::size];
 
-    __u8 buffer[4] = {
-    		rc_address,
-    		RESET_QUADRATURE_ENCODER_COUNTERS};
-
-    if (rc_uart_write(fd, command_size, buffer) != command_size) {
-    	return -1; 
-	}
-	
-    return 0;
+    return rc_write_encoded(fd, buffer, rc_cmd_reset_encoder_counters::encode(buffer, rc_address));
 }
 
 
 int rc_read_speed125_m1(int fd, __u8 rc_address, __u32 *value) {
-	const ssize_t command_size = 2;
-
-    __u8 buffer[2] = {
-    		rc_address,
-    		READ_CURRENT_SPEED_M1};
-    
-    rc_uart_flush_input(fd);
-
-	if (rc_uart_write(fd, command_size, buffer) != command_size) {
-		return -1;
-	}
-
-	const ssize_t reply_size = 4;
-    __u8 in_buffer[reply_size];
-    if (rc_uart_read(fd, reply_size, in_buffer) != reply_size ||
-        !check_crc(rc_address, READ_CURRENT_SPEED_M1, in_buffer, reply_size)) {
-    	return -1;
-    }
-
-	*value = (in_buffer[0] << 24) | (in_buffer[1] << 16) | (in_buffer[2] << 8) | in_buffer[3];
-
-	return 0;
+    return rc_qry_read_speed125_m1::run(fd, rc_address, value);
 }
 
 
 int rc_read_speed125_m2(int fd, __u8 rc_address, __u32 *value) {
-	const ssize_t command_size = 2;
-
-    __u8 buffer[2] = {
-    		rc_address,
-    		READ_CURRENT_SPEED_M2};
-
-    rc_uart_flush_input(fd);
-    
-	if (rc_uart_write(fd, command_size, buffer) != command_size) {
-		return -1;
-	}
-
-	const ssize_t reply_size = 4;
-    __u8 in_buffer[reply_size];
-    if (rc_uart_read(fd, reply_size, in_buffer) != reply_size ||
-        !check_crc(rc_address, READ_CURRENT_SPEED_M2, in_buffer, reply_size)) {
-    	return -1;
-    }
-
-	*value = (in_buffer[0] << 24) | (in_buffer[1] << 16) | (in_buffer[2] << 8) | in_buffer[3];
-
-	return 0;
+    return rc_qry_read_speed125_m2::run(fd, rc_address, value);
 }
 
 
 int rc_drive_m1_speed(int fd, __u8 rc_address, __s32 speed_m) {
-	const ssize_t command_size = 7;
-
-	__u8 buffer[command_size] = {
-		rc_address,
-		DRIVE_M1_SPEED,
+    __u8 buffer[rc_cmd_drive_m1_speed::size];
 
-		BYTE(speed_m, 3),
-		BYTE(speed_m, 2),
-		BYTE(speed_m, 1),
-		BYTE(speed_m, 0),
-
-		0x00 // to be filled with CRC
-	};
-	fill_crc(buffer, command_size);
-
- 	if (rc_uart_write(fd, command_size, buffer) != command_size) {
-    	return -1; 
-	}
-	
-    return 0;
+    return rc_write_encoded(fd, buffer, rc_cmd_drive_m1_speed::encode(buffer, rc_address, speed_m));
 }
 
 int rc_drive_m2_speed(int fd, __u8 rc_address, __s32 speed_m) {
-	const ssize_t command_size = 7;
-
-	__u8 buffer[command_size] = {
-		rc_address,
-		DRIVE_M2_SPEED,
-
-		BYTE(speed_m, 3),
-		BYTE(speed_m, 2),
-		BYTE(speed_m, 1),
-		BYTE(speed_m, 0),
-
-		0x00 // to be filled with CRC
-	};
-	fill_crc(buffer, command_size);
+    __u8 buffer[rc_cmd_drive_m2_speed::size];
 
-	if (rc_uart_write(fd, command_size, buffer) != command_size) {
-    	return -1; 
-	}
-	
-    return 0;
+    return rc_write_encoded(fd, buffer, rc_cmd_drive_m2_speed::encode(buffer, rc_address, speed_m));
 }
 
 
 int rc_drive_speed(int fd, __u8 rc_address, __s32 speed_m1, __s32 speed_m2) {
-	const ssize_t command_size = 11;
-
-	__u8 buffer[command_size] = {
-		rc_address,
-		MIX_MODE_DRIVE_SPEED,
-
-		BYTE(speed_m1, 3),
-		BYTE(speed_m1, 2),
-		BYTE(speed_m1, 1),
-		BYTE(speed_m1, 0),
+    __u8 buffer[rc_cmd_drive_speed::size];
 
-		BYTE(speed_m2, 3),
-		BYTE(speed_m2, 2),
-		BYTE(speed_m2, 1),
-		BYTE(speed_m2, 0),
-
-		0x00 // to be filled with CRC
-	};
-	fill_crc(buffer, command_size);
-
-	if (rc_uart_write(fd, command_size, buffer) != command_size) {
-    	return -1; 
-	}
-	
-    return 0;
+    return rc_write_encoded(fd, buffer, rc_cmd_drive_speed::encode(buffer, rc_address, speed_m1, speed_m2));
 }
 
 
 int rc_drive_m1_speed_accel(int fd, __u8 rc_address, __u32 accel, __s32 speed) {
-	const ssize_t command_size = 11;
+    __u8 buffer[rc_cmd_drive_m1_speed_accel::size];
 
-	__u8 buffer[command_size] = {
-		rc_address,
-		DRIVE_M1_SPEED_ACCEL,
-
-		BYTE(accel, 3),
-		BYTE(accel, 2),
-		BYTE(accel, 1),
-		BYTE(accel, 0),
-
-		BYTE(speed, 3),
-		BYTE(speed, 2),
-		BYTE(speed, 1),
-		BYTE(speed, 0),
-
-		0x00 // to be filled with CRC
-	};
-	fill_crc(buffer, command_size);
-
-	if (rc_uart_write(fd, command_size, buffer) != command_size) {
-    	return -1; 
-	}
-	
-    return 0;
+    return rc_write_encoded(fd, buffer, rc_cmd_drive_m1_speed_accel::encode(buffer, rc_address, accel, speed));
 }
 
 
 int rc_drive_m2_speed_accel(int fd, __u8 rc_address, __u32 accel, __s32 speed) {
-	const ssize_t command_size = 11;
-
-	__u8 buffer[command_size] = {
-		rc_address,
-		DRIVE_M2_SPEED_ACCEL,
-
-		BYTE(accel, 3),
-		BYTE(accel, 2),
-		BYTE(accel, 1),
-		BYTE(accel, 0),
+    __u8 buffer[rc_cmd_drive_m2_speed_accel::size];
 
-		BYTE(speed, 3),
-		BYTE(speed, 2),
-		BYTE(speed, 1),
-		BYTE(speed, 0),
-
-		0x00 // to be filled with CRC
-	};
-	fill_crc(buffer, command_size);
-
-	if (rc_uart_write(fd, command_size, buffer) != command_size) {
-    	return -1; 
-	}
-	
-    return 0;
+    return rc_write_encoded(fd, buffer, rc_cmd_drive_m2_speed_accel::encode(buffer, rc_address, accel, speed));
 }
 
 
 int rc_drive_speed_accel(int fd, __u8 rc_address, __u32 accel, __s32 speed_m1, __s32 speed_m2) {
-	const ssize_t command_size = 15;
-
-	__u8 buffer[command_size] = {
-		rc_address,
-		MIX_MODE_DRIVE_SPEED_ACCEL,
-
-		BYTE(accel, 3),
-		BYTE(accel, 2),
-		BYTE(accel, 1),
-		BYTE(accel, 0),
-
-		BYTE(speed_m1, 3),
-		BYTE(speed_m1, 2),
-		BYTE(speed_m1, 1),
-		BYTE(speed_m1, 0),
-
-		BYTE(speed_m2, 3),
-		BYTE(speed_m2, 2),
-		BYTE(speed_m2, 1),
-		BYTE(speed_m2, 0),
+    __u8 buffer[rc_cmd_drive_speed_accel::size];
 
-		0x00 // to be filled with CRC
-	};
-	fill_crc(buffer, command_size);
-
-	if (rc_uart_write(fd, command_size, buffer) != command_size) {
-    	return -1; 
-	}
-	
-    return 0;
+    return rc_write_encoded(fd, buffer, rc_cmd_drive_speed_accel::encode(buffer, rc_address, accel, speed_m1, speed_m2));
 }
 
-int rc_buffered_m1_drive_speed_dist(int fd, __u8 rc_address,__s32 speed, __u32 dist, __u8 now) {
-	const ssize_t command_size = 12;
-
-	__u8 buffer[command_size] = {
-		rc_address,
-		BUFFERED_M1_DRIVE_SPEED_DIST,
-
-		BYTE(speed, 3),
-		BYTE(speed, 2),
-		BYTE(speed, 1),
-		BYTE(speed, 0),
-
-		BYTE(dist, 3),
-		BYTE(dist, 2),
-		BYTE(dist, 1),
-		BYTE(dist, 0),
-
-		now,
-		0x00 // to be filled with CRC
-	};
-	fill_crc(buffer, command_size);
+int rc_buffered_m1_drive_speed_dist(int fd, __u8 rc_address, __s32 speed, __u32 dist, __u8 now) {
+    __u8 buffer[rc_cmd_buffered_m1_drive_speed_dist::size];
 
-	if (rc_uart_write(fd, command_size, buffer) != command_size) {
-    	return -1; 
-	}
-	
-    return 0;
+    return rc_write_encoded(fd, buffer, rc_cmd_buffered_m1_drive_speed_dist::encode(buffer, rc_address, speed, dist, now));
 }
 
-int rc_buffered_m2_drive_speed_dist(int fd, __u8 rc_address,__s32 speed, __u32 dist, __u8 now) {
-	const ssize_t command_size = 12;
-
-	__u8 buffer[command_size] = {
-		rc_address,
-		BUFFERED_M2_DRIVE_SPEED_DIST,
-
-		BYTE(speed, 3),
-		BYTE(speed, 2),
-		BYTE(speed, 1),
-		BYTE(speed, 0),
+int rc_buffered_m2_drive_speed_dist(int fd, __u8 rc_address, __s32 speed, __u32 dist, __u8 now) {
+    __u8 buffer[rc_cmd_buffered_m2_drive_speed_dist::size];
 
-		BYTE(dist, 3),
-		BYTE(dist, 2),
-		BYTE(dist, 1),
-		BYTE(dist, 0),
-
-		now,
-		0x00 // to be filled with CRC
-	};
-	fill_crc(buffer, command_size);
-
-	if (rc_uart_write(fd, command_size, buffer) != command_size) {
-    	return -1; 
-	}
-	
-    return 0;
+    return rc_write_encoded(fd, buffer, rc_cmd_buffered_m2_drive_speed_dist::encode(buffer, rc_address, speed, dist, now));
 }
 
 int rc_buffered_drive_speed_dist(int fd, __u8 rc_address, __s32 speed_m1, __u32 dist_m1, __s32 speed_m2, __u32 dist_m2, __u8 now) {
-	const ssize_t command_size = 20;
-
-	__u8 buffer[command_size] = {
-		rc_address,
-		BUFFERED_MIX_MODE_DRIVE_SPEED_DIST,
-
-		BYTE(speed_m1, 3),
-		BYTE(speed_m1, 2),
-		BYTE(speed_m1, 1),
-		BYTE(speed_m1, 0),
-
-		BYTE(dist_m1, 3),
-		BYTE(dist_m1, 2),
-		BYTE(dist_m1, 1),
-		BYTE(dist_m1, 0),
-
-		BYTE(speed_m2, 3),
-		BYTE(speed_m2, 2),
-		BYTE(speed_m2, 1),
-		BYTE(speed_m2, 0),
-
-		BYTE(dist_m2, 3),
-		BYTE(dist_m2, 2),
-		BYTE(dist_m2, 1),
-		BYTE(dist_m2, 0),
-
-		now,
-		0x00 // to be filled with CRC
-	};
-	fill_crc(buffer, command_size);
-
-	if (rc_uart_write(fd, command_size, buffer) != command_size) {
-    	return -1; 
-	}
-	
-    return 0;
-}
-
-
-int rc_buffered_m1_drive_speed_accel_dist(int fd, __u8 rc_address, __u32 accel, __s32 speed, __u32 dist, __u8 now){
-	const ssize_t command_size = 16;
-
-	__u8 buffer[command_size] = {
-		rc_address,
-		BUFFERED_M1_DRIVE_SPEED_ACCEL_DIST,
-
-		BYTE(accel, 3),
-		BYTE(accel, 2),
-		BYTE(accel, 1),
-		BYTE(accel, 0),
-
-		BYTE(speed, 3),
-		BYTE(speed, 2),
-		BYTE(speed, 1),
-		BYTE(speed, 0),
+    __u8 buffer[rc_cmd_buffered_drive_speed_dist::size];
 
-		BYTE(dist, 3),
-		BYTE(dist, 2),
-		BYTE(dist, 1),
-		BYTE(dist, 0),
-
-		now,
-		0x00 // to be filled with CRC
-	};
-	fill_crc(buffer, command_size);
-
-	if (rc_uart_write(fd, command_size, buffer) != command_size) {
-    	return -1; 
-	}
-	
-    return 0;
+    return rc_write_encoded(fd, buffer, rc_cmd_buffered_drive_speed_dist::encode(buffer, rc_address, speed_m1, dist_m1, speed_m2, dist_m2, now));
 }
 
-int rc_buffered_m2_drive_speed_accel_dist(int fd, __u8 rc_address, __u32 accel, __s32 speed, __u32 dist, __u8 now){
-	const ssize_t command_size = 16;
 
-	__u8 buffer[command_size] = {
-		rc_address,
-		BUFFERED_M2_DRIVE_SPEED_ACCEL_DIST,
+int rc_buffered_m1_drive_speed_accel_dist(int fd, __u8 rc_address, __u32 accel, __s32 speed, __u32 dist, __u8 now) {
+    __u8 buffer[rc_cmd_buffered_m1_drive_speed_accel_dist::size];
 
-		BYTE(accel, 3),
-		BYTE(accel, 2),
-		BYTE(accel, 1),
-		BYTE(accel, 0),
-
-		BYTE(speed, 3),
-		BYTE(speed, 2),
-		BYTE(speed, 1),
-		BYTE(speed, 0),
-
-		BYTE(dist, 3),
-		BYTE(dist, 2),
-		BYTE(dist, 1),
-		BYTE(dist, 0),
+    return rc_write_encoded(fd, buffer, rc_cmd_buffered_m1_drive_speed_accel_dist::encode(buffer, rc_address, accel, speed, dist, now));
+}
 
-		now,
-		0x00 // to be filled with CRC
-	};
-	fill_crc(buffer, command_size);
+int rc_buffered_m2_drive_speed_accel_dist(int fd, __u8 rc_address, __u32 accel, __s32 speed, __u32 dist, __u8 now) {
+    __u8 buffer[rc_cmd_buffered_m2_drive_speed_accel_dist::size];
 
-	if (rc_uart_write(fd, command_size, buffer) != command_size) {
-    	return -1; 
-	}
-	
-    return 0;
+    return rc_write_encoded(fd, buffer, rc_cmd_buffered_m2_drive_speed_accel_dist::encode(buffer, rc_address, accel, speed, dist, now));
 }
 
 
 int rc_buffered_drive_speed_accel_dist(int fd, __u8 rc_address, __u32 accel, __s32 speed_m1, __u32 dist_m1, __s32 speed_m2, __u32 dist_m2, __u8 now) {
-	const ssize_t command_size = 24;
-
-	__u8 buffer[command_size] = {
-		rc_address,
-		BUFFERED_MIX_MODE_SPEED_ACCEL_DISTANCE,
-
-		BYTE(accel, 3),
-		BYTE(accel, 2),
-		BYTE(accel, 1),
-		BYTE(accel, 0),
-
-		BYTE(speed_m1, 3),
-		BYTE(speed_m1, 2),
-		BYTE(speed_m1, 1),
-		BYTE(speed_m1, 0),
-
-		BYTE(dist_m1, 3),
-		BYTE(dist_m1, 2),
-		BYTE(dist_m1, 1),
-		BYTE(dist_m1, 0),
-
-		BYTE(speed_m2, 3),
-		BYTE(speed_m2, 2),
-		BYTE(speed_m2, 1),
-		BYTE(speed_m2, 0),
-
-		BYTE(dist_m2, 3),
-		BYTE(dist_m2, 2),
-		BYTE(dist_m2, 1),
-		BYTE(dist_m2, 0),
-
-		now,
-		0x00 // to be filled with CRC
-	};
-	fill_crc(buffer, command_size);
-
-	if (rc_uart_write(fd, command_size, buffer) != command_size) {
-    	return -1; 
-	}
-	
-    return 0;
-}
+    __u8 buffer[rc_cmd_buffered_drive_speed_accel_dist::size];
 
-int rc_read_temperature(int fd, __u8 rc_address, __u16* value) {
-    const ssize_t command_size = 2;
+    return rc_write_encoded(fd, buffer, rc_cmd_buffered_drive_speed_accel_dist::encode(buffer, rc_address, accel, speed_m1, dist_m1, speed_m2, dist_m2, now));
+}
 
-    __u8 buffer[4] = {
-            rc_address,
-            READ_TEMPERATURE};
+int rc_read_buffer_length(int fd, __u8 rc_address, __u8 *length_m1, __u8 *length_m2) {
+    return rc_qry_read_buffer_length::run(fd, rc_address, length_m1, length_m2);
+}
 
-    rc_uart_flush_input(fd);
+int rc_read_buffer_lengths(int fd, __u8 *rc_addresses, int count, __u8 *lengths, int *results) {
+    rc_transaction transactions[RC_PIPELINE_MAX];
+    __u8 replies[RC_PIPELINE_MAX][rc_qry_read_buffer_length::reply_size];
 
-    if (rc_uart_write(fd, command_size, buffer) != command_size) {
+    if (count > RC_PIPELINE_MAX) {
         return -1;
     }
 
-    const ssize_t reply_size = 3;
-    __u8 in_buffer[reply_size];
-    if (rc_uart_read(fd, reply_size, in_buffer) != reply_size ||
-        !check_crc(rc_address, READ_TEMPERATURE, in_buffer, reply_size)) {
-        return -1;
+    for (int i = 0; i < count; i++) {
+        transactions[i].rc_address = rc_addresses[i];
+        transactions[i].command_id = rc_qry_read_buffer_length::id;
+        transactions[i].reply = replies[i];
+        transactions[i].reply_size = rc_qry_read_buffer_length::reply_size;
     }
 
-    *value = (__u16)((in_buffer[0] << 8) | in_buffer[1]);
-
-    return 0;
-}
-
-int rc_read_error_status(int fd, __u8 rc_address, __u8* error) {
-    const ssize_t command_size = 2;
+    int succeeded = rc_uart_transact(fd, transactions, count);
 
-    __u8 buffer[4] = {
-            rc_address,
-            READ_ERROR_STATUS};
-
-    rc_uart_flush_input(fd);
+    for (int i = 0; i < count; i++) {
+        results[i] = transactions[i].result;
 
-    if (rc_uart_write(fd, command_size, buffer) != command_size) {
-        return -1;
-    }
-
-    const ssize_t reply_size = 2;
-    __u8 in_buffer[reply_size];
-    if (rc_uart_read(fd, reply_size, in_buffer) != reply_size ||
-        !check_crc(rc_address, READ_ERROR_STATUS, in_buffer, reply_size)) {
-        return -1;
+        if (transactions[i].result == 0) {
+            // checksum already verified by rc_uart_transact
+            rc_field<__u8>::get(rc_field<__u8>::get(replies[i], &lengths[2 * i]), &lengths[2 * i + 1]);
+        }
     }
 
-    *error = (__u8) in_buffer[0];
-
-    return 0;
+    return succeeded;
 }
 
-int rc_read_pid_const_m1(int fd, __u8 rc_address, __u32 *d, __u32 *p, __u32 *i, __u32 *qpps) {
-    const ssize_t command_size = 2;
-
-    __u8 buffer[4] = {
-            rc_address,
-            READ_PID_CONST_M1};
+int rc_read_temperature(int fd, __u8 rc_address, __u16* value) {
+    return rc_qry_read_temperature::run(fd, rc_address, value);
+}
 
-    rc_uart_flush_input(fd);
+int rc_read_error_status(int fd, __u8 rc_address, __u8* error) {
+    return rc_qry_read_error_status::run(fd, rc_address, error);
+}
 
-    if (rc_uart_write(fd, command_size, buffer) != command_size) {
-        return -1;
+int rc_read_health(int fd, __u8 *rc_addresses, int count, rc_health *health) {
+    rc_transaction transactions[RC_PIPELINE_MAX];
+    __u8 replies[RC_PIPELINE_MAX][rc_qry_read_main_battery_voltage_level::reply_size];
+    int owner[RC_PIPELINE_MAX];
+    int n = 0;
+
+    for (int i = 0; i < count; i++) {
+        health[i].result = 0;
+
+        for (int item = RC_HEALTH_MAIN_BATTERY; item <= RC_HEALTH_ERROR_STATUS; item <<= 1) {
+            if ((health[i].what & item) == 0) {
+                continue;
+            }
+
+            if (n == RC_PIPELINE_MAX) {
+                return -1;
+            }
+
+            transactions[n].rc_address = rc_addresses[i];
+            transactions[n].reply = replies[n];
+
+            switch (item) {
+            case RC_HEALTH_MAIN_BATTERY:
+                transactions[n].command_id = rc_qry_read_main_battery_voltage_level::id;
+                transactions[n].reply_size = rc_qry_read_main_battery_voltage_level::reply_size;
+                break;
+            case RC_HEALTH_TEMPERATURE:
+                transactions[n].command_id = rc_qry_read_temperature::id;
+                transactions[n].reply_size = rc_qry_read_temperature::reply_size;
+                break;
+            default:
+                transactions[n].command_id = rc_qry_read_error_status::id;
+                transactions[n].reply_size = rc_qry_read_error_status::reply_size;
+                break;
+            }
+
+            owner[n++] = i;
+        }
     }
 
-    const ssize_t reply_size = 17;
-    __u8 in_buffer[reply_size];
-    if (rc_uart_read(fd, reply_size, in_buffer) != reply_size ||
-        !check_crc(rc_address, READ_PID_CONST_M1, in_buffer, reply_size)) {
-        return -1;
+    if (n == 0) {
+        return 0;
     }
 
-    *p = (in_buffer[0] << 24) | (in_buffer[1] << 16) | (in_buffer[2] << 8) | in_buffer[3];
-    *i = (in_buffer[4] << 24) | (in_buffer[5] << 16) | (in_buffer[6] << 8) | in_buffer[7];
-    *d = (in_buffer[8] << 24) | (in_buffer[9] << 16) | (in_buffer[10] << 8) | in_buffer[11];
-    *qpps = (in_buffer[12] << 24) | (in_buffer[13] << 16) | (in_buffer[14] << 8) | in_buffer[15];
+    int succeeded = rc_uart_transact(fd, transactions, n);
 
-    return 0;
-}
-
-int rc_read_pid_const_m2(int fd, __u8 rc_address, __u32 *d, __u32 *p, __u32 *i, __u32 *qpps) {
-    const ssize_t command_size = 2;
-
-    __u8 buffer[4] = {
-            rc_address,
-            READ_PID_CONST_M2};
+    for (int t = 0; t < n; t++) {
+        if (transactions[t].result != 0) {
+            continue;
+        }
 
-    rc_uart_flush_input(fd);
+        // checksum already verified by rc_uart_transact
+        rc_health *h = &health[owner[t]];
 
-    if (rc_uart_write(fd, command_size, buffer) != command_size) {
-        return -1;
+        switch (transactions[t].command_id) {
+        case rc_qry_read_main_battery_voltage_level::id:
+            rc_field<__u16>::get(replies[t], &h->main_battery);
+            h->result |= RC_HEALTH_MAIN_BATTERY;
+            break;
+        case rc_qry_read_temperature::id:
+            rc_field<__u16>::get(replies[t], &h->temperature);
+            h->result |= RC_HEALTH_TEMPERATURE;
+            break;
+        default:
+            rc_field<__u8>::get(replies[t], &h->error_status);
+            h->result |= RC_HEALTH_ERROR_STATUS;
+            break;
+        }
     }
 
-    const ssize_t reply_size = 17;
-    __u8 in_buffer[reply_size];
-    if (rc_uart_read(fd, reply_size, in_buffer) != reply_size ||
-        !check_crc(rc_address, READ_PID_CONST_M2, in_buffer, reply_size)) {
-        return -1;
-    }
+    return succeeded;
+}
 
-    *p = (in_buffer[0] << 24) | (in_buffer[1] << 16) | (in_buffer[2] << 8) | in_buffer[3];
-    *i = (in_buffer[4] << 24) | (in_buffer[5] << 16) | (in_buffer[6] << 8) | in_buffer[7];
-    *d = (in_buffer[8] << 24) | (in_buffer[9] << 16) | (in_buffer[10] << 8) | in_buffer[11];
-    *qpps = (in_buffer[12] << 24) | (in_buffer[13] << 16) | (in_buffer[14] << 8) | in_buffer[15];
+int rc_read_pid_const_m1(int fd, __u8 rc_address, __u32 *d, __u32 *p, __u32 *i, __u32 *qpps) {
+    return rc_qry_read_pid_const_m1::run(fd, rc_address, p, i, d, qpps);
+}
 
-    return 0;
+int rc_read_pid_const_m2(int fd, __u8 rc_address, __u32 *d, __u32 *p, __u32 *i, __u32 *qpps) {
+    return rc_qry_read_pid_const_m2::run(fd, rc_address, p, i, d, qpps);
 }
 
 int rc_write_to_eeprom(int fd, __u8 rc_address) {
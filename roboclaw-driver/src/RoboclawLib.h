@@ -6,9 +6,26 @@
 
 int rc_uart_open(const char *blockdevice);
 int rc_uart_init(int fd, speed_t speed);
+int rc_uart_init_baud(int fd, __u32 baud);
+void rc_uart_set_command_drain(int fd, bool drain);
+void rc_uart_set_reply_timeout(int fd, __u32 timeout_us);
+__u32 rc_uart_tx_time_us(int fd, int bytes);
+int rc_uart_drain(int fd);
 ssize_t rc_uart_write(int fd, int bytes, __u8 *buf);
+ssize_t rc_uart_write_command(int fd, int bytes, __u8 *buf);
 ssize_t rc_uart_read(int fd, int to_read, __u8 *buf);
 int rc_uart_flush_input(int fd);
+
+// Request/reply exchange, replies are read in order and checked with check_crc
+struct rc_transaction {
+	__u8 rc_address;
+	__u8 command_id;
+	__u8 *reply;
+	int reply_size;
+	int result;
+};
+
+int rc_uart_transact(int fd, rc_transaction *transactions, int count);
 int rc_uart_close(int fd);
 
 int rc_gpio_open(const char *gpio_path);
@@ -20,6 +37,50 @@ int rc_reset(int gpio_fd);
 void fill_crc(__u8 *buf, int size);
 bool check_crc(__u8 rc_address, __u8 command_id, __u8 *buf, int size);
 
+__u64 rc_monotonic_us();
+
+// Log-linear latency histogram in microseconds: exact below 8us, then 4 buckets
+// per power of two (at most 25% wide) up to ~2s, the last bucket takes the rest
+#define RC_HISTOGRAM_LINEAR_BITS 3
+#define RC_HISTOGRAM_LINEAR (1 << RC_HISTOGRAM_LINEAR_BITS)
+#define RC_HISTOGRAM_SUB_BITS 2
+#define RC_HISTOGRAM_SUB_BUCKETS (1 << RC_HISTOGRAM_SUB_BITS)
+#define RC_HISTOGRAM_BUCKETS 80
+
+struct rc_histogram {
+	__u32 counts[RC_HISTOGRAM_BUCKETS];
+	__u32 count;
+	__u64 sum;
+	__u64 max;
+};
+
+// Per command id, kept in fixed static tables, recording never allocates
+struct rc_command_stats {
+	__u32 writes;
+	__u32 write_errors;
+	__u32 replies;
+	__u32 timeouts;		// short or missing reply
+	__u32 crc_errors;
+	__u32 retries;
+	rc_histogram write_time;
+	rc_histogram drain_wait;
+	rc_histogram reply_time;
+};
+
+#define RC_STATS_COMMANDS 96
+
+void rc_stats_get(__u8 command_id, rc_command_stats *stats);
+void rc_stats_retry(__u8 command_id);
+void rc_stats_reset();
+__u64 rc_histogram_percentile(const rc_histogram *histogram, double percentile);
+
+#define RC_UART_MAX_FDS 64
+#define RC_UART_DEFAULT_BAUD 38400
+#define RC_UART_DRAIN_SLACK_US 2000
+#define RC_UART_REPLY_TIMEOUT_US 3000
+#define RC_PIPELINE_MAX 16
+#define RC_TRANSACT_RETRIES 2
+
 #define RC_ERROR_NORMAL 0x00
 #define RC_ERROR_M1_OVERCURRENT 0x01
 #define RC_ERROR_M2_OVERCURRENT 0x02
@@ -94,6 +155,15 @@ int rc_read_encoder_register_m1(int fd, __u8 rc_address, __u32 *value, __u8 *sta
 // 17 - Read Quadrature Encoder Register M2
 int rc_read_encoder_register_m2(int fd, __u8 rc_address, __u32 *value, __u8 *status);
 
+// 16, 17 - Read encoder registers M1 and M2 of several controllers in one pipelined exchange,
+// values and statuses are left untouched for the reads that failed
+int rc_read_encoders(int fd, __u8 *rc_addresses, int count, __u32 *values, __u8 *statuses, int *results);
+
+// encoder register status bits
+#define RC_ENCODER_UNDERFLOW 0x01
+#define RC_ENCODER_BACKWARD 0x02
+#define RC_ENCODER_OVERFLOW 0x04
+
 
 //18 - Read Speed M1
 int rc_read_speed_m1(int fd, __u8 rc_address, __u32 *value, __u8 *direction);
@@ -101,6 +171,9 @@ int rc_read_speed_m1(int fd, __u8 rc_address, __u32 *value, __u8 *direction);
 // 19 - Read Speed M2
 int rc_read_speed_m2(int fd, __u8 rc_address, __u32 *value, __u8 *direction);
 
+// 18, 19 - Read Speed M1 and M2 of several controllers in one pipelined exchange
+int rc_read_speeds(int fd, __u8 *rc_addresses, int count, __u32 *values, __u8 *directions);
+
 // 20 - Reset Quadrature Encoder Counters
 int rc_reset_encoder_counters(int fd, __u8 rc_address);
 
@@ -156,6 +229,16 @@ int rc_buffered_m2_drive_speed_accel_dist(int fd, __u8 rc_address, __u32 accel,
 // 46 - Buffered Mix Mode Drive M1 / M2 With Signed Speed, Accel And Distance
 int rc_buffered_drive_speed_accel_dist(int fd, __u8 rc_address, __u32 accel, __s32 speed_m1, __u32 dist_m1, __s32 speed_m2, __u32 dist_m2, __u8 now);
 
+// 47 - Read Buffer Length
+int rc_read_buffer_length(int fd, __u8 rc_address, __u8 *length_m1, __u8 *length_m2);
+
+// 47 - Read Buffer Length of several controllers in one pipelined exchange, lengths
+// go m1, m2 per controller and are left untouched for the reads that failed
+int rc_read_buffer_lengths(int fd, __u8 *rc_addresses, int count, __u8 *lengths, int *results);
+
+// buffer length when the buffer is empty and the last buffered command has finished
+#define RC_BUFFER_IDLE 0x80
+
 // 55 - Read Motor 1 P, I, D and QPPS Settings
 int rc_read_pid_const_m1(int fd, __u8 rc_address, __u32 *d, __u32 *p, __u32 *i, __u32 *qpps); 
 
@@ -168,6 +251,21 @@ int rc_read_temperature(int fd, __u8 rc_address, __u16* value);
 // 90 - Read Error Status
 int rc_read_error_status(int fd, __u8 rc_address, __u8* error);
 
+// 24, 82, 90 - Read main battery, temperature and error status of several controllers in one pipelined exchange
+#define RC_HEALTH_MAIN_BATTERY 0x01
+#define RC_HEALTH_TEMPERATURE 0x02
+#define RC_HEALTH_ERROR_STATUS 0x04
+
+struct rc_health {
+	int what;		// RC_HEALTH_* to read
+	int result;		// RC_HEALTH_* read successfully
+	__u16 main_battery;
+	__u16 temperature;
+	__u8 error_status;
+};
+
+int rc_read_health(int fd, __u8 *rc_addresses, int count, rc_health *health);
+
 // 94 - Write Settings to EEPROM
 int rc_write_to_eeprom(int fd, __u8 rc_address);
 
@@ -229,7 +327,7 @@ int rc_write_to_eeprom(int fd, __u8 rc_address);
 #define DRIVE_M2_SPEED 36
 #define MIX_MODE_DRIVE_SPEED 37
 #define DRIVE_M1_SPEED_ACCEL 38
-#define DRIVE_M2_SPEED_ACCEL 29
+#define DRIVE_M2_SPEED_ACCEL 39
 #define MIX_MODE_DRIVE_SPEED_ACCEL 40
 #define BUFFERED_M1_DRIVE_SPEED_DIST 41
 #define BUFFERED_M2_DRIVE_SPEED_DIST 42
@@ -0,0 +1,108 @@
+/*
+ * RoboclawMailbox.cpp
+ *
+ *  Created on: 17-10-2026
+ */
+
+#include <boost/interprocess/sync/scoped_lock.hpp>
+#include <boost/thread/thread_time.hpp>
+
+#include "RoboclawMailbox.h"
+
+using namespace boost;
+using namespace boost::interprocess;
+using namespace log4cxx;
+
+LoggerPtr RoboclawMailbox::_logger (Logger::getLogger("Roboclaw.Mailbox"));
+
+RoboclawMailbox::RoboclawMailbox(RoboclawDriver *driver, unsigned int statsInterval):
+		_driver(driver), _statsInterval(statsInterval), _hasPending(false), _sending(false),
+		_sent(0), _superseded(0), _writerThread(NULL) {
+
+}
+
+RoboclawMailbox::~RoboclawMailbox() {
+
+}
+
+void RoboclawMailbox::start() {
+	_writerThread = new boost::thread(boost::ref(*this));
+}
+
+void RoboclawMailbox::post(const MotorsSpeedStruct& mss) {
+	scoped_lock<interprocess_mutex> lock(_mailboxMutex);
+
+	if (_hasPending) {
+		_superseded++;
+
+		if (_logger->isDebugEnabled()) {
+			LOG4CXX_DEBUG(_logger, "Motors command superseded before sending");
+		}
+	}
+
+	_pending = mss;
+	_hasPending = true;
+
+	_commandPosted.notify_one();
+}
+
+void RoboclawMailbox::clear() {
+	scoped_lock<interprocess_mutex> lock(_mailboxMutex);
+
+	_hasPending = false;
+
+	while (_sending) {
+		_commandSent.wait(lock);
+	}
+}
+
+void RoboclawMailbox::operator()() {
+	LOG4CXX_INFO(_logger, "Motors command writer thread started");
+
+	MotorsSpeedStruct mss;
+	boost::system_time nextStatsTime = boost::get_system_time() + boost::posix_time::milliseconds(_statsInterval);
+
+	while (1) {
+		{
+			scoped_lock<interprocess_mutex> lock(_mailboxMutex);
+
+			while (1) {
+				if (_statsInterval > 0 && boost::get_system_time() >= nextStatsTime) {
+					LOG4CXX_INFO(_logger, "Motors commands sent: " << _sent << ", superseded: " << _superseded);
+
+					_sent = 0;
+					_superseded = 0;
+					nextStatsTime = boost::get_system_time() + boost::posix_time::milliseconds(_statsInterval);
+				}
+
+				if (_hasPending) {
+					break;
+				}
+
+				if (_statsInterval > 0) {
+					_commandPosted.timed_wait(lock, nextStatsTime);
+				} else {
+					_commandPosted.wait(lock);
+				}
+			}
+
+			mss = _pending;
+			_hasPending = false;
+			_sending = true;
+		}
+
+		try {
+			_driver->sendMotorsEncoderCommand(&mss);
+		} catch (RoboclawSerialException& e) {
+			// do nothing
+		}
+
+		{
+			scoped_lock<interprocess_mutex> lock(_mailboxMutex);
+
+			_sent++;
+			_sending = false;
+			_commandSent.notify_all();
+		}
+	}
+}
@@ -0,0 +1,58 @@
+/*
+ * RoboclawMailbox.h
+ *
+ *  Created on: 17-10-2026
+ */
+
+#ifndef ROBOCLAWMAILBOX_H_
+#define ROBOCLAWMAILBOX_H_
+
+#include <boost/thread.hpp>
+#include <boost/interprocess/sync/interprocess_condition.hpp>
+#include <boost/interprocess/sync/interprocess_mutex.hpp>
+#include <log4cxx/logger.h>
+
+#include "RoboclawCommon.h"
+#include "RoboclawDriver.h"
+
+/*
+ * One-slot mailbox for motors commands. A new command overwrites the one
+ * not sent yet and a writer thread always sends the latest, so clients
+ * streaming faster than the uart never queue up stale setpoints.
+ */
+class RoboclawMailbox {
+
+public:
+	RoboclawMailbox(RoboclawDriver *driver, unsigned int statsInterval);
+	virtual ~RoboclawMailbox();
+
+	void start();
+
+	void post(const MotorsSpeedStruct& mss);
+
+	// drops the pending command and waits for the one being sent, call before stopping motors
+	void clear();
+
+	void operator()();
+
+private:
+	static log4cxx::LoggerPtr _logger;
+
+	RoboclawDriver *_driver;
+	unsigned int _statsInterval;
+
+	MotorsSpeedStruct _pending;
+	bool _hasPending;
+	bool _sending;
+
+	__u32 _sent;
+	__u32 _superseded;
+
+	boost::interprocess::interprocess_mutex _mailboxMutex;
+	boost::interprocess::interprocess_condition _commandPosted;
+	boost::interprocess::interprocess_condition _commandSent;
+
+	boost::thread *_writerThread;
+};
+
+#endif /* ROBOCLAWMAILBOX_H_ */
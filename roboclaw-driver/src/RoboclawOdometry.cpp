@@ -0,0 +1,161 @@
+/*
+ * RoboclawOdometry.cpp
+ *
+ *  Created on: 17-10-2026
+ */
+
+#include <cmath>
+#include <cstring>
+
+#include <boost/thread/thread_time.hpp>
+
+#include "RoboclawOdometry.h"
+#include "RoboclawLib.h"
+
+using namespace boost;
+using namespace log4cxx;
+
+LoggerPtr RoboclawOdometry::_logger (Logger::getLogger("Roboclaw.Odometry"));
+
+// counts, allowed on top of twice motors_max_qpps before a delta is taken for garbage
+#define ODOMETRY_GLITCH_MARGIN 100
+
+RoboclawOdometry::RoboclawOdometry(RoboclawDriver *driver, RoboclawConfiguration *configuration):
+		_driver(driver), _configuration(configuration), _lastTimestamp(0), _lastResets(0), _synced(false),
+		_samplerThread(NULL) {
+
+	memset(&_current, 0, sizeof(_current));
+	memset(_lastCounts, 0, sizeof(_lastCounts));
+}
+
+RoboclawOdometry::~RoboclawOdometry() {
+
+}
+
+void RoboclawOdometry::start() {
+	_samplerThread = new boost::thread(boost::ref(*this));
+}
+
+OdometrySnapshot RoboclawOdometry::getPose() {
+	return _pose.read();
+}
+
+void RoboclawOdometry::operator()() {
+	LOG4CXX_INFO(_logger, "Odometry thread started, interval: " << _configuration->odometry_interval
+			<< "ms, track width: " << _configuration->track_width << "mm");
+
+	MotorsEncoderStruct mes;
+	boost::system_time nextTime = boost::get_system_time();
+
+	while (1) {
+		nextTime += boost::posix_time::milliseconds(_configuration->odometry_interval);
+
+		boost::system_time actTime = boost::get_system_time();
+		if (nextTime < actTime) {
+			// fell behind, don't try to catch up with a burst of reads
+			nextTime = actTime;
+		}
+
+		boost::thread::sleep(nextTime);
+
+		try {
+			_driver->readEncoders(&mes);
+		} catch (RoboclawSerialException& e) {
+			continue;
+		}
+
+		// the next complete read covers this period as well
+		bool valid = true;
+		for (unsigned int i = 0; i < _configuration->wheels.size(); i++) {
+			valid = valid && mes.valid[i];
+		}
+
+		if (!valid) {
+			continue;
+		}
+
+		if (!_synced || mes.resets != _lastResets) {
+			resync(&mes);
+		} else {
+			integrate(&mes);
+		}
+	}
+}
+
+void RoboclawOdometry::integrate(MotorsEncoderStruct *mes) {
+	unsigned int wheels = (unsigned int)_configuration->wheels.size();
+	__s32 deltas[RC_MAX_WHEELS];
+
+	double dt = (double)(mes->timestamp - _lastTimestamp) / 1e6;
+	double limit = 2.0 * _configuration->motors_max_qpps * dt + ODOMETRY_GLITCH_MARGIN;
+
+	for (unsigned int i = 0; i < wheels; i++) {
+		// unsigned difference stays right across the 32-bit wrap around
+		deltas[i] = (__s32)(mes->count[i] - _lastCounts[i]);
+
+		if (mes->status[i] & (RC_ENCODER_UNDERFLOW | RC_ENCODER_OVERFLOW)) {
+			LOG4CXX_INFO(_logger, "Encoder counter wrapped around, " << _configuration->wheels[i].name);
+		}
+
+		if (fabs((double)deltas[i]) > limit) {
+			LOG4CXX_WARN(_logger, "Encoder jump, " << _configuration->wheels[i].name << ": " << deltas[i] << " counts in "
+					<< dt * 1000 << "ms, resynchronizing");
+			resync(mes);
+			return;
+		}
+	}
+
+	double leftSum = 0, rightSum = 0;
+	int leftWheels = 0, rightWheels = 0;
+
+	for (unsigned int i = 0; i < wheels; i++) {
+		if (_configuration->wheels[i].side == RC_WHEEL_LEFT) {
+			leftSum += deltas[i];
+			leftWheels++;
+		} else {
+			rightSum += deltas[i];
+			rightWheels++;
+		}
+	}
+
+	// the wheel map has wheels on both sides
+	double mmPerPulse = 2 * M_PI * _configuration->wheel_radius / (double)_configuration->pulses_per_revolution;
+	double right = rightSum / rightWheels * mmPerPulse;
+	double left = leftSum / leftWheels * mmPerPulse;
+
+	// track_width is the effective one, skid-steer wheels slip when turning
+	double distance = (left + right) / 2.0;
+	double rotation = (right - left) / (double)_configuration->track_width;
+
+	// heading at the middle of the step, exact for constant curvature
+	double heading = _current.theta + rotation / 2.0;
+	_current.x += distance * cos(heading);
+	_current.y += distance * sin(heading);
+
+	double theta = _current.theta + rotation;
+	_current.theta = atan2(sin(theta), cos(theta));
+	_current.timestamp = mes->timestamp;
+
+	memcpy(_lastCounts, mes->count, sizeof(_lastCounts));
+	_lastTimestamp = mes->timestamp;
+
+	_pose.write(_current);
+}
+
+// the pose is kept, only the counters reference moves
+void RoboclawOdometry::resync(MotorsEncoderStruct *mes) {
+	if (_synced) {
+		LOG4CXX_INFO(_logger, "Encoder counters resynchronized");
+	}
+
+	memcpy(_lastCounts, mes->count, sizeof(_lastCounts));
+
+	_lastTimestamp = mes->timestamp;
+	_lastResets = mes->resets;
+	_synced = true;
+
+	_current.timestamp = mes->timestamp;
+	_current.valid = true;
+
+	_pose.write(_current);
+}
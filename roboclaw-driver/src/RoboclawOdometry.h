@@ -0,0 +1,67 @@
+/*
+ * RoboclawOdometry.h
+ *
+ *  Created on: 17-10-2026
+ */
+
+#ifndef ROBOCLAWODOMETRY_H_
+#define ROBOCLAWODOMETRY_H_
+
+#include <boost/thread.hpp>
+#include <log4cxx/logger.h>
+
+#include "AmberSeqlock.h"
+#include "RoboclawCommon.h"
+#include "RoboclawDriver.h"
+
+struct OdometrySnapshot {
+
+	double x;			// mm
+	double y;			// mm
+	double theta;		// rad, counterclockwise, (-pi, pi]
+	__u64 timestamp;	// monotonic, us, when the encoders were read
+	bool valid;
+
+};
+
+/*
+ * Integrates skid-steer pose from the encoder registers, each side moves
+ * by the mean of its wheels. Registers are
+ * absolute, so a failed read only delays integration, nothing is lost.
+ * Counters restart after a controller reset, the first read after one
+ * only resynchronizes.
+ */
+class RoboclawOdometry {
+
+public:
+	RoboclawOdometry(RoboclawDriver *driver, RoboclawConfiguration *configuration);
+	virtual ~RoboclawOdometry();
+
+	void start();
+
+	OdometrySnapshot getPose();
+
+	void operator()();
+
+private:
+	static log4cxx::LoggerPtr _logger;
+
+	RoboclawDriver *_driver;
+	RoboclawConfiguration *_configuration;
+
+	AmberSeqlock<OdometrySnapshot> _pose;
+
+	// sampler thread only
+	OdometrySnapshot _current;
+	__u32 _lastCounts[RC_MAX_WHEELS];
+	__u64 _lastTimestamp;
+	__u32 _lastResets;
+	bool _synced;
+
+	boost::thread *_samplerThread;
+
+	void integrate(MotorsEncoderStruct *mes);
+	void resync(MotorsEncoderStruct *mes);
+};
+
+#endif /* ROBOCLAWODOMETRY_H_ */
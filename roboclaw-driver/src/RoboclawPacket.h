@@ -0,0 +1,323 @@
+#ifndef ROBOCLAW_PACKET_H_
+#define ROBOCLAW_PACKET_H_
+
+#include <cassert>
+#include <cstddef>
+#include <linux/types.h>
+
+#include <boost/static_assert.hpp>
+
+#include "RoboclawLib.h"
+
+/*
+ * Packet layouts as types. A command or query lists its argument / reply
+ * field types, sizes and encoders follow at compile time, buffers live on
+ * the stack. All fields are big endian.
+ */
+
+struct rc_void {};
+
+template <class T>
+struct rc_field;
+
+template <>
+struct rc_field<rc_void> {
+	enum { size = 0, count = 0 };
+
+	static __u8 *put(__u8 *buf, rc_void) { return buf; }
+	static const __u8 *get(const __u8 *buf, rc_void *) { return buf; }
+};
+
+template <>
+struct rc_field<__u8> {
+	enum { size = 1, count = 1 };
+
+	static __u8 *put(__u8 *buf, __u8 value) {
+		buf[0] = value;
+		return buf + size;
+	}
+
+	static const __u8 *get(const __u8 *buf, __u8 *value) {
+		if (value != NULL) {
+			*value = buf[0];
+		}
+		return buf + size;
+	}
+};
+
+template <>
+struct rc_field<__u16> {
+	enum { size = 2, count = 1 };
+
+	static __u8 *put(__u8 *buf, __u16 value) {
+		buf[0] = BYTE(value, 1);
+		buf[1] = BYTE(value, 0);
+		return buf + size;
+	}
+
+	static const __u8 *get(const __u8 *buf, __u16 *value) {
+		if (value != NULL) {
+			*value = (__u16)((buf[0] << 8) | buf[1]);
+		}
+		return buf + size;
+	}
+};
+
+template <>
+struct rc_field<__u32> {
+	enum { size = 4, count = 1 };
+
+	static __u8 *put(__u8 *buf, __u32 value) {
+		buf[0] = BYTE(value, 3);
+		buf[1] = BYTE(value, 2);
+		buf[2] = BYTE(value, 1);
+		buf[3] = BYTE(value, 0);
+		return buf + size;
+	}
+
+	static const __u8 *get(const __u8 *buf, __u32 *value) {
+		if (value != NULL) {
+			*value = ((__u32)buf[0] << 24) | ((__u32)buf[1] << 16) | ((__u32)buf[2] << 8) | buf[3];
+		}
+		return buf + size;
+	}
+};
+
+template <>
+struct rc_field<__s32> {
+	enum { size = 4, count = 1 };
+
+	static __u8 *put(__u8 *buf, __s32 value) {
+		return rc_field<__u32>::put(buf, (__u32)value);
+	}
+
+	static const __u8 *get(const __u8 *buf, __s32 *value) {
+		__u32 raw;
+		buf = rc_field<__u32>::get(buf, &raw);
+		if (value != NULL) {
+			*value = (__s32)raw;
+		}
+		return buf;
+	}
+};
+
+/*
+ * Write-only command: [address, command, arguments..., checksum].
+ * Commands without arguments go out as [address, command], like the original
+ * rc_reset_encoder_counters did.
+ */
+template <__u8 Id, class A1 = rc_void, class A2 = rc_void, class A3 = rc_void,
+		class A4 = rc_void, class A5 = rc_void, class A6 = rc_void>
+struct rc_command {
+	enum {
+		id = Id,
+		arity = rc_field<A1>::count + rc_field<A2>::count + rc_field<A3>::count +
+				rc_field<A4>::count + rc_field<A5>::count + rc_field<A6>::count,
+		args_size = rc_field<A1>::size + rc_field<A2>::size + rc_field<A3>::size +
+				rc_field<A4>::size + rc_field<A5>::size + rc_field<A6>::size,
+		size = 2 + args_size + (args_size > 0 ? 1 : 0)
+	};
+
+	static int encode(__u8 *buf, __u8 rc_address) {
+		BOOST_STATIC_ASSERT(arity == 0);
+		return encode_all(buf, rc_address, A1(), A2(), A3(), A4(), A5(), A6());
+	}
+
+	static int encode(__u8 *buf, __u8 rc_address, A1 a1) {
+		BOOST_STATIC_ASSERT(arity == 1);
+		return encode_all(buf, rc_address, a1, A2(), A3(), A4(), A5(), A6());
+	}
+
+	static int encode(__u8 *buf, __u8 rc_address, A1 a1, A2 a2) {
+		BOOST_STATIC_ASSERT(arity == 2);
+		return encode_all(buf, rc_address, a1, a2, A3(), A4(), A5(), A6());
+	}
+
+	static int encode(__u8 *buf, __u8 rc_address, A1 a1, A2 a2, A3 a3) {
+		BOOST_STATIC_ASSERT(arity == 3);
+		return encode_all(buf, rc_address, a1, a2, a3, A4(), A5(), A6());
+	}
+
+	static int encode(__u8 *buf, __u8 rc_address, A1 a1, A2 a2, A3 a3, A4 a4) {
+		BOOST_STATIC_ASSERT(arity == 4);
+		return encode_all(buf, rc_address, a1, a2, a3, a4, A5(), A6());
+	}
+
+	static int encode(__u8 *buf, __u8 rc_address, A1 a1, A2 a2, A3 a3, A4 a4, A5 a5) {
+		BOOST_STATIC_ASSERT(arity == 5);
+		return encode_all(buf, rc_address, a1, a2, a3, a4, a5, A6());
+	}
+
+	static int encode(__u8 *buf, __u8 rc_address, A1 a1, A2 a2, A3 a3, A4 a4, A5 a5, A6 a6) {
+		BOOST_STATIC_ASSERT(arity == 6);
+		return encode_all(buf, rc_address, a1, a2, a3, a4, a5, a6);
+	}
+
+private:
+	static int encode_all(__u8 *buf, __u8 rc_address, A1 a1, A2 a2, A3 a3, A4 a4, A5 a5, A6 a6) {
+		__u8 *p = buf;
+
+		*p++ = rc_address;
+		*p++ = Id;
+
+		p = rc_field<A1>::put(p, a1);
+		p = rc_field<A2>::put(p, a2);
+		p = rc_field<A3>::put(p, a3);
+		p = rc_field<A4>::put(p, a4);
+		p = rc_field<A5>::put(p, a5);
+		p = rc_field<A6>::put(p, a6);
+
+		if (args_size > 0) {
+			fill_crc(buf, size);
+		}
+
+		return size;
+	}
+};
+
+/*
+ * Read request [address, command], reply [fields..., checksum] where the
+ * checksum covers address and command too.
+ */
+template <__u8 Id, class R1 = rc_void, class R2 = rc_void, class R3 = rc_void, class R4 = rc_void>
+struct rc_query {
+	enum {
+		id = Id,
+		request_size = 2,
+		reply_size = rc_field<R1>::size + rc_field<R2>::size + rc_field<R3>::size + rc_field<R4>::size + 1
+	};
+
+	static int encode(__u8 *buf, __u8 rc_address) {
+		buf[0] = rc_address;
+		buf[1] = Id;
+
+		return request_size;
+	}
+
+	// NULL outputs are skipped
+	static bool decode(__u8 rc_address, __u8 *reply, R1 *r1 = NULL, R2 *r2 = NULL, R3 *r3 = NULL, R4 *r4 = NULL) {
+		if (!check_crc(rc_address, Id, reply, reply_size)) {
+			return false;
+		}
+
+		const __u8 *p = reply;
+		p = rc_field<R1>::get(p, r1);
+		p = rc_field<R2>::get(p, r2);
+		p = rc_field<R3>::get(p, r3);
+		rc_field<R4>::get(p, r4);
+
+		return true;
+	}
+
+	// one request/reply exchange on an idle line
+	static int run(int fd, __u8 rc_address, R1 *r1 = NULL, R2 *r2 = NULL, R3 *r3 = NULL, R4 *r4 = NULL) {
+		__u8 request[request_size];
+		__u8 reply[reply_size];
+
+		encode(request, rc_address);
+
+		rc_uart_flush_input(fd);
+
+		if (rc_uart_write(fd, request_size, request) != request_size) {
+			return -1;
+		}
+
+		if (rc_uart_read(fd, reply_size, reply) != reply_size ||
+			!decode(rc_address, reply, r1, r2, r3, r4)) {
+			return -1;
+		}
+
+		return 0;
+	}
+};
+
+/*
+ * Several encoded commands sent with one write.
+ *   rc_batch<2 * rc_cmd_drive_speed::size> batch;
+ *   rc_cmd_drive_speed::encode(batch.next<rc_cmd_drive_speed>(), address, m1, m2);
+ */
+template <int Capacity>
+class rc_batch {
+public:
+	rc_batch(): _size(0) {}
+
+	template <class C>
+	__u8 *next() {
+		assert(_size + C::size <= Capacity);
+
+		__u8 *buf = _data + _size;
+		_size += C::size;
+
+		return buf;
+	}
+
+	int size() const { return _size; }
+	bool empty() const { return _size == 0; }
+
+	int write(int fd) {
+		if (_size == 0) {
+			return 0;
+		}
+
+		return rc_uart_write_command(fd, _size, _data) == _size ? 0 : -1;
+	}
+
+private:
+	__u8 _data[Capacity];
+	int _size;
+};
+
+// Command table
+
+typedef rc_command<DRIVE_FORWARD_M1, __u8> rc_cmd_drive_forward_m1;
+typedef rc_command<DRIVE_BACKWARDS_M1, __u8> rc_cmd_drive_backwards_m1;
+typedef rc_command<SET_MINIMUM_MAIN_VOLTAGE, __u8> rc_cmd_set_minimum_main_voltage;
+typedef rc_command<SET_MAXIMUM_MAIN_VOLTAGE, __u8> rc_cmd_set_maximum_main_voltage;
+typedef rc_command<DRIVE_FORWARD_M2, __u8> rc_cmd_drive_forward_m2;
+typedef rc_command<DRIVE_BACKWARDS_M2, __u8> rc_cmd_drive_backwards_m2;
+typedef rc_command<DRIVE_M1, __u8> rc_cmd_drive_m1;
+typedef rc_command<DRIVE_M2, __u8> rc_cmd_drive_m2;
+typedef rc_command<DRIVE_FORWARD, __u8> rc_cmd_drive_forward;
+typedef rc_command<DRIVE_BACKWARDS, __u8> rc_cmd_drive_backwards;
+typedef rc_command<TURN_RIGHT, __u8> rc_cmd_turn_right;
+typedef rc_command<TURN_LEFT, __u8> rc_cmd_turn_left;
+typedef rc_command<DRIVE_FORWARD_OR_BACKWARD, __u8> rc_cmd_drive;
+typedef rc_command<TURN_LEFT_OR_RIGHT, __u8> rc_cmd_turn;
+typedef rc_command<SET_MINIMUM_LOGIC_VOLTAGE_LEVEL, __u8> rc_cmd_set_minimum_logic_voltage_level;
+typedef rc_command<SET_MAXIMUM_LOGIC_VOLTAGE_LEVEL, __u8> rc_cmd_set_maximum_logic_voltage_level;
+typedef rc_command<RESET_QUADRATURE_ENCODER_COUNTERS> rc_cmd_reset_encoder_counters;
+// d, p, i, qpps
+typedef rc_command<SET_PID_CONSTANTS_M1, __u32, __u32, __u32, __u32> rc_cmd_set_pid_consts_m1;
+typedef rc_command<SET_PID_CONSTANTS_M2, __u32, __u32, __u32, __u32> rc_cmd_set_pid_consts_m2;
+typedef rc_command<DRIVE_M1_SPEED, __s32> rc_cmd_drive_m1_speed;
+typedef rc_command<DRIVE_M2_SPEED, __s32> rc_cmd_drive_m2_speed;
+typedef rc_command<MIX_MODE_DRIVE_SPEED, __s32, __s32> rc_cmd_drive_speed;
+typedef rc_command<DRIVE_M1_SPEED_ACCEL, __u32, __s32> rc_cmd_drive_m1_speed_accel;
+typedef rc_command<DRIVE_M2_SPEED_ACCEL, __u32, __s32> rc_cmd_drive_m2_speed_accel;
+typedef rc_command<MIX_MODE_DRIVE_SPEED_ACCEL, __u32, __s32, __s32> rc_cmd_drive_speed_accel;
+typedef rc_command<BUFFERED_M1_DRIVE_SPEED_DIST, __s32, __u32, __u8> rc_cmd_buffered_m1_drive_speed_dist;
+typedef rc_command<BUFFERED_M2_DRIVE_SPEED_DIST, __s32, __u32, __u8> rc_cmd_buffered_m2_drive_speed_dist;
+typedef rc_command<BUFFERED_MIX_MODE_DRIVE_SPEED_DIST, __s32, __u32, __s32, __u32, __u8> rc_cmd_buffered_drive_speed_dist;
+typedef rc_command<BUFFERED_M1_DRIVE_SPEED_ACCEL_DIST, __u32, __s32, __u32, __u8> rc_cmd_buffered_m1_drive_speed_accel_dist;
+typedef rc_command<BUFFERED_M2_DRIVE_SPEED_ACCEL_DIST, __u32, __s32, __u32, __u8> rc_cmd_buffered_m2_drive_speed_accel_dist;
+typedef rc_command<BUFFERED_MIX_MODE_SPEED_ACCEL_DISTANCE, __u32, __s32, __u32, __s32, __u32, __u8> rc_cmd_buffered_drive_speed_accel_dist;
+
+typedef rc_query<READ_MAIN_BATTEY_VOLTAGE_LEVEL, __u16> rc_qry_read_main_battery_voltage_level;
+typedef rc_query<READ_LOGIC_BATTERY_VOLTAGE_LEVEL, __u16> rc_qry_read_logic_battery_voltage_level;
+// value, status
+typedef rc_query<READ_QUADRATURE_ENCODER_REGISTER_M1, __u32, __u8> rc_qry_read_encoder_register_m1;
+typedef rc_query<READ_QUADRATURE_ENCODER_REGISTER_M2, __u32, __u8> rc_qry_read_encoder_register_m2;
+// value, direction
+typedef rc_query<READ_SPEED_M1, __u32, __u8> rc_qry_read_speed_m1;
+typedef rc_query<READ_SPEED_M2, __u32, __u8> rc_qry_read_speed_m2;
+typedef rc_query<READ_CURRENT_SPEED_M1, __u32> rc_qry_read_speed125_m1;
+typedef rc_query<READ_CURRENT_SPEED_M2, __u32> rc_qry_read_speed125_m2;
+// m1, m2
+typedef rc_query<READ_BUFFER_LENGTH, __u8, __u8> rc_qry_read_buffer_length;
+// p, i, d, qpps
+typedef rc_query<READ_PID_CONST_M1, __u32, __u32, __u32, __u32> rc_qry_read_pid_const_m1;
+typedef rc_query<READ_PID_CONST_M2, __u32, __u32, __u32, __u32> rc_qry_read_pid_const_m2;
+typedef rc_query<READ_TEMPERATURE, __u16> rc_qry_read_temperature;
+typedef rc_query<READ_ERROR_STATUS, __u8> rc_qry_read_error_status;
+
+#endif /* ROBOCLAW_PACKET_H_ */
@@ -0,0 +1,189 @@
+/*
+ * RoboclawTopology.cpp
+ *
+ *  Created on: 17-10-2026
+ */
+
+#include <sstream>
+
+#include "RoboclawTopology.h"
+
+using namespace std;
+
+#define RC_MIN_ADDRESS 0x80
+#define RC_MAX_ADDRESS (RC_MIN_ADDRESS + RC_MAX_CONTROLLERS - 1)
+
+void RoboclawTopology::parse(RoboclawConfiguration *configuration, const vector<string>& controllerLines,
+		const vector<string>& wheelLines) {
+
+	configuration->controllers.clear();
+	configuration->wheels.clear();
+
+	for (vector<string>::const_iterator it = controllerLines.begin(); it != controllerLines.end(); ++it) {
+		istringstream in(*it);
+		RoboclawControllerConfiguration controller;
+		unsigned int address;
+
+		if (!(in >> controller.name >> address)) {
+			throw runtime_error("malformed controller: " + *it);
+		}
+
+		if (address < RC_MIN_ADDRESS || address > RC_MAX_ADDRESS) {
+			throw runtime_error("controller address out of range: " + *it);
+		}
+
+		if (!(in >> controller.uart_port)) {
+			controller.uart_port = configuration->uart_port;
+		}
+
+		controller.address = (__u8)address;
+		configuration->controllers.push_back(controller);
+	}
+
+	for (vector<string>::const_iterator it = wheelLines.begin(); it != wheelLines.end(); ++it) {
+		istringstream in(*it);
+		RoboclawWheelConfiguration wheel;
+		string controller;
+		string side;
+
+		if (!(in >> wheel.name >> controller >> wheel.motor >> side)) {
+			throw runtime_error("malformed wheel: " + *it);
+		}
+
+		wheel.controller = -1;
+		for (unsigned int i = 0; i < configuration->controllers.size(); i++) {
+			if (configuration->controllers[i].name == controller) {
+				wheel.controller = (int)i;
+			}
+		}
+
+		if (wheel.controller < 0) {
+			throw runtime_error("wheel on unknown controller: " + *it);
+		}
+
+		if (wheel.motor != 1 && wheel.motor != 2) {
+			throw runtime_error("wheel motor is neither 1 nor 2: " + *it);
+		}
+
+		if (side == "left") {
+			wheel.side = RC_WHEEL_LEFT;
+		} else if (side == "right") {
+			wheel.side = RC_WHEEL_RIGHT;
+		} else {
+			throw runtime_error("wheel side is neither left nor right: " + *it);
+		}
+
+		configuration->wheels.push_back(wheel);
+	}
+
+	validate(configuration);
+}
+
+void RoboclawTopology::setDefault(RoboclawConfiguration *configuration, __u8 frontAddress, __u8 rearAddress) {
+	static const char *wheelNames[4] = { "front_right", "front_left", "rear_right", "rear_left" };
+
+	configuration->controllers.clear();
+	configuration->wheels.clear();
+
+	RoboclawControllerConfiguration controller;
+	controller.uart_port = configuration->uart_port;
+
+	controller.name = "front";
+	controller.address = frontAddress;
+	configuration->controllers.push_back(controller);
+
+	controller.name = "rear";
+	controller.address = rearAddress;
+	configuration->controllers.push_back(controller);
+
+	for (int i = 0; i < 4; i++) {
+		RoboclawWheelConfiguration wheel;
+		wheel.name = wheelNames[i];
+		wheel.controller = i / 2;
+		wheel.motor = i % 2 + 1;
+		wheel.side = i % 2 == 0 ? RC_WHEEL_RIGHT : RC_WHEEL_LEFT;
+
+		configuration->wheels.push_back(wheel);
+	}
+
+	validate(configuration);
+}
+
+vector<string> RoboclawTopology::getPorts(RoboclawConfiguration *configuration) {
+	vector<string> ports;
+
+	for (unsigned int i = 0; i < configuration->controllers.size(); i++) {
+		const string& port = configuration->controllers[i].uart_port;
+
+		bool known = false;
+		for (unsigned int j = 0; j < ports.size(); j++) {
+			known = known || ports[j] == port;
+		}
+
+		if (!known) {
+			ports.push_back(port);
+		}
+	}
+
+	return ports;
+}
+
+void RoboclawTopology::validate(RoboclawConfiguration *configuration) {
+	vector<RoboclawControllerConfiguration>& controllers = configuration->controllers;
+	vector<RoboclawWheelConfiguration>& wheels = configuration->wheels;
+
+	if (controllers.empty() || controllers.size() > RC_MAX_CONTROLLERS) {
+		throw runtime_error("number of controllers out of range");
+	}
+
+	for (unsigned int i = 0; i < controllers.size(); i++) {
+		for (unsigned int j = 0; j < i; j++) {
+			if (controllers[i].name == controllers[j].name) {
+				throw runtime_error("controller defined twice: " + controllers[i].name);
+			}
+
+			// packet serial addresses only have to differ on one port
+			if (controllers[i].address == controllers[j].address && controllers[i].uart_port == controllers[j].uart_port) {
+				throw runtime_error("controllers " + controllers[j].name + " and " + controllers[i].name + " share an address");
+			}
+		}
+	}
+
+	bool left = false;
+	bool right = false;
+
+	for (unsigned int i = 0; i < wheels.size(); i++) {
+		for (unsigned int j = 0; j < i; j++) {
+			if (wheels[i].name == wheels[j].name) {
+				throw runtime_error("wheel defined twice: " + wheels[i].name);
+			}
+
+			if (wheels[i].controller == wheels[j].controller && wheels[i].motor == wheels[j].motor) {
+				throw runtime_error("wheels " + wheels[j].name + " and " + wheels[i].name + " share a motor");
+			}
+		}
+
+		left = left || wheels[i].side == RC_WHEEL_LEFT;
+		right = right || wheels[i].side == RC_WHEEL_RIGHT;
+	}
+
+	// skid-steer, turning needs both sides
+	if (!left || !right) {
+		throw runtime_error("wheel map needs wheels on both sides");
+	}
+
+	configuration->front_left_wheel = findWheel(configuration, "front_left");
+	configuration->front_right_wheel = findWheel(configuration, "front_right");
+	configuration->rear_left_wheel = findWheel(configuration, "rear_left");
+	configuration->rear_right_wheel = findWheel(configuration, "rear_right");
+}
+
+int RoboclawTopology::findWheel(RoboclawConfiguration *configuration, const string& name) {
+	for (unsigned int i = 0; i < configuration->wheels.size(); i++) {
+		if (configuration->wheels[i].name == name) {
+			return (int)i;
+		}
+	}
+
+	return -1;
+}
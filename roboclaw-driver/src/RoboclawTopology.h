@@ -0,0 +1,40 @@
+/*
+ * RoboclawTopology.h
+ *
+ *  Created on: 17-10-2026
+ */
+
+#ifndef ROBOCLAWTOPOLOGY_H_
+#define ROBOCLAWTOPOLOGY_H_
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "RoboclawCommon.h"
+
+/*
+ * Builds the controllers and wheel map of RoboclawConfiguration, either
+ * from "controller" and "wheel" configuration lines or, without them, the
+ * original front/rear pair sharing uart_port.
+ */
+class RoboclawTopology {
+
+public:
+	// controller lines: <name> <address> [uart_port], uart_port by default
+	// wheel lines: <name> <controller name> <1|2> <left|right>
+	static void parse(RoboclawConfiguration *configuration, const std::vector<std::string>& controllerLines,
+			const std::vector<std::string>& wheelLines);
+
+	// motor 1 of each controller drives the right wheel
+	static void setDefault(RoboclawConfiguration *configuration, __u8 frontAddress, __u8 rearAddress);
+
+	// distinct ports in the order their first controller comes
+	static std::vector<std::string> getPorts(RoboclawConfiguration *configuration);
+
+private:
+	static void validate(RoboclawConfiguration *configuration);
+	static int findWheel(RoboclawConfiguration *configuration, const std::string& name);
+};
+
+#endif /* ROBOCLAWTOPOLOGY_H_ */
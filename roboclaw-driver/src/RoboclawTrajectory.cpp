@@ -0,0 +1,240 @@
+/*
+ * RoboclawTrajectory.cpp
+ *
+ *  Created on: 17-10-2026
+ */
+
+#include <algorithm>
+
+#include <boost/interprocess/sync/scoped_lock.hpp>
+#include <boost/thread/thread_time.hpp>
+
+#include "RoboclawTrajectory.h"
+#include "RoboclawLib.h"
+
+using namespace boost;
+using namespace boost::interprocess;
+using namespace log4cxx;
+
+LoggerPtr RoboclawTrajectory::_logger (Logger::getLogger("Roboclaw.Trajectory"));
+
+RoboclawTrajectory::RoboclawTrajectory(RoboclawDriver *driver, RoboclawConfiguration *configuration,
+		RoboclawTrajectoryListener *listener): _driver(driver), _configuration(configuration), _listener(listener),
+		_sent(0), _completed(0), _generation(0), _clientId(0), _synNum(0), _active(false), _sending(false),
+		_trajectoryThread(NULL) {
+
+}
+
+RoboclawTrajectory::~RoboclawTrajectory() {
+
+}
+
+void RoboclawTrajectory::start() {
+	_trajectoryThread = new boost::thread(boost::ref(*this));
+}
+
+void RoboclawTrajectory::follow(int clientId, int synNum, const std::vector<MotorsSegmentStruct>& segments) {
+	cancel();
+
+	LOG4CXX_INFO(_logger, "Following trajectory of " << segments.size() << " segments, client: " << clientId);
+
+	scoped_lock<interprocess_mutex> lock(_trajectoryMutex);
+
+	_segments = segments;
+	_sent = 0;
+	_completed = 0;
+	_generation++;
+	_clientId = clientId;
+	_synNum = synNum;
+	_active = !_segments.empty();
+
+	_trajectoryChanged.notify_all();
+}
+
+bool RoboclawTrajectory::cancel() {
+	RoboclawTrajectoryProgress progress;
+	int clientId;
+	int synNum;
+
+	{
+		scoped_lock<interprocess_mutex> lock(_trajectoryMutex);
+
+		if (!_active) {
+			return false;
+		}
+
+		_active = false;
+		_generation++;
+
+		fillProgress(&progress);
+		clientId = _clientId;
+		synNum = _synNum;
+
+		_trajectoryChanged.notify_all();
+
+		// a segment already on its way is the last one, at most one bus job to wait for
+		while (_sending) {
+			_trajectoryChanged.wait(lock);
+		}
+	}
+
+	LOG4CXX_INFO(_logger, "Trajectory cancelled, completed: " << progress.completed << "/" << progress.total);
+
+	_listener->handleTrajectoryProgress(clientId, synNum, &progress);
+
+	return true;
+}
+
+bool RoboclawTrajectory::isActive() {
+	scoped_lock<interprocess_mutex> lock(_trajectoryMutex);
+
+	return _active;
+}
+
+void RoboclawTrajectory::operator()() {
+	LOG4CXX_INFO(_logger, "Trajectory thread started, poll interval: " << _configuration->trajectory_poll_interval
+			<< "ms, queue depth: " << _configuration->trajectory_queue_depth);
+
+	MotorsBufferStruct buffers;
+	RoboclawTrajectoryProgress progress;
+
+	while (1) {
+		__u32 generation;
+		bool fresh;
+
+		{
+			scoped_lock<interprocess_mutex> lock(_trajectoryMutex);
+
+			while (!_active) {
+				_trajectoryChanged.wait(lock);
+			}
+
+			generation = _generation;
+			fresh = _sent == 0;
+		}
+
+		// nothing of a new trajectory is buffered yet, its first segment drops whatever is left of the old one
+		buffers.valid = false;
+
+		if (!fresh) {
+			try {
+				_driver->readBufferLengths(&buffers);
+			} catch (RoboclawSerialException& e) {
+				// do nothing
+			}
+		}
+
+		int clientId;
+		int synNum;
+
+		if (update(generation, &buffers, &progress, &clientId, &synNum)) {
+			_listener->handleTrajectoryProgress(clientId, synNum, &progress);
+		}
+
+		// a new trajectory doesn't wait for the poll
+		scoped_lock<interprocess_mutex> lock(_trajectoryMutex);
+
+		if (_generation == generation) {
+			_trajectoryChanged.timed_wait(lock, boost::get_system_time() +
+					boost::posix_time::milliseconds(_configuration->trajectory_poll_interval));
+		}
+	}
+}
+
+// Counts segments finished by all wheels and tops the buffers up, true if there is progress to report.
+// Segments are sent without the lock, so cancel() and isActive() don't wait behind a whole refill.
+bool RoboclawTrajectory::update(__u32 generation, MotorsBufferStruct *buffers, RoboclawTrajectoryProgress *progress,
+		int *clientId, int *synNum) {
+	scoped_lock<interprocess_mutex> lock(_trajectoryMutex);
+
+	// replaced or cancelled while the buffers were read
+	if (_generation != generation || !_active) {
+		return false;
+	}
+
+	bool changed = false;
+
+	if (buffers->valid) {
+		__u32 pending = 0;
+		bool idle = true;
+
+		for (unsigned int i = 0; i < _configuration->wheels.size(); i++) {
+			// the length counts the commands waiting, the one executing comes on top
+			if (buffers->length[i] != RC_BUFFER_IDLE) {
+				idle = false;
+				pending = std::max(pending, (__u32)buffers->length[i] + 1);
+			}
+		}
+
+		__u32 completed = pending < _sent ? _sent - pending : 0;
+		if (completed > _completed) {
+			_completed = completed;
+			changed = true;
+		}
+
+		if (idle && _sent == _segments.size()) {
+			LOG4CXX_INFO(_logger, "Trajectory finished, segments: " << _sent);
+
+			_completed = _sent;
+			_active = false;
+			changed = true;
+		}
+	}
+
+	bool failed = false;
+
+	while (_active && _sent < _segments.size() && _sent - _completed < _configuration->trajectory_queue_depth) {
+		MotorsSegmentStruct segment = _segments[_sent];
+		bool now = _sent == 0;
+		bool sent = false;
+
+		_sending = true;
+		lock.unlock();
+
+		try {
+			sent = _driver->sendBufferedSegment(&segment, now);
+		} catch (RoboclawSerialException& e) {
+			// do nothing
+		}
+
+		lock.lock();
+		_sending = false;
+		_trajectoryChanged.notify_all();
+
+		// cancel() has reported it already, follow() starts over with a segment that drops this one
+		if (_generation != generation) {
+			return false;
+		}
+
+		if (!sent) {
+			LOG4CXX_WARN(_logger, "Unable to send trajectory segment " << _sent << ", stopping motors");
+
+			_active = false;
+			_generation++;
+			failed = true;
+		} else {
+			_sent++;
+		}
+
+		changed = true;
+	}
+
+	fillProgress(progress);
+	*clientId = _clientId;
+	*synNum = _synNum;
+
+	if (failed) {
+		lock.unlock();
+		_driver->stopMotors();
+	}
+
+	return changed;
+}
+
+void RoboclawTrajectory::fillProgress(RoboclawTrajectoryProgress *progress) {
+	progress->total = (__u32)_segments.size();
+	progress->completed = _completed;
+	progress->queued = _sent - _completed;
+	progress->finished = !_active;
+	progress->cancelled = !_active && _completed < progress->total;
+}
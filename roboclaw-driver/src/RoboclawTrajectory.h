@@ -0,0 +1,87 @@
+/*
+ * RoboclawTrajectory.h
+ *
+ *  Created on: 17-10-2026
+ */
+
+#ifndef ROBOCLAWTRAJECTORY_H_
+#define ROBOCLAWTRAJECTORY_H_
+
+#include <vector>
+
+#include <boost/thread.hpp>
+#include <boost/interprocess/sync/interprocess_condition.hpp>
+#include <boost/interprocess/sync/interprocess_mutex.hpp>
+#include <log4cxx/logger.h>
+
+#include "RoboclawCommon.h"
+#include "RoboclawDriver.h"
+
+struct RoboclawTrajectoryProgress {
+
+	__u32 total;		// segments in the trajectory
+	__u32 completed;	// finished by all wheels
+	__u32 queued;		// sent to the controllers, not finished yet
+	bool finished;
+	bool cancelled;
+
+};
+
+class RoboclawTrajectoryListener {
+public:
+	virtual ~RoboclawTrajectoryListener() {};
+	virtual void handleTrajectoryProgress(int clientId, int synNum, RoboclawTrajectoryProgress *progress) = 0;
+};
+
+/*
+ * Feeds a trajectory into the controllers' onboard buffers, at most
+ * trajectory_queue_depth segments ahead of the slowest wheel, and reports
+ * progress whenever a segment completes. Timing between segments is left
+ * to the controllers, the driver only polls buffer lengths.
+ */
+class RoboclawTrajectory {
+
+public:
+	RoboclawTrajectory(RoboclawDriver *driver, RoboclawConfiguration *configuration, RoboclawTrajectoryListener *listener);
+	virtual ~RoboclawTrajectory();
+
+	void start();
+
+	// replaces the running trajectory, if any
+	void follow(int clientId, int synNum, const std::vector<MotorsSegmentStruct>& segments);
+
+	// motors are commanded some other way, nothing is sent after it returns; true if a trajectory was running
+	bool cancel();
+
+	bool isActive();
+
+	void operator()();
+
+private:
+	static log4cxx::LoggerPtr _logger;
+
+	RoboclawDriver *_driver;
+	RoboclawConfiguration *_configuration;
+	RoboclawTrajectoryListener *_listener;
+
+	// not held during bus I/O, cancel() waits out a send in progress instead
+	boost::interprocess::interprocess_mutex _trajectoryMutex;
+	boost::interprocess::interprocess_condition _trajectoryChanged;
+
+	std::vector<MotorsSegmentStruct> _segments;
+	__u32 _sent;
+	__u32 _completed;
+	__u32 _generation;		// bumped by follow() and cancel()
+	int _clientId;
+	int _synNum;
+	bool _active;
+	bool _sending;			// a segment is on the bus, the lock is released meanwhile
+
+	boost::thread *_trajectoryThread;
+
+	bool update(__u32 generation, MotorsBufferStruct *buffers, RoboclawTrajectoryProgress *progress,
+			int *clientId, int *synNum);
+	void fillProgress(RoboclawTrajectoryProgress *progress);
+};
+
+#endif /* ROBOCLAWTRAJECTORY_H_ */
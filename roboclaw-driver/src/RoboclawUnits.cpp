@@ -0,0 +1,49 @@
+/*
+ * RoboclawUnits.cpp
+ *
+ *  Created on: 17-10-2026
+ */
+
+#include <cmath>
+
+#include "RoboclawUnits.h"
+
+RoboclawUnits::RoboclawUnits(const RoboclawConfiguration *configuration) {
+	if (configuration->wheel_radius == 0 || configuration->pulses_per_revolution == 0) {
+		throw std::runtime_error("wheel_radius and pulses_per_revolution must not be 0");
+	}
+
+	double pulsesPerMm = configuration->pulses_per_revolution / (2 * M_PI * configuration->wheel_radius);
+
+	_toPulses = makeScale(pulsesPerMm);
+	_toMm = makeScale(1.0 / pulsesPerMm);
+}
+
+void RoboclawUnits::toQpps(const int *mm, int *pulses, int count) const {
+	for (int i = 0; i < count; i++) {
+		pulses[i] = scale(mm[i], _toPulses);
+	}
+}
+
+void RoboclawUnits::toMmps(const int *pulses, int *mm, int count) const {
+	for (int i = 0; i < count; i++) {
+		mm[i] = scale(pulses[i], _toMm);
+	}
+}
+
+RoboclawUnits::Scale RoboclawUnits::makeScale(double ratio) {
+	if (ratio >= 2147483648.0) {
+		throw std::runtime_error("wheel_radius and pulses_per_revolution too far apart");
+	}
+
+	Scale s;
+	s.whole = (__s64)floor(ratio);
+	s.fraction = (__s64)floor((ratio - (double)s.whole) * 4294967296.0 + 0.5);
+
+	if (s.fraction == ((__s64)1 << 32)) {
+		s.whole++;
+		s.fraction = 0;
+	}
+
+	return s;
+}
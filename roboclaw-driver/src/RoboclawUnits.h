@@ -0,0 +1,66 @@
+/*
+ * RoboclawUnits.h
+ *
+ *  Created on: 17-10-2026
+ */
+
+#ifndef ROBOCLAWUNITS_H_
+#define ROBOCLAWUNITS_H_
+
+#include <climits>
+#include <stdexcept>
+
+#include "RoboclawCommon.h"
+
+/*
+ * Millimetres to encoder pulses and back, for distances, speeds and
+ * accelerations alike. Both scales are fixed point, worked out once from
+ * wheel_radius and pulses_per_revolution, so a conversion is two integer
+ * multiplies and a shift, rounded to the nearest with halves away from
+ * zero. Commands and reports round the same way, a speed read back shows
+ * as commanded.
+ */
+class RoboclawUnits {
+
+public:
+	// throws std::runtime_error if the wheel has no size or no pulses
+	RoboclawUnits(const RoboclawConfiguration *configuration);
+
+	int toQpps(int mm) const {
+		return scale(mm, _toPulses);
+	}
+
+	int toMmps(int pulses) const {
+		return scale(pulses, _toMm);
+	}
+
+	// whole wheel map at once, in and out may be the same array
+	void toQpps(const int *mm, int *pulses, int count) const;
+	void toMmps(const int *pulses, int *mm, int count) const;
+
+private:
+	// ratio = whole + fraction / 2^32
+	struct Scale {
+		__s64 whole;
+		__s64 fraction;
+	};
+
+	Scale _toPulses;
+	Scale _toMm;
+
+	static Scale makeScale(double ratio);
+
+	// |in| <= 2^31, whole < 2^31 and fraction < 2^32, neither product can overflow
+	static int scale(int in, const Scale& s) {
+		__s64 magnitude = in < 0 ? -(__s64)in : (__s64)in;
+		__s64 out = magnitude * s.whole + ((magnitude * s.fraction + ((__s64)1 << 31)) >> 32);
+
+		if (out > INT_MAX) {
+			out = INT_MAX;
+		}
+
+		return in < 0 ? -(int)out : (int)out;
+	}
+};
+
+#endif /* ROBOCLAWUNITS_H_ */
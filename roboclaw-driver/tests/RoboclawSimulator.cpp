@@ -0,0 +1,557 @@
+/*
+ * RoboclawSimulator.cpp
+ *
+ *  Created on: 17-10-2026
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <time.h>
+
+#include "RoboclawSimulator.h"
+#include "RoboclawLib.h"
+
+using namespace boost::interprocess;
+
+#define SIM_FIRMWARE_VERSION "Roboclaw 2x15A v3.1.5 (sim)\n"
+#define SIM_DEFAULT_QPPS 13800
+#define SIM_PACKET_MAX 64
+#define SIM_SLEEP_GRANULARITY_US 200
+
+static __u32 sim_u32(__u8 *buf) {
+	return ((__u32)buf[0] << 24) | ((__u32)buf[1] << 16) | ((__u32)buf[2] << 8) | buf[3];
+}
+
+static void sim_put_u32(__u8 *buf, __u32 value) {
+	buf[0] = BYTE(value, 3);
+	buf[1] = BYTE(value, 2);
+	buf[2] = BYTE(value, 1);
+	buf[3] = BYTE(value, 0);
+}
+
+RoboclawSimulator::RoboclawSimulator(const RoboclawSimulatorConfiguration &configuration):
+		_configuration(configuration), _thread(NULL), _running(false),
+		_randState(configuration.seed), _lastUpdate(0), _lineFree(0), _lineIdle(true) {
+
+	memset(&_stats, 0, sizeof(_stats));
+
+	_masterFd = posix_openpt(O_RDWR | O_NOCTTY);
+	if (_masterFd < 0 || grantpt(_masterFd) < 0 || unlockpt(_masterFd) < 0) {
+		perror("posix_openpt");
+		exit(1);
+	}
+
+	struct termios termios;
+	tcgetattr(_masterFd, &termios);
+	cfmakeraw(&termios);
+	tcsetattr(_masterFd, TCSANOW, &termios);
+
+	_portName = ptsname(_masterFd);
+}
+
+RoboclawSimulator::~RoboclawSimulator() {
+	stop();
+	close(_masterFd);
+}
+
+const std::string &RoboclawSimulator::getPortName() {
+	return _portName;
+}
+
+void RoboclawSimulator::addController(__u8 address) {
+	scoped_lock<interprocess_mutex> lock(_mutex);
+
+	Controller controller;
+
+	for (int i = 0; i < 2; i++) {
+		Motor &motor = controller.motors[i];
+		motor.speed = 0.0;
+		motor.target = 0;
+		motor.accel = _configuration.default_accel;
+		motor.encoder = 0.0;
+		motor.distance_left = 0.0;
+		motor.buffered_active = false;
+		motor.p = motor.i = motor.d = 0;
+		motor.qpps = SIM_DEFAULT_QPPS;
+	}
+
+	controller.error_status = RC_ERROR_NORMAL;
+	controller.temperature = 250;
+	controller.main_battery = 120;
+	controller.logic_battery = 50;
+
+	_controllers[address] = controller;
+}
+
+void RoboclawSimulator::start() {
+	_running = true;
+	_lastUpdate = rc_monotonic_us();
+	_thread = new boost::thread(boost::bind(&RoboclawSimulator::run, this));
+}
+
+void RoboclawSimulator::stop() {
+	if (_thread != NULL) {
+		_running = false;
+		_thread->join();
+		delete _thread;
+		_thread = NULL;
+	}
+}
+
+__s32 RoboclawSimulator::getSpeed(__u8 address, int motor) {
+	scoped_lock<interprocess_mutex> lock(_mutex);
+	return (__s32)lround(_controllers[address].motors[motor].speed);
+}
+
+__u32 RoboclawSimulator::getEncoder(__u8 address, int motor) {
+	scoped_lock<interprocess_mutex> lock(_mutex);
+	return (__u32)(__s64)floor(_controllers[address].motors[motor].encoder);
+}
+
+void RoboclawSimulator::setErrorStatus(__u8 address, __u8 status) {
+	scoped_lock<interprocess_mutex> lock(_mutex);
+	_controllers[address].error_status = status;
+}
+
+void RoboclawSimulator::setTemperature(__u8 address, __u16 temperature) {
+	scoped_lock<interprocess_mutex> lock(_mutex);
+	_controllers[address].temperature = temperature;
+}
+
+RoboclawSimulatorStats RoboclawSimulator::getStats() {
+	scoped_lock<interprocess_mutex> lock(_mutex);
+	return _stats;
+}
+
+double RoboclawSimulator::random() {
+	return rand_r(&_randState) / ((double)RAND_MAX + 1.0);
+}
+
+void RoboclawSimulator::lineDelay(int bytes) {
+	if (_configuration.baud == 0) {
+		return;
+	}
+
+	// bytes are consumed from the pty at line speed, so the sender's TIOCOUTQ behaves like on a real UART
+	// the line only restarts from now after it was seen idle, oversleeping must not accumulate
+	__u64 now = rc_monotonic_us();
+	if (_lineIdle) {
+		if (_lineFree < now) {
+			_lineFree = now;
+		}
+		_lineIdle = false;
+	}
+	_lineFree += (__u64)bytes * 10 * 1000000 / _configuration.baud;
+
+	if (_lineFree > now + SIM_SLEEP_GRANULARITY_US) {
+		boost::this_thread::sleep(boost::posix_time::microseconds((long)(_lineFree - now)));
+	}
+}
+
+void RoboclawSimulator::lineFlush() {
+	__u64 now = rc_monotonic_us();
+
+	if (_lineFree > now) {
+		boost::this_thread::sleep(boost::posix_time::microseconds((long)(_lineFree - now)));
+	}
+}
+
+int RoboclawSimulator::argumentsSize(__u8 command) {
+	// bytes following address and command, including checksum of write commands
+	switch (command) {
+	case DRIVE_FORWARD_M1: case DRIVE_BACKWARDS_M1:
+	case SET_MINIMUM_MAIN_VOLTAGE: case SET_MAXIMUM_MAIN_VOLTAGE:
+	case DRIVE_FORWARD_M2: case DRIVE_BACKWARDS_M2:
+	case DRIVE_M1: case DRIVE_M2:
+	case DRIVE_FORWARD: case DRIVE_BACKWARDS:
+	case TURN_RIGHT: case TURN_LEFT:
+	case DRIVE_FORWARD_OR_BACKWARD: case TURN_LEFT_OR_RIGHT:
+	case SET_MINIMUM_LOGIC_VOLTAGE_LEVEL: case SET_MAXIMUM_LOGIC_VOLTAGE_LEVEL:
+	case SET_PWM_RESOLUTION:
+		return 2;
+
+	case READ_QUADRATURE_ENCODER_REGISTER_M1: case READ_QUADRATURE_ENCODER_REGISTER_M2:
+	case READ_SPEED_M1: case READ_SPEED_M2:
+	case RESET_QUADRATURE_ENCODER_COUNTERS:
+	case READ_FIRMWARE_VERSION:
+	case READ_MAIN_BATTEY_VOLTAGE_LEVEL: case READ_LOGIC_BATTERY_VOLTAGE_LEVEL:
+	case READ_CURRENT_SPEED_M1: case READ_CURRENT_SPEED_M2:
+	case READ_BUFFER_LENGTH:
+	case READ_PID_CONST_M1: case READ_PID_CONST_M2:
+	case READ_TEMPERATURE:
+	case READ_ERROR_STATUS:
+		return 0;
+
+	case SET_PID_CONSTANTS_M1: case SET_PID_CONSTANTS_M2:
+		return 17;
+
+	case DRIVE_M1_DUTY_CYCLE: case DRIVE_M2_DUTY_CYCLE:
+		return 3;
+	case MIX_MODE_DRIVE_DUTY_CYCLE:
+		return 5;
+
+	case DRIVE_M1_SPEED: case DRIVE_M2_SPEED:
+		return 5;
+	case MIX_MODE_DRIVE_SPEED:
+	case DRIVE_M1_SPEED_ACCEL: case DRIVE_M2_SPEED_ACCEL:
+		return 9;
+	case MIX_MODE_DRIVE_SPEED_ACCEL:
+		return 13;
+	case BUFFERED_M1_DRIVE_SPEED_DIST: case BUFFERED_M2_DRIVE_SPEED_DIST:
+		return 10;
+	case BUFFERED_MIX_MODE_DRIVE_SPEED_DIST:
+		return 18;
+	case BUFFERED_M1_DRIVE_SPEED_ACCEL_DIST: case BUFFERED_M2_DRIVE_SPEED_ACCEL_DIST:
+		return 14;
+	case BUFFERED_MIX_MODE_SPEED_ACCEL_DISTANCE:
+		return 22;
+
+	case WRITE_TO_EEPROM:
+		return 1;
+
+	default:
+		return -1;
+	}
+}
+
+void RoboclawSimulator::run() {
+	__u8 packet[SIM_PACKET_MAX];
+	int size = 0;
+	struct pollfd pfd;
+
+	pfd.fd = _masterFd;
+	pfd.events = POLLIN;
+
+	while (_running) {
+		int res = poll(&pfd, 1, 1);
+		if (res == 0) {
+			_lineIdle = true;
+		}
+
+		if (res > 0 && (pfd.revents & POLLIN)) {
+			__u8 c;
+			if (read(_masterFd, &c, 1) != 1) {
+				continue;
+			}
+
+			// a packet always starts with an address
+			if (size == 0 && c < 0x80) {
+				continue;
+			}
+
+			lineDelay(1);
+			packet[size++] = c;
+
+			if (size >= 2) {
+				int args = argumentsSize(packet[1]);
+				if (args < 0) {
+					scoped_lock<interprocess_mutex> lock(_mutex);
+					_stats.unknown++;
+					size = 0;
+				} else if (size == 2 + args) {
+					lineFlush();
+					handlePacket(packet, size);
+					size = 0;
+				}
+			}
+		}
+
+		scoped_lock<interprocess_mutex> lock(_mutex);
+		update();
+	}
+}
+
+void RoboclawSimulator::update() {
+	__u64 now = rc_monotonic_us();
+	double dt = (double)(now - _lastUpdate) / 1e6;
+	_lastUpdate = now;
+
+	for (std::map<__u8, Controller>::iterator it = _controllers.begin(); it != _controllers.end(); ++it) {
+		updateMotor(it->second.motors[0], dt);
+		updateMotor(it->second.motors[1], dt);
+	}
+}
+
+void RoboclawSimulator::updateMotor(Motor &motor, double dt) {
+	if (motor.buffered_active && motor.distance_left <= 0.0) {
+		if (!motor.buffer.empty()) {
+			BufferedCommand next = motor.buffer.front();
+			motor.buffer.pop_front();
+
+			motor.target = next.speed;
+			motor.accel = next.accel;
+			motor.distance_left = next.dist;
+		} else {
+			motor.buffered_active = false;
+			motor.target = 0;
+		}
+	}
+
+	double step = motor.accel * dt;
+	double diff = motor.target - motor.speed;
+
+	if (fabs(diff) <= step) {
+		motor.speed = motor.target;
+	} else {
+		motor.speed += diff > 0 ? step : -step;
+	}
+
+	motor.encoder += motor.speed * dt;
+	if (motor.buffered_active) {
+		motor.distance_left -= fabs(motor.speed * dt);
+	}
+}
+
+void RoboclawSimulator::setSpeed(Motor &motor, __s32 speed, __u32 accel) {
+	motor.buffer.clear();
+	motor.buffered_active = false;
+	motor.target = speed;
+	motor.accel = accel;
+}
+
+void RoboclawSimulator::queueBuffered(Motor &motor, __u32 accel, __s32 speed, __u32 dist, __u8 now) {
+	BufferedCommand command;
+	command.accel = accel;
+	command.speed = speed;
+	command.dist = dist;
+
+	if (now) {
+		motor.buffer.clear();
+		motor.distance_left = 0.0;
+	}
+
+	motor.buffer.push_back(command);
+	motor.buffered_active = true;
+}
+
+void RoboclawSimulator::sendReply(__u8 address, __u8 command, __u8 *data, int size) {
+	__u8 sum = (__u8)(address + command);
+	for (int i = 0; i < size - 1; i++) {
+		sum = (__u8)(sum + data[i]);
+	}
+	data[size - 1] = sum & 0x7F;
+
+	if (random() < _configuration.reply_loss) {
+		_stats.lost++;
+		return;
+	}
+
+	if (random() < _configuration.reply_corruption) {
+		int pos = (int)(random() * size);
+		data[pos] = (__u8)(data[pos] ^ (1 << (int)(random() * 7)));
+		_stats.corrupted++;
+	}
+
+	_stats.replies++;
+
+	_mutex.unlock();
+	if (_configuration.baud > 0) {
+		boost::this_thread::sleep(boost::posix_time::microseconds((long)((__u64)size * 10 * 1000000 / _configuration.baud)));
+	}
+	if (write(_masterFd, data, size) != size) {
+		perror("write");
+	}
+	_mutex.lock();
+}
+
+void RoboclawSimulator::handlePacket(__u8 *packet, int size) {
+	scoped_lock<interprocess_mutex> lock(_mutex);
+
+	__u8 address = packet[0];
+	__u8 command = packet[1];
+	__u8 *args = packet + 2;
+
+	_stats.packets++;
+
+	if (_controllers.count(address) == 0) {
+		return;
+	}
+
+	// write commands carry checksum of the whole packet
+	if (size > 2 && command != WRITE_TO_EEPROM) {
+		__u8 sum = 0;
+		for (int i = 0; i < size - 1; i++) {
+			sum = (__u8)(sum + packet[i]);
+		}
+
+		if ((sum & 0x7F) != packet[size - 1]) {
+			_stats.bad_crc++;
+			return;
+		}
+	}
+
+	update();
+
+	Controller &controller = _controllers[address];
+	Motor *m = controller.motors;
+	__u8 reply[SIM_PACKET_MAX];
+
+	switch (command) {
+	case DRIVE_FORWARD_M1:
+		setSpeed(m[0], (__s32)m[0].qpps * args[0] / 127, _configuration.default_accel);
+		break;
+	case DRIVE_BACKWARDS_M1:
+		setSpeed(m[0], -(__s32)m[0].qpps * args[0] / 127, _configuration.default_accel);
+		break;
+	case DRIVE_FORWARD_M2:
+		setSpeed(m[1], (__s32)m[1].qpps * args[0] / 127, _configuration.default_accel);
+		break;
+	case DRIVE_BACKWARDS_M2:
+		setSpeed(m[1], -(__s32)m[1].qpps * args[0] / 127, _configuration.default_accel);
+		break;
+	case DRIVE_FORWARD:
+		setSpeed(m[0], (__s32)m[0].qpps * args[0] / 127, _configuration.default_accel);
+		setSpeed(m[1], (__s32)m[1].qpps * args[0] / 127, _configuration.default_accel);
+		break;
+	case DRIVE_BACKWARDS:
+		setSpeed(m[0], -(__s32)m[0].qpps * args[0] / 127, _configuration.default_accel);
+		setSpeed(m[1], -(__s32)m[1].qpps * args[0] / 127, _configuration.default_accel);
+		break;
+
+	case SET_PID_CONSTANTS_M1:
+	case SET_PID_CONSTANTS_M2: {
+		Motor &motor = m[command == SET_PID_CONSTANTS_M1 ? 0 : 1];
+		motor.d = sim_u32(args);
+		motor.p = sim_u32(args + 4);
+		motor.i = sim_u32(args + 8);
+		motor.qpps = sim_u32(args + 12);
+		break;
+	}
+
+	case RESET_QUADRATURE_ENCODER_COUNTERS:
+		m[0].encoder = 0.0;
+		m[1].encoder = 0.0;
+		break;
+
+	case DRIVE_M1_SPEED:
+		setSpeed(m[0], (__s32)sim_u32(args), _configuration.default_accel);
+		break;
+	case DRIVE_M2_SPEED:
+		setSpeed(m[1], (__s32)sim_u32(args), _configuration.default_accel);
+		break;
+	case MIX_MODE_DRIVE_SPEED:
+		setSpeed(m[0], (__s32)sim_u32(args), _configuration.default_accel);
+		setSpeed(m[1], (__s32)sim_u32(args + 4), _configuration.default_accel);
+		break;
+	case DRIVE_M1_SPEED_ACCEL:
+		setSpeed(m[0], (__s32)sim_u32(args + 4), sim_u32(args));
+		break;
+	case DRIVE_M2_SPEED_ACCEL:
+		setSpeed(m[1], (__s32)sim_u32(args + 4), sim_u32(args));
+		break;
+	case MIX_MODE_DRIVE_SPEED_ACCEL:
+		setSpeed(m[0], (__s32)sim_u32(args + 4), sim_u32(args));
+		setSpeed(m[1], (__s32)sim_u32(args + 8), sim_u32(args));
+		break;
+
+	case BUFFERED_M1_DRIVE_SPEED_DIST:
+		queueBuffered(m[0], _configuration.default_accel, (__s32)sim_u32(args), sim_u32(args + 4), args[8]);
+		break;
+	case BUFFERED_M2_DRIVE_SPEED_DIST:
+		queueBuffered(m[1], _configuration.default_accel, (__s32)sim_u32(args), sim_u32(args + 4), args[8]);
+		break;
+	case BUFFERED_MIX_MODE_DRIVE_SPEED_DIST:
+		queueBuffered(m[0], _configuration.default_accel, (__s32)sim_u32(args), sim_u32(args + 4), args[16]);
+		queueBuffered(m[1], _configuration.default_accel, (__s32)sim_u32(args + 8), sim_u32(args + 12), args[16]);
+		break;
+	case BUFFERED_M1_DRIVE_SPEED_ACCEL_DIST:
+		queueBuffered(m[0], sim_u32(args), (__s32)sim_u32(args + 4), sim_u32(args + 8), args[12]);
+		break;
+	case BUFFERED_M2_DRIVE_SPEED_ACCEL_DIST:
+		queueBuffered(m[1], sim_u32(args), (__s32)sim_u32(args + 4), sim_u32(args + 8), args[12]);
+		break;
+	case BUFFERED_MIX_MODE_SPEED_ACCEL_DISTANCE:
+		queueBuffered(m[0], sim_u32(args), (__s32)sim_u32(args + 4), sim_u32(args + 8), args[20]);
+		queueBuffered(m[1], sim_u32(args), (__s32)sim_u32(args + 12), sim_u32(args + 16), args[20]);
+		break;
+
+	case READ_QUADRATURE_ENCODER_REGISTER_M1:
+	case READ_QUADRATURE_ENCODER_REGISTER_M2: {
+		Motor &motor = m[command == READ_QUADRATURE_ENCODER_REGISTER_M1 ? 0 : 1];
+		sim_put_u32(reply, (__u32)(__s64)floor(motor.encoder));
+		reply[4] = motor.speed < 0 ? 0x02 : 0x00;
+		sendReply(address, command, reply, 6);
+		break;
+	}
+
+	case READ_SPEED_M1:
+	case READ_SPEED_M2: {
+		Motor &motor = m[command == READ_SPEED_M1 ? 0 : 1];
+		long speed = lround(motor.speed);
+		sim_put_u32(reply, (__u32)labs(speed));
+		reply[4] = speed < 0 ? 1 : 0;
+		sendReply(address, command, reply, 6);
+		break;
+	}
+
+	case READ_CURRENT_SPEED_M1:
+	case READ_CURRENT_SPEED_M2: {
+		Motor &motor = m[command == READ_CURRENT_SPEED_M1 ? 0 : 1];
+		sim_put_u32(reply, (__u32)(labs(lround(motor.speed)) / 125));
+		sendReply(address, command, reply, 5);
+		break;
+	}
+
+	case READ_FIRMWARE_VERSION: {
+		int len = (int)strlen(SIM_FIRMWARE_VERSION) + 1;
+		memcpy(reply, SIM_FIRMWARE_VERSION, len);
+		sendReply(address, command, reply, len + 1);
+		break;
+	}
+
+	case READ_MAIN_BATTEY_VOLTAGE_LEVEL:
+		reply[0] = BYTE(controller.main_battery, 1);
+		reply[1] = BYTE(controller.main_battery, 0);
+		sendReply(address, command, reply, 3);
+		break;
+
+	case READ_LOGIC_BATTERY_VOLTAGE_LEVEL:
+		reply[0] = BYTE(controller.logic_battery, 1);
+		reply[1] = BYTE(controller.logic_battery, 0);
+		sendReply(address, command, reply, 3);
+		break;
+
+	case READ_BUFFER_LENGTH:
+		// commands still waiting, the executing one isn't counted
+		for (int i = 0; i < 2; i++) {
+			reply[i] = m[i].buffered_active ? (__u8)m[i].buffer.size() : 0x80;
+		}
+		sendReply(address, command, reply, 3);
+		break;
+
+	case READ_PID_CONST_M1:
+	case READ_PID_CONST_M2: {
+		Motor &motor = m[command == READ_PID_CONST_M1 ? 0 : 1];
+		sim_put_u32(reply, motor.p);
+		sim_put_u32(reply + 4, motor.i);
+		sim_put_u32(reply + 8, motor.d);
+		sim_put_u32(reply + 12, motor.qpps);
+		sendReply(address, command, reply, 17);
+		break;
+	}
+
+	case READ_TEMPERATURE:
+		reply[0] = BYTE(controller.temperature, 1);
+		reply[1] = BYTE(controller.temperature, 0);
+		sendReply(address, command, reply, 3);
+		break;
+
+	case READ_ERROR_STATUS:
+		reply[0] = controller.error_status;
+		sendReply(address, command, reply, 2);
+		break;
+
+	case WRITE_TO_EEPROM:
+		sendReply(address, command, reply, 1);
+		break;
+
+	default:
+		break;
+	}
+}
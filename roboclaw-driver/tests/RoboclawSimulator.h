@@ -0,0 +1,115 @@
+/*
+ * RoboclawSimulator.h
+ *
+ *  Created on: 17-10-2026
+ */
+
+#ifndef ROBOCLAWSIMULATOR_H_
+#define ROBOCLAWSIMULATOR_H_
+
+#include <linux/types.h>
+#include <string>
+#include <map>
+#include <deque>
+
+#include <boost/thread.hpp>
+#include <boost/interprocess/sync/interprocess_mutex.hpp>
+#include <boost/interprocess/sync/scoped_lock.hpp>
+
+struct RoboclawSimulatorConfiguration {
+	unsigned int baud;			// 0 - no line delay
+	double reply_loss;			// probability of dropping a reply
+	double reply_corruption;	// probability of flipping a byte in a reply
+	__u32 default_accel;		// qpps/s used by commands without acceleration
+	unsigned int seed;
+
+	RoboclawSimulatorConfiguration(): baud(38400), reply_loss(0.0), reply_corruption(0.0),
+			default_accel(50000), seed(1) {}
+};
+
+struct RoboclawSimulatorStats {
+	unsigned long packets;
+	unsigned long replies;
+	unsigned long lost;
+	unsigned long corrupted;
+	unsigned long bad_crc;
+	unsigned long unknown;
+};
+
+/*
+ * Packet serial Roboclaw running on the master side of a pseudo-terminal.
+ * Bytes are consumed and replies sent at the configured baud rate, motors
+ * ramp towards their setpoints with the configured acceleration.
+ */
+class RoboclawSimulator {
+public:
+	RoboclawSimulator(const RoboclawSimulatorConfiguration &configuration);
+	virtual ~RoboclawSimulator();
+
+	// path of the slave side, to be opened with rc_uart_open()
+	const std::string &getPortName();
+
+	void addController(__u8 address);
+	void start();
+	void stop();
+
+	__s32 getSpeed(__u8 address, int motor);
+	__u32 getEncoder(__u8 address, int motor);
+	void setErrorStatus(__u8 address, __u8 status);
+	void setTemperature(__u8 address, __u16 temperature);
+	RoboclawSimulatorStats getStats();
+
+private:
+	struct BufferedCommand {
+		__u32 accel;
+		__s32 speed;
+		__u32 dist;
+	};
+
+	struct Motor {
+		double speed;
+		__s32 target;
+		__u32 accel;
+		double encoder;
+		double distance_left;
+		bool buffered_active;
+		std::deque<BufferedCommand> buffer;
+		__u32 p, i, d, qpps;
+	};
+
+	struct Controller {
+		Motor motors[2];
+		__u8 error_status;
+		__u16 temperature;
+		__u16 main_battery;
+		__u16 logic_battery;
+	};
+
+	RoboclawSimulatorConfiguration _configuration;
+	std::map<__u8, Controller> _controllers;
+	RoboclawSimulatorStats _stats;
+	boost::interprocess::interprocess_mutex _mutex;
+	boost::thread *_thread;
+
+	int _masterFd;
+	std::string _portName;
+	volatile bool _running;
+	unsigned int _randState;
+	__u64 _lastUpdate;
+	__u64 _lineFree;
+	bool _lineIdle;
+
+	void run();
+	void update();
+	void updateMotor(Motor &motor, double dt);
+	int argumentsSize(__u8 command);
+	void handlePacket(__u8 *packet, int size);
+	void sendReply(__u8 address, __u8 command, __u8 *data, int size);
+	void lineDelay(int bytes);
+	void lineFlush();
+	void setSpeed(Motor &motor, __s32 speed, __u32 accel);
+	void queueBuffered(Motor &motor, __u32 accel, __s32 speed, __u32 dist, __u8 now);
+	double random();
+};
+
+#endif /* ROBOCLAWSIMULATOR_H_ */
@@ -0,0 +1,90 @@
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+#include <linux/types.h>
+#include <time.h>
+#include <vector>
+#include <algorithm>
+#include "RoboclawLib.h"
+#include <termios.h>
+
+void print_usage();
+double now_us();
+void bench_baud(int fd, __u8 address, __u32 baud, int samples);
+
+void print_usage() {
+	printf("usage: baud_bench port address samples baud [baud ...]\n");
+	printf("Roboclaw must be set to the same baud rate before each run.\n");
+}
+
+double now_us() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (double)ts.tv_sec * 1e6 + (double)ts.tv_nsec / 1e3;
+}
+
+void bench_baud(int fd, __u8 address, __u32 baud, int samples) {
+	std::vector<double> latencies;
+	__u32 value;
+	__u8 direction;
+	int errors = 0;
+
+	if (rc_uart_init_baud(fd, baud) < 0) {
+		printf("%u: rc_uart_init_baud: error\n", baud);
+		return;
+	}
+
+	for (int i = 0; i < samples; i++) {
+		double start = now_us();
+
+		if (rc_read_speed_m1(fd, address, &value, &direction) < 0) {
+			errors++;
+			continue;
+		}
+
+		latencies.push_back(now_us() - start);
+	}
+
+	if (latencies.empty()) {
+		printf("%u: no replies\n", baud);
+		return;
+	}
+
+	std::sort(latencies.begin(), latencies.end());
+
+	double sum = 0.0;
+	for (unsigned int i = 0; i < latencies.size(); i++) {
+		sum += latencies[i];
+	}
+
+	double mean = sum / (double)latencies.size();
+
+	printf("%7u: mean %8.1f us, p50 %8.1f us, p99 %8.1f us, max %8.1f us, 4 wheels %6.2f ms, errors %d/%d\n",
+			baud, mean, latencies[latencies.size() / 2], latencies[latencies.size() * 99 / 100],
+			latencies.back(), 4 * mean / 1000.0, errors, samples);
+}
+
+int main(int argc, char *argv[]) {
+
+	if (argc < 5) {
+		print_usage();
+		return 1;
+	}
+
+	int fd = rc_uart_open(argv[1]);
+	if (fd < 0) {
+		printf("unable to open %s\n", argv[1]);
+		return 1;
+	}
+
+	__u8 address = (__u8)atoi(argv[2]);
+	int samples = atoi(argv[3]);
+
+	for (int i = 4; i < argc; i++) {
+		bench_baud(fd, address, (__u32)atoi(argv[i]), samples);
+	}
+
+	rc_uart_close(fd);
+	return 0;
+}
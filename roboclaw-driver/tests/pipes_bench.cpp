@@ -0,0 +1,211 @@
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <algorithm>
+#include <unistd.h>
+#include <linux/types.h>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <log4cxx/propertyconfigurator.h>
+
+#include "AmberPipes.h"
+#include "RoboclawLib.h"
+#include "drivermsg.pb.h"
+#include "roboclaw.pb.h"
+
+// glibc's own, every other allocator call ends up here
+extern "C" void *__libc_malloc(size_t size);
+
+static volatile unsigned long allocations;
+
+extern "C" void *malloc(size_t size) {
+	__sync_fetch_and_add(&allocations, 1);
+	return __libc_malloc(size);
+}
+
+class NullHandler: public MessageHandler {
+public:
+	void handleDataMsg(amber::DriverHdr *, amber::DriverMsg *) {}
+	void handleClientDiedMsg(int) {}
+};
+
+struct ReaderResult {
+	unsigned long frames;
+	unsigned long bytes;
+	unsigned long bad;
+};
+
+void print_usage();
+void make_message(amber::DriverMsg *message, int size);
+void read_frames(int fd, size_t frameLength, ReaderResult *result);
+void bench_size(int size, int megabytes);
+void check_oversize();
+
+static const int sizes[] = { 16, 64, 256, 1024, 4096, 16384, 0xffff };
+
+void print_usage() {
+	printf("usage: pipes_bench [-n megabytes] log_conf\n");
+	printf("Pushes messages from 16B to 64KB through AmberPipes and reads them back from the pipe.\n");
+}
+
+// a wheel speeds message padded with speeds up to the size asked for
+void make_message(amber::DriverMsg *message, int size) {
+	message->set_type(amber::DriverMsg_MsgType_DATA);
+	amber::roboclaw_proto::WheelsSpeed *speeds = message->MutableExtension(amber::roboclaw_proto::currentWheelsSpeed);
+
+	// 100 and -100 take two bytes each, a longer length prefix may overshoot
+	while (message->ByteSize() < size) {
+		speeds->add_speeds(speeds->speeds_size() % 2 ? 100 : -100);
+	}
+
+	while (message->ByteSize() > size) {
+		speeds->mutable_speeds()->RemoveLast();
+	}
+}
+
+// every frame the same length, counts the ones that aren't
+void read_frames(int fd, size_t frameLength, ReaderResult *result) {
+	std::vector<unsigned char> buffer(PIPE_IN_BUFFER_SIZE);
+	size_t start = 0, end = 0;
+
+	while (1) {
+		ssize_t in = read(fd, &buffer[end], buffer.size() - end);
+		if (in <= 0) {
+			return;
+		}
+
+		end += (size_t)in;
+		result->bytes += (unsigned long)in;
+
+		while (end - start >= 4) {
+			size_t headerLen = (buffer[start] << 8) | buffer[start + 1];
+			if (end - start < 2 + headerLen + 2) {
+				break;
+			}
+
+			size_t length = 2 + headerLen + 2 + ((buffer[start + 2 + headerLen] << 8) | buffer[start + 3 + headerLen]);
+			if (end - start < length) {
+				break;
+			}
+
+			result->frames++;
+			result->bad += length != frameLength;
+			start += length;
+		}
+
+		std::copy(buffer.begin() + start, buffer.begin() + end, buffer.begin());
+		end -= start;
+		start = 0;
+	}
+}
+
+void bench_size(int size, int megabytes) {
+	amber::DriverHdr header;
+	header.add_clientids(1);
+
+	amber::DriverMsg message;
+	make_message(&message, size);
+
+	size_t frameLength = 2 + header.ByteSize() + 2 + message.ByteSize();
+	int messages = (int)std::max((size_t)2000, (size_t)megabytes * 1024 * 1024 / frameLength);
+
+	int fds[2];
+	if (pipe(fds) < 0) {
+		perror("pipe");
+		exit(1);
+	}
+
+	NullHandler handler;
+	ReaderResult result = { 0, 0, 0 };
+
+	AmberPipes *pipes = new AmberPipes(&handler, -1, fds[1]);
+	boost::thread reader(boost::bind(read_frames, fds[0], frameLength, &result));
+
+	// the first round fills the pools
+	for (int i = 0; i < PIPE_OUT_QUEUE_SIZE + PIPE_OUT_BATCH; i++) {
+		pipes->writeMsgToPipe(&header, &message);
+	}
+
+	unsigned long allocationsBefore = allocations;
+	__u64 start = rc_monotonic_us();
+
+	for (int i = 0; i < messages; i++) {
+		pipes->writeMsgToPipe(&header, &message);
+	}
+
+	// flushes the queue
+	delete pipes;
+	double elapsed = (double)(rc_monotonic_us() - start);
+	unsigned long writeAllocations = allocations - allocationsBefore;
+
+	close(fds[1]);
+	reader.join();
+	close(fds[0]);
+
+	printf("%6d B message: %8.0f msg/s, %7.1f MB/s, %.3f allocations/msg, frames %lu/%d, bad %lu\n",
+			message.ByteSize(), messages / (elapsed / 1e6), (double)messages * (double)frameLength / elapsed,
+			(double)writeAllocations / messages, result.frames, messages + PIPE_OUT_QUEUE_SIZE + PIPE_OUT_BATCH, result.bad);
+}
+
+// one byte over the 16 bit length is refused, not truncated
+void check_oversize() {
+	amber::DriverHdr header;
+	header.add_clientids(1);
+
+	amber::DriverMsg message;
+	make_message(&message, 0xffff);
+
+	while (message.ByteSize() <= 0xffff) {
+		message.MutableExtension(amber::roboclaw_proto::currentWheelsSpeed)->add_speeds(100);
+	}
+
+	int fds[2];
+	if (pipe(fds) < 0) {
+		perror("pipe");
+		exit(1);
+	}
+
+	NullHandler handler;
+	AmberPipes pipes(&handler, -1, fds[1]);
+
+	try {
+		pipes.writeMsgToPipe(&header, &message);
+		printf("%6d B message: accepted, FAILED\n", message.ByteSize());
+	} catch (PipeException &e) {
+		printf("%6d B message: refused, OK\n", message.ByteSize());
+	}
+}
+
+int main(int argc, char *argv[]) {
+	int megabytes = 64;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:")) != -1) {
+		switch (opt) {
+		case 'n':
+			megabytes = atoi(optarg);
+			break;
+		default:
+			print_usage();
+			return 1;
+		}
+	}
+
+	if (optind >= argc || megabytes <= 0) {
+		print_usage();
+		return 1;
+	}
+
+	log4cxx::PropertyConfigurator::configure(argv[optind]);
+
+	printf("%d MB per size, queue %d, batch %d\n", megabytes, PIPE_OUT_QUEUE_SIZE, PIPE_OUT_BATCH);
+
+	for (unsigned int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		bench_size(sizes[i], megabytes);
+	}
+
+	check_oversize();
+
+	return 0;
+}
@@ -0,0 +1,461 @@
+#include <cstdio>
+#include <cstdlib>
+#include <csignal>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <linux/types.h>
+
+#include <boost/thread.hpp>
+#include <log4cxx/propertyconfigurator.h>
+
+#include "RoboclawSimulator.h"
+#include "RoboclawDriver.h"
+#include "RoboclawTopology.h"
+#include "RoboclawLib.h"
+#include "drivermsg.pb.h"
+#include "roboclaw.pb.h"
+
+#define FRONT_ADDRESS 129
+#define REAR_ADDRESS 128
+
+void print_usage();
+void print_latencies(const char *name, std::vector<double> &latencies, double elapsed, int errors);
+void print_simulator_stats(RoboclawSimulator &simulator);
+std::string make_gpio_file();
+void make_configuration(RoboclawConfiguration *configuration, const std::string &port, unsigned int baud);
+void bench_driver(RoboclawSimulator &simulator, unsigned int baud, int samples);
+void write_configuration_file(const char *path, RoboclawConfiguration *configuration);
+bool write_message(int fd, amber::DriverMsg *message);
+bool read_message(int fd, amber::DriverMsg *message);
+bool read_exact(int fd, unsigned char *buffer, int len);
+void bench_controller(RoboclawSimulator &simulator, unsigned int baud, int samples, const char *driverPath,
+		const char *logConfFile);
+
+void print_usage() {
+	printf("usage: roboclaw_bench [-b baud] [-n samples] [-l reply_loss] [-c reply_corruption] log_conf [roboclaw_driver]\n");
+	printf("Runs the driver against the simulator, and the controller too if roboclaw_driver binary is given.\n");
+}
+
+void print_latencies(const char *name, std::vector<double> &latencies, double elapsed, int errors) {
+	if (latencies.empty()) {
+		printf("%-24s: no replies, errors %d\n", name, errors);
+		return;
+	}
+
+	std::sort(latencies.begin(), latencies.end());
+
+	printf("%-24s: %8.1f/s, p50 %8.1f us, p90 %8.1f us, p99 %8.1f us, max %8.1f us, errors %d/%u\n",
+			name, (double)latencies.size() / (elapsed / 1e6),
+			latencies[latencies.size() / 2], latencies[latencies.size() * 9 / 10],
+			latencies[latencies.size() * 99 / 100], latencies.back(),
+			errors, (unsigned int)latencies.size() + (unsigned int)errors);
+}
+
+void print_simulator_stats(RoboclawSimulator &simulator) {
+	RoboclawSimulatorStats stats = simulator.getStats();
+
+	printf("%-24s: packets %lu, replies %lu, lost %lu, corrupted %lu, bad crc %lu, unknown %lu\n", "simulator",
+			stats.packets, stats.replies, stats.lost, stats.corrupted, stats.bad_crc, stats.unknown);
+}
+
+std::string make_gpio_file() {
+	char path[] = "/tmp/roboclaw_bench_gpioXXXXXX";
+
+	int fd = mkstemp(path);
+	if (fd < 0) {
+		perror("mkstemp");
+		exit(1);
+	}
+	close(fd);
+
+	return path;
+}
+
+void make_configuration(RoboclawConfiguration *configuration, const std::string &port, unsigned int baud) {
+	configuration->uart_port = port;
+	configuration->uart_speed = baud > 0 ? baud : 38400;
+	configuration->uart_command_drain = false;
+	configuration->uart_reply_timeout = RC_UART_REPLY_TIMEOUT_US;
+	configuration->uart_stats_interval = 0;
+
+	configuration->bus_queue_size = 16;
+	configuration->bus_stats_interval = 0;
+
+	configuration->reset_gpio_path = make_gpio_file();
+	configuration->reset_delay = 10;
+	configuration->led1_gpio_path = make_gpio_file();
+	configuration->led2_gpio_path = make_gpio_file();
+
+	RoboclawTopology::setDefault(configuration, FRONT_ADDRESS, REAR_ADDRESS);
+
+	configuration->motors_max_qpps = 13800;
+	configuration->motors_p_const = 65536;
+	configuration->motors_i_const = 32768;
+	configuration->motors_d_const = 16384;
+	configuration->motors_command_keepalive = 500;
+
+	configuration->pulses_per_revolution = 1865;
+	configuration->wheel_radius = 60;
+
+	configuration->battery_monitor_interval = 10000;
+	configuration->error_monitor_interval = 100;
+	configuration->temperature_monitor_interval = 5000;
+	configuration->temperature_critical = 700;
+	configuration->temperature_drop = 600;
+	configuration->critical_read_repeats = 3;
+
+	configuration->speed_poll_interval = 20;
+	configuration->speed_max_age = 50;
+
+	configuration->stop_idle_timeout = 4000;
+	configuration->reset_idle_timeout = 7000;
+}
+
+void bench_driver(RoboclawSimulator &simulator, unsigned int baud, int samples) {
+	RoboclawConfiguration configuration;
+	make_configuration(&configuration, simulator.getPortName(), baud);
+
+	RoboclawDriver driver(&configuration);
+	driver.initializeDriver();
+
+	std::vector<double> latencies;
+	int errors = 0;
+
+	__u64 start = rc_monotonic_us();
+	for (int i = 0; i < samples; i++) {
+		// every frame differs, otherwise the setpoint cache skips it
+		int speed = 1000 + i % 1000;
+		MotorsSpeedStruct mss;
+		std::fill(mss.speed, mss.speed + RC_MAX_WHEELS, speed);
+		mss.acceleration = 0;
+
+		unsigned int failures = driver.getSerialFailures();
+		__u64 sendStart = rc_monotonic_us();
+		bool failed = false;
+		try {
+			driver.sendMotorsEncoderCommand(&mss);
+		} catch (RoboclawSerialException &e) {
+			failed = true;
+		}
+		__u64 elapsed = rc_monotonic_us() - sendStart;
+
+		// a port that failed is counted by the driver whether it threw or not
+		if (failed || driver.getSerialFailures() != failures) {
+			errors++;
+		} else {
+			latencies.push_back((double)elapsed);
+		}
+	}
+	print_latencies("driver motors command", latencies, (double)(rc_monotonic_us() - start), errors);
+
+	latencies.clear();
+	errors = 0;
+
+	start = rc_monotonic_us();
+	for (int i = 0; i < samples; i++) {
+		MotorsSpeedStruct mss;
+
+		unsigned int failures = driver.getSerialFailures();
+		__u64 readStart = rc_monotonic_us();
+		bool failed = false;
+		try {
+			driver.readCurrentSpeed(&mss);
+		} catch (RoboclawSerialException &e) {
+			failed = true;
+		}
+		__u64 elapsed = rc_monotonic_us() - readStart;
+
+		if (failed || driver.getSerialFailures() != failures) {
+			errors++;
+		} else {
+			latencies.push_back((double)elapsed);
+		}
+	}
+	print_latencies("driver current speed", latencies, (double)(rc_monotonic_us() - start), errors);
+
+	driver.stopMotors();
+
+	unlink(configuration.reset_gpio_path.c_str());
+	unlink(configuration.led1_gpio_path.c_str());
+	unlink(configuration.led2_gpio_path.c_str());
+}
+
+void write_configuration_file(const char *path, RoboclawConfiguration *configuration) {
+	FILE *file = fopen(path, "w");
+	if (file == NULL) {
+		perror("fopen");
+		exit(1);
+	}
+
+	fprintf(file, "[roboclaw]\n");
+	fprintf(file, "uart_port = %s\n", configuration->uart_port.c_str());
+	fprintf(file, "uart_speed = %u\n", configuration->uart_speed);
+	fprintf(file, "uart_command_drain = %d\n", configuration->uart_command_drain ? 1 : 0);
+	fprintf(file, "uart_reply_timeout = %u\n", configuration->uart_reply_timeout);
+	fprintf(file, "uart_stats_interval = %u\n", configuration->uart_stats_interval);
+	fprintf(file, "bus_queue_size = %u\n", configuration->bus_queue_size);
+	fprintf(file, "bus_stats_interval = %u\n", configuration->bus_stats_interval);
+	fprintf(file, "reset_gpio_path = %s\n", configuration->reset_gpio_path.c_str());
+	fprintf(file, "reset_delay = %u\n", configuration->reset_delay);
+	fprintf(file, "led1_gpio_path = %s\n", configuration->led1_gpio_path.c_str());
+	fprintf(file, "led2_gpio_path = %s\n", configuration->led2_gpio_path.c_str());
+	fprintf(file, "rear_rc_address = %u\n", configuration->controllers[1].address);
+	fprintf(file, "front_rc_address = %u\n", configuration->controllers[0].address);
+	fprintf(file, "motors_max_qpps = %u\n", configuration->motors_max_qpps);
+	fprintf(file, "motors_p_const = %u\n", configuration->motors_p_const);
+	fprintf(file, "motors_i_const = %u\n", configuration->motors_i_const);
+	fprintf(file, "motors_d_const = %u\n", configuration->motors_d_const);
+	fprintf(file, "motors_command_keepalive = %u\n", configuration->motors_command_keepalive);
+	fprintf(file, "pulses_per_revolution = %u\n", configuration->pulses_per_revolution);
+	fprintf(file, "wheel_radius = %u\n", configuration->wheel_radius);
+	fprintf(file, "battery_monitor_interval = %u\n", configuration->battery_monitor_interval);
+	fprintf(file, "error_monitor_interval = %u\n", configuration->error_monitor_interval);
+	fprintf(file, "temperature_monitor_interval = %u\n", configuration->temperature_monitor_interval);
+	fprintf(file, "temperature_critical = %u\n", configuration->temperature_critical);
+	fprintf(file, "temperature_drop = %u\n", configuration->temperature_drop);
+	fprintf(file, "critical_read_repeats = %u\n", configuration->critical_read_repeats);
+	fprintf(file, "speed_poll_interval = %u\n", configuration->speed_poll_interval);
+	fprintf(file, "speed_max_age = %u\n", configuration->speed_max_age);
+	fprintf(file, "stop_idle_timeout = %u\n", configuration->stop_idle_timeout);
+	fprintf(file, "reset_idle_timeout = %u\n", configuration->reset_idle_timeout);
+
+	fclose(file);
+}
+
+bool read_exact(int fd, unsigned char *buffer, int len) {
+	int got = 0;
+
+	while (got < len) {
+		ssize_t in = read(fd, buffer + got, (size_t)(len - got));
+		if (in <= 0) {
+			return false;
+		}
+		got += (int)in;
+	}
+
+	return true;
+}
+
+// same framing as AmberPipes: 2 bytes header length, header, 2 bytes message length, message
+bool write_message(int fd, amber::DriverMsg *message) {
+	amber::DriverHdr header;
+	header.set_devicetype(amber::ROBOCLAW);
+	header.add_clientids(1);
+
+	std::string headerData = header.SerializeAsString();
+	std::string messageData = message->SerializeAsString();
+
+	std::string frame;
+	frame += (char)((headerData.size() >> 8) & 0xff);
+	frame += (char)(headerData.size() & 0xff);
+	frame += headerData;
+	frame += (char)((messageData.size() >> 8) & 0xff);
+	frame += (char)(messageData.size() & 0xff);
+	frame += messageData;
+
+	return write(fd, frame.data(), frame.size()) == (ssize_t)frame.size();
+}
+
+bool read_message(int fd, amber::DriverMsg *message) {
+	unsigned char buffer[512];
+
+	for (int part = 0; part < 2; part++) {
+		if (!read_exact(fd, buffer, 2)) {
+			return false;
+		}
+
+		int len = (buffer[0] << 8) | buffer[1];
+		if (len > (int)sizeof(buffer) || !read_exact(fd, buffer, len)) {
+			return false;
+		}
+
+		if (part == 1) {
+			return message->ParseFromArray(buffer, len);
+		}
+	}
+
+	return false;
+}
+
+void bench_controller(RoboclawSimulator &simulator, unsigned int baud, int samples, const char *driverPath,
+		const char *logConfFile) {
+
+	RoboclawConfiguration configuration;
+	make_configuration(&configuration, simulator.getPortName(), baud);
+
+	char confPath[] = "/tmp/roboclaw_bench_confXXXXXX";
+	int confFd = mkstemp(confPath);
+	if (confFd < 0) {
+		perror("mkstemp");
+		exit(1);
+	}
+	close(confFd);
+	write_configuration_file(confPath, &configuration);
+
+	int toDriver[2], fromDriver[2];
+	if (pipe(toDriver) < 0 || pipe(fromDriver) < 0) {
+		perror("pipe");
+		exit(1);
+	}
+
+	pid_t pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		exit(1);
+	}
+
+	if (pid == 0) {
+		dup2(toDriver[0], 0);
+		dup2(fromDriver[1], 1);
+		close(toDriver[1]);
+		close(fromDriver[0]);
+
+		execl(driverPath, driverPath, confPath, logConfFile, (char *)NULL);
+		perror("execl");
+		_exit(1);
+	}
+
+	close(toDriver[0]);
+	close(fromDriver[1]);
+
+	std::vector<double> latencies;
+	unsigned int synNum = 0;
+
+	// the first answer also means the driver is up
+	for (int cached = 0; cached < 2; cached++) {
+		latencies.clear();
+		int errors = 0;
+
+		__u64 start = rc_monotonic_us();
+		for (int i = 0; i < samples; i++) {
+			amber::DriverMsg request;
+			request.set_type(amber::DriverMsg_MsgType_DATA);
+			request.set_synnum(++synNum);
+			request.SetExtension(amber::roboclaw_proto::currentSpeedRequest, true);
+			request.SetExtension(amber::roboclaw_proto::currentSpeedMaxAge, cached ? configuration.speed_max_age : 0);
+
+			RoboclawSimulatorStats stats = simulator.getStats();
+			__u64 requestStart = rc_monotonic_us();
+			amber::DriverMsg reply;
+
+			if (!write_message(toDriver[1], &request) || !read_message(fromDriver[0], &reply)) {
+				printf("roboclaw_driver died\n");
+				kill(pid, SIGTERM);
+				waitpid(pid, NULL, 0);
+				unlink(confPath);
+				return;
+			}
+
+			// the driver runs in its own process, its failed reads show up as replies the simulator lost or
+			// corrupted meanwhile, the pollers' included; a failed request still gets an answer, in zeros
+			RoboclawSimulatorStats after = simulator.getStats();
+			if (!reply.HasExtension(amber::roboclaw_proto::currentSpeed)
+					|| after.lost + after.corrupted != stats.lost + stats.corrupted) {
+				errors++;
+				continue;
+			}
+
+			if (i > 0 || cached) {
+				latencies.push_back((double)(rc_monotonic_us() - requestStart));
+			}
+		}
+		print_latencies(cached ? "controller cached speed" : "controller serial speed", latencies,
+				(double)(rc_monotonic_us() - start), errors);
+	}
+
+	RoboclawSimulatorStats before = simulator.getStats();
+
+	latencies.clear();
+	__u64 start = rc_monotonic_us();
+	for (int i = 0; i < samples; i++) {
+		amber::DriverMsg command;
+		command.set_type(amber::DriverMsg_MsgType_DATA);
+
+		amber::roboclaw_proto::MotorsSpeed *speed = command.MutableExtension(amber::roboclaw_proto::motorsCommand);
+		int value = 100 + i % 100;
+		speed->set_frontleftspeed(value);
+		speed->set_frontrightspeed(value);
+		speed->set_rearleftspeed(value);
+		speed->set_rearrightspeed(value);
+
+		__u64 commandStart = rc_monotonic_us();
+		write_message(toDriver[1], &command);
+		latencies.push_back((double)(rc_monotonic_us() - commandStart));
+	}
+	__u64 elapsed = rc_monotonic_us() - start;
+
+	// let the mailbox flush the last command
+	boost::this_thread::sleep(boost::posix_time::milliseconds(200));
+
+	print_latencies("controller motors post", latencies, (double)elapsed, 0);
+	printf("%-24s: %lu packets for %d commands\n", "controller on the wire",
+			simulator.getStats().packets - before.packets, samples);
+
+	close(toDriver[1]);
+	kill(pid, SIGTERM);
+	waitpid(pid, NULL, 0);
+
+	unlink(confPath);
+	unlink(configuration.reset_gpio_path.c_str());
+	unlink(configuration.led1_gpio_path.c_str());
+	unlink(configuration.led2_gpio_path.c_str());
+}
+
+int main(int argc, char *argv[]) {
+	RoboclawSimulatorConfiguration simulatorConfiguration;
+	int samples = 1000;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "b:n:l:c:")) != -1) {
+		switch (opt) {
+		case 'b':
+			simulatorConfiguration.baud = (unsigned int)atoi(optarg);
+			break;
+		case 'n':
+			samples = atoi(optarg);
+			break;
+		case 'l':
+			simulatorConfiguration.reply_loss = atof(optarg);
+			break;
+		case 'c':
+			simulatorConfiguration.reply_corruption = atof(optarg);
+			break;
+		default:
+			print_usage();
+			return 1;
+		}
+	}
+
+	if (optind >= argc || samples <= 0) {
+		print_usage();
+		return 1;
+	}
+
+	const char *logConfFile = argv[optind];
+	const char *driverPath = optind + 1 < argc ? argv[optind + 1] : NULL;
+
+	log4cxx::PropertyConfigurator::configure(logConfFile);
+
+	RoboclawSimulator simulator(simulatorConfiguration);
+	simulator.addController(FRONT_ADDRESS);
+	simulator.addController(REAR_ADDRESS);
+	simulator.start();
+
+	printf("baud %u, samples %d, reply loss %.3f, reply corruption %.3f\n", simulatorConfiguration.baud, samples,
+			simulatorConfiguration.reply_loss, simulatorConfiguration.reply_corruption);
+
+	bench_driver(simulator, simulatorConfiguration.baud, samples);
+	print_simulator_stats(simulator);
+
+	if (driverPath != NULL) {
+		bench_controller(simulator, simulatorConfiguration.baud, samples, driverPath, logConfFile);
+		print_simulator_stats(simulator);
+	}
+
+	simulator.stop();
+
+	return 0;
+}
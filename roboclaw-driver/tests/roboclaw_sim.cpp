@@ -0,0 +1,76 @@
+#include <cstdio>
+#include <cstdlib>
+#include <csignal>
+#include <unistd.h>
+#include <linux/types.h>
+
+#include "RoboclawSimulator.h"
+
+void print_usage();
+
+static volatile sig_atomic_t running = 1;
+
+static void handle_signal(int) {
+	running = 0;
+}
+
+void print_usage() {
+	printf("usage: roboclaw_sim [-b baud] [-l reply_loss] [-c reply_corruption] [-s seed] address [address ...]\n");
+	printf("Prints the pty to use as uart_port, runs until interrupted.\n");
+}
+
+int main(int argc, char *argv[]) {
+	RoboclawSimulatorConfiguration configuration;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "b:l:c:s:")) != -1) {
+		switch (opt) {
+		case 'b':
+			configuration.baud = (unsigned int)atoi(optarg);
+			break;
+		case 'l':
+			configuration.reply_loss = atof(optarg);
+			break;
+		case 'c':
+			configuration.reply_corruption = atof(optarg);
+			break;
+		case 's':
+			configuration.seed = (unsigned int)atoi(optarg);
+			break;
+		default:
+			print_usage();
+			return 1;
+		}
+	}
+
+	if (optind >= argc) {
+		print_usage();
+		return 1;
+	}
+
+	RoboclawSimulator simulator(configuration);
+
+	for (int i = optind; i < argc; i++) {
+		simulator.addController((__u8)atoi(argv[i]));
+	}
+
+	signal(SIGINT, handle_signal);
+	signal(SIGTERM, handle_signal);
+
+	simulator.start();
+
+	printf("%s\n", simulator.getPortName().c_str());
+	fflush(stdout);
+
+	while (running) {
+		pause();
+	}
+
+	simulator.stop();
+
+	RoboclawSimulatorStats stats = simulator.getStats();
+	printf("packets: %lu, replies: %lu, lost: %lu, corrupted: %lu, bad crc: %lu, unknown: %lu\n",
+			stats.packets, stats.replies, stats.lost, stats.corrupted, stats.bad_crc, stats.unknown);
+
+	return 0;
+}
@@ -0,0 +1,155 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+#include "RoboclawUnits.h"
+
+struct wheel {
+	__u32 radius;
+	__u32 pulses;
+};
+
+// the robot's wheel first, then small and large ratios both ways
+static const wheel wheels[] = { { 60, 1865 }, { 60, 64 }, { 1, 1 }, { 200, 48 }, { 35, 65536 }, { 5000, 200 } };
+
+#define RANGE 1000000
+
+int check_wheel(const wheel *w);
+int check_conversion(const char *name, const RoboclawUnits& units, bool toPulses, double ratio);
+int check_round_trip(const wheel *w, const RoboclawUnits& units, double pulsesPerMm);
+int check_batch(const RoboclawUnits& units);
+
+// exact rounding, halves away from zero; returns false near a half, where the fixed point scale may go either way
+static bool reference(int in, double ratio, long *out) {
+	long double exact = (long double)in * (long double)ratio;
+	long double fraction = fabsl(exact - truncl(exact));
+
+	*out = (long)(exact < 0 ? -floorl(-exact + 0.5L) : floorl(exact + 0.5L));
+
+	return fabsl(fraction - 0.5L) > 1e-6L * (1.0L + fabsl(exact));
+}
+
+int check_conversion(const char *name, const RoboclawUnits& units, bool toPulses, double ratio) {
+	int errors = 0;
+
+	for (int in = -RANGE; in <= RANGE; in += 7) {
+		int out = toPulses ? units.toQpps(in) : units.toMmps(in);
+		long expected;
+
+		if (!reference(in, ratio, &expected)) {
+			if (labs(out - expected) > 1) {
+				errors++;
+			}
+		} else if (out != expected) {
+			if (errors < 5) {
+				printf("  %s(%d): %d, expected %ld\n", name, in, out, expected);
+			}
+			errors++;
+		}
+	}
+
+	return errors;
+}
+
+// mm -> pulses -> mm comes back within half a pulse worth of mm, pulses -> mm -> pulses within half a mm worth of pulses
+int check_round_trip(const wheel *w, const RoboclawUnits& units, double pulsesPerMm) {
+	double mmBound = floor(0.5 + 0.5 / pulsesPerMm + 1e-9);
+	double pulsesBound = floor(0.5 + 0.5 * pulsesPerMm + 1e-9);
+	double mmWorst = 0, pulsesWorst = 0;
+	int errors = 0;
+
+	for (int in = -RANGE; in <= RANGE; in += 3) {
+		double mmError = fabs((double)units.toMmps(units.toQpps(in)) - in);
+		double pulsesError = fabs((double)units.toQpps(units.toMmps(in)) - in);
+
+		mmWorst = std::max(mmWorst, mmError);
+		pulsesWorst = std::max(pulsesWorst, pulsesError);
+
+		if (mmError > mmBound || pulsesError > pulsesBound) {
+			errors++;
+		}
+	}
+
+	printf("  radius %u, pulses %u: round trip error mm %.0f (bound %.0f), pulses %.0f (bound %.0f)\n",
+			w->radius, w->pulses, mmWorst, mmBound, pulsesWorst, pulsesBound);
+
+	return errors;
+}
+
+int check_batch(const RoboclawUnits& units) {
+	int in[RC_MAX_WHEELS];
+	int out[RC_MAX_WHEELS];
+	int errors = 0;
+
+	for (int i = 0; i < RC_MAX_WHEELS; i++) {
+		in[i] = (i - RC_MAX_WHEELS / 2) * 123457;
+	}
+
+	units.toQpps(in, out, RC_MAX_WHEELS);
+	for (int i = 0; i < RC_MAX_WHEELS; i++) {
+		errors += out[i] != units.toQpps(in[i]);
+	}
+
+	units.toMmps(in, out, RC_MAX_WHEELS);
+	for (int i = 0; i < RC_MAX_WHEELS; i++) {
+		errors += out[i] != units.toMmps(in[i]);
+	}
+
+	// in place
+	units.toQpps(in, in, RC_MAX_WHEELS);
+	for (int i = 0; i < RC_MAX_WHEELS; i++) {
+		errors += in[i] != units.toQpps((i - RC_MAX_WHEELS / 2) * 123457);
+	}
+
+	return errors;
+}
+
+int check_wheel(const wheel *w) {
+	RoboclawConfiguration configuration;
+	configuration.wheel_radius = w->radius;
+	configuration.pulses_per_revolution = w->pulses;
+
+	RoboclawUnits units(&configuration);
+	double pulsesPerMm = w->pulses / (2 * M_PI * w->radius);
+	int errors = 0;
+
+	errors += check_conversion("toQpps", units, true, pulsesPerMm);
+	errors += check_conversion("toMmps", units, false, 1.0 / pulsesPerMm);
+	errors += check_round_trip(w, units, pulsesPerMm);
+	errors += check_batch(units);
+
+	// the extremes saturate or stay in range, never wrap
+	int top = units.toQpps(2147483647);
+	int bottom = units.toQpps(-2147483647 - 1);
+	if (top < 0 || bottom > 0) {
+		printf("  extremes wrapped: %d %d\n", top, bottom);
+		errors++;
+	}
+
+	return errors;
+}
+
+int main() {
+	int errors = 0;
+
+	for (unsigned int i = 0; i < sizeof(wheels) / sizeof(wheels[0]); i++) {
+		errors += check_wheel(&wheels[i]);
+	}
+
+	RoboclawConfiguration configuration;
+	configuration.wheel_radius = 0;
+	configuration.pulses_per_revolution = 1865;
+
+	try {
+		RoboclawUnits units(&configuration);
+		printf("  wheel_radius 0 accepted\n");
+		errors++;
+	} catch (std::runtime_error& e) {
+		// expected
+	}
+
+	printf("%s, errors: %d\n", errors == 0 ? "OK" : "FAILED", errors);
+
+	return errors == 0 ? 0 : 1;
+}